@@ -0,0 +1,471 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "contour3d.h"
+#include "../src/contour3d/struct.h"
+#include "../src/contour3d/vector.h"
+#include "../src/contour3d/project.h"
+#include "../src/contour3d/canvas.h"
+#include "../src/contour3d/memory.h"
+#include "../src/contour3d/contour/internal.h"
+
+// single-process microbenchmarks of the kernels,
+//   which call them directly without MPI initialisation or domain decomposition:
+// - triangulation of slices            [ns / cell]
+//     through the general converter (point by point and batched)
+//     and through the uniform-grid identity fast path
+// - vertex normals of the middle slice [ns / triangle]
+// - projection of three vertices       [ns / triangle]
+// - rasterisation                      [ns / triangle] and [ns / pixel tested]
+
+static const double pi = 3.1415926535897932;
+
+typedef enum {
+  FIELD_SPHERE       = 0,
+  FIELD_RANDOM       = 1,
+  FIELD_CHECKERBOARD = 2,
+  NFIELDS            = 3,
+} field_t;
+
+static const char * const field_names[NFIELDS] = {
+  "sphere",
+  "random",
+  "checkerboard",
+};
+
+// keeps the results of the timed loops alive
+static volatile double sink = 0.;
+
+typedef struct {
+  size_t glsize;
+  size_t screen_sizes[2];
+  size_t repeats;
+  bool fields[NFIELDS];
+} options_t;
+
+static double get_time (
+    void
+) {
+  struct timespec ts = {0};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1.e-9 * ts.tv_nsec;
+}
+
+static int show_usage (
+    const char program[]
+) {
+  fprintf(stderr, "usage: %s [options]\n", program);
+  fprintf(stderr, "  --grid=N               number of grid points in each direction (128)\n");
+  fprintf(stderr, "  --resolution=WxH       screen resolution (1440x1080)\n");
+  fprintf(stderr, "  --repeats=N            number of measurements, the fastest is reported (5)\n");
+  fprintf(stderr, "  --field=NAME           sphere, random, or checkerboard (all)\n");
+  return 0;
+}
+
+static int parse_options (
+    const int argc,
+    char * argv[],
+    options_t * const options
+) {
+  bool is_field_given = false;
+  for (int n = 1; n < argc; n++) {
+    const char * const arg = argv[n];
+    const char * const value = strchr(arg, '=');
+    const char * const v = NULL == value ? "" : value + 1;
+    if (0 == strncmp(arg, "--grid=", 7)) {
+      if (1 != sscanf(v, "%zu", &options->glsize)) {
+        return 1;
+      }
+    } else if (0 == strncmp(arg, "--resolution=", 13)) {
+      if (2 != sscanf(v, "%zux%zu", options->screen_sizes + 0, options->screen_sizes + 1)) {
+        return 1;
+      }
+    } else if (0 == strncmp(arg, "--repeats=", 10)) {
+      if (1 != sscanf(v, "%zu", &options->repeats)) {
+        return 1;
+      }
+    } else if (0 == strncmp(arg, "--field=", 8)) {
+      if (!is_field_given) {
+        for (size_t m = 0; m < NFIELDS; m++) {
+          options->fields[m] = false;
+        }
+        is_field_given = true;
+      }
+      bool is_found = false;
+      for (size_t m = 0; m < NFIELDS; m++) {
+        if (0 == strcmp(v, field_names[m])) {
+          options->fields[m] = true;
+          is_found = true;
+        }
+      }
+      if (!is_found) {
+        return 1;
+      }
+    } else {
+      return 1;
+    }
+  }
+  if (options->glsize < 4 || 0 == options->repeats) {
+    return 1;
+  }
+  return 0;
+}
+
+// scalar field on a uniform grid in [-0.5 : +0.5]^3, normalised to [-1 : +1],
+//   whose iso-surface of 0 is extracted
+static int init_field (
+    const field_t field,
+    const size_t glsize,
+    double * const grid,
+    double * const array
+) {
+  for (size_t n = 0; n < glsize; n++) {
+    grid[n] = -0.5 + 0.5 * (2 * n + 1) / glsize;
+  }
+  const size_t nitems = glsize * glsize * glsize;
+  for (size_t index = 0; index < nitems; index++) {
+    array[index] = 0.;
+  }
+  if (FIELD_SPHERE == field) {
+    // signed distance from a sphere
+    for (size_t k = 0; k < glsize; k++) {
+      for (size_t j = 0; j < glsize; j++) {
+        for (size_t i = 0; i < glsize; i++) {
+          const double x = grid[i];
+          const double y = grid[j];
+          const double z = grid[k];
+          array[(k * glsize + j) * glsize + i] = 2. * (sqrt(x * x + y * y + z * z) - 0.35);
+        }
+      }
+    }
+    return 0;
+  }
+  if (FIELD_CHECKERBOARD == field) {
+    // every cell is cut by the iso-surface (worst case)
+    for (size_t k = 0; k < glsize; k++) {
+      for (size_t j = 0; j < glsize; j++) {
+        for (size_t i = 0; i < glsize; i++) {
+          array[(k * glsize + j) * glsize + i] = (i + j + k) % 2 ? +1. : -1.;
+        }
+      }
+    }
+    return 0;
+  }
+  // superposed sinusoidal functions with (seeded) random phases, as the demo
+  srand(0);
+  for (size_t kz = 1; kz < 5; kz += 1) {
+    for (size_t ky = 1; ky < 5; ky += 1) {
+      for (size_t kx = 1; kx < 5; kx += 1) {
+        const double yphase = 2. * pi * rand() / RAND_MAX;
+        const double zphase = 2. * pi * rand() / RAND_MAX;
+        for (size_t k = 0; k < glsize; k++) {
+          for (size_t j = 0; j < glsize; j++) {
+            for (size_t i = 0; i < glsize; i++) {
+              array[(k * glsize + j) * glsize + i] += 1.
+                * sin(2. * pi * kx * grid[i])
+                * sin(2. * pi * ky * grid[j] + yphase)
+                * sin(2. * pi * kz * grid[k] + zphase);
+            }
+          }
+        }
+      }
+    }
+  }
+  double min = + HUGE_VAL;
+  double max = - HUGE_VAL;
+  for (size_t index = 0; index < nitems; index++) {
+    min = fmin(min, array[index]);
+    max = fmax(max, array[index]);
+  }
+  for (size_t index = 0; index < nitems; index++) {
+    array[index] = (array[index] - min) / (max - min) * 2. - 1.;
+  }
+  return 0;
+}
+
+static contour3d_vector_t converter (
+    const contour3d_vector_t orthogonal
+) {
+  return orthogonal;
+}
+
+static void batch_converter (
+    const size_t npoints,
+    contour3d_vector_t * const points
+) {
+  for (size_t n = 0; n < npoints; n++) {
+    points[n] = converter(points[n]);
+  }
+}
+
+// pixels inside the bounding box of the projected triangle,
+//   which are tested by the rasteriser (see contour/render.c)
+static size_t count_tested_pixels (
+    const screen_t * const screen,
+    const contour3d_vector_t projected[3]
+) {
+  const int_fast32_t width  = screen->width;
+  const int_fast32_t height = screen->height;
+  double xmin = + HUGE_VAL;
+  double xmax = - HUGE_VAL;
+  double ymin = + HUGE_VAL;
+  double ymax = - HUGE_VAL;
+  for (size_t n = 0; n < 3; n++) {
+    xmin = fmin(xmin, projected[n].x);
+    xmax = fmax(xmax, projected[n].x);
+    ymin = fmin(ymin, projected[n].y);
+    ymax = fmax(ymax, projected[n].y);
+  }
+  const int_fast32_t imin = (0.5 + xmin) * width  - 1;
+  const int_fast32_t imax = (0.5 + xmax) * width  + 1;
+  const int_fast32_t jmin = (0.5 + ymin) * height - 1;
+  const int_fast32_t jmax = (0.5 + ymax) * height + 1;
+  const int_fast32_t ilower = imin < 0 ? 0 : width  - 1 < imin ? width  - 1 : imin;
+  const int_fast32_t iupper = imax < 0 ? 0 : width  - 1 < imax ? width  - 1 : imax;
+  const int_fast32_t jlower = jmin < 0 ? 0 : height - 1 < jmin ? height - 1 : jmin;
+  const int_fast32_t jupper = jmax < 0 ? 0 : height - 1 < jmax ? height - 1 : jmax;
+  return (size_t)(iupper - ilower + 1) * (size_t)(jupper - jlower + 1);
+}
+
+static int print_result (
+    const field_t field,
+    const char kernel[],
+    const size_t count,
+    const char unit[],
+    const double time
+) {
+  printf("%s,%s,%zu,%s,%.3f\n", field_names[field], kernel, count, unit, 0 == count ? 0. : 1.e9 * time / count);
+  return 0;
+}
+
+static int run (
+    const options_t * const options,
+    const field_t field
+) {
+  const size_t glsize = options->glsize;
+  double * const grid = malloc(glsize * sizeof(double));
+  double * const array = malloc(glsize * glsize * glsize * sizeof(double));
+  const size_t nlattices = (glsize - 1) * (glsize - 1);
+  lattice_t * const slices[3] = {
+    malloc(nlattices * sizeof(lattice_t)),
+    malloc(nlattices * sizeof(lattice_t)),
+    malloc(nlattices * sizeof(lattice_t)),
+  };
+  if (NULL == grid || NULL == array || NULL == slices[0] || NULL == slices[1] || NULL == slices[2]) {
+    fprintf(stderr, "failed to allocate field\n");
+    return 1;
+  }
+  init_field(field, glsize, grid, array);
+  // the general paths convert the intersections,
+  //   while the fast path computes the corners on the uniform grid and converts nothing
+  const mapping_t general = {
+    .is_uniform = false,
+    .converter = converter,
+  };
+  const mapping_t batched = {
+    .is_uniform = false,
+    .batch_converter = batch_converter,
+  };
+  mapping_t fast = {0};
+  const contour3d_contour_obj_t identity_obj = {
+    .glsizes = {glsize, glsize, glsize},
+    .grids = {grid, grid, grid},
+    .converter_kind = CONTOUR3D_CONVERTER_IDENTITY,
+  };
+  if (0 != contour3d_contour_init_mapping(&identity_obj, (size_t [2]) {0, 0}, &fast)) {
+    return 1;
+  }
+  // triangulation and vertex normals, slice by slice as the library does,
+  //   where the extracted triangles are kept for the following kernels
+  size_t capacity = 0;
+  size_t num_triangles = 0;
+  primitive_t * primitives = NULL;
+  double time_triangulate = HUGE_VAL;
+  double time_normals = HUGE_VAL;
+  size_t num_cells = 0;
+  size_t num_normals = 0;
+  for (size_t repeat = 0; repeat < options->repeats; repeat++) {
+    double time_t = 0.;
+    double time_n = 0.;
+    num_cells = 0;
+    num_normals = 0;
+    for (size_t k = 0; k < glsize - 1; k++) {
+      const double tic = get_time();
+      contour3d_contour_triangulate_slice(
+          (size_t [2]) {glsize, glsize},
+          (size_t [3]) {1, glsize, glsize * glsize},
+          (double * const [3]) {grid, grid, grid + k},
+          &general,
+          array + k * glsize * glsize,
+          NULL,
+          0.,
+          slices[k % 3]
+      );
+      time_t += get_time() - tic;
+      num_cells += nlattices;
+      if (k < 2) {
+        continue;
+      }
+      const double toc = get_time();
+      contour3d_contour_compute_vertex_normals(
+          (size_t [2]) {glsize, glsize},
+          (lattice_t * [3]) {slices[(k - 2) % 3], slices[(k - 1) % 3], slices[k % 3]}
+      );
+      time_n += get_time() - toc;
+      // keep the triangles whose normals are complete
+      const lattice_t * const middle = slices[(k - 1) % 3];
+      for (size_t j = 1; j < glsize - 2; j++) {
+        for (size_t i = 1; i < glsize - 2; i++) {
+          const lattice_t * const lattice = middle + j * (glsize - 1) + i;
+          num_normals += lattice->num_triangles;
+          if (0 != repeat) {
+            continue;
+          }
+          for (size_t n = 0; n < lattice->num_triangles; n++) {
+            if (capacity == num_triangles) {
+              capacity = 0 == capacity ? 1024 : 2 * capacity;
+              primitives = realloc(primitives, capacity * sizeof(primitive_t));
+              if (NULL == primitives) {
+                fprintf(stderr, "failed to allocate triangles\n");
+                return 1;
+              }
+            }
+            const triangle_t * const triangle = lattice->triangles + n;
+            primitives[num_triangles++] = (primitive_t){
+              .vertices = {triangle->vertices[0], triangle->vertices[1], triangle->vertices[2]},
+              .vertex_normals = {triangle->vertex_normals[0], triangle->vertex_normals[1], triangle->vertex_normals[2]},
+              .color = {0xFF, 0xFF, 0xFF},
+              .id = 1,
+            };
+          }
+        }
+      }
+    }
+    time_triangulate = fmin(time_triangulate, time_t);
+    time_normals = fmin(time_normals, time_n);
+  }
+  double times_triangulate[2] = {HUGE_VAL, HUGE_VAL};
+  for (size_t repeat = 0; repeat < options->repeats; repeat++) {
+    for (size_t m = 0; m < 2; m++) {
+      const double tic = get_time();
+      for (size_t k = 0; k < glsize - 1; k++) {
+        contour3d_contour_triangulate_slice(
+            (size_t [2]) {glsize, glsize},
+            (size_t [3]) {1, glsize, glsize * glsize},
+            (double * const [3]) {grid, grid, grid + k},
+            0 == m ? &batched : &fast,
+            array + k * glsize * glsize,
+            NULL,
+            0.,
+            slices[k % 3]
+        );
+      }
+      times_triangulate[m] = fmin(times_triangulate[m], get_time() - tic);
+    }
+  }
+  // the same view as the demo
+  const camera_t camera = {
+    .position = {+8.660254037844386e-1, -1.5, +1.},
+    .look_at = {0., 0., 0.},
+  };
+  const contour3d_vector_t local_x = {+1.154700538379251e+0, +6.666666666666665e-1, +0.000000000000000e+0};
+  const contour3d_vector_t local_y = {-2.500000000000000e-1, +4.330127018922195e-1, +8.660254037844386e-1};
+  const screen_t screen = {
+    .center = {+4.330127018922194e-1, -7.500000000000003e-1, +5.000000000000003e-1},
+    .width = options->screen_sizes[0],
+    .height = options->screen_sizes[1],
+    .local_x = local_x,
+    .local_y = local_y,
+    .normal = contour3d_vector_normalise(contour3d_vector_outer_product(local_x, local_y)),
+  };
+  const contour3d_vector_t light = contour3d_vector_normalise((contour3d_vector_t){0., 2., -1.});
+  // pixels tested by the rasteriser, used to normalise its timing
+  size_t num_tested = 0;
+  for (size_t n = 0; n < num_triangles; n++) {
+    contour3d_vector_t projected[3] = {{0}};
+    bool is_visible = true;
+    for (size_t m = 0; m < 3; m++) {
+      if (0 != contour3d_project(&camera, &screen, primitives[n].vertices + m, projected + m)) {
+        is_visible = false;
+      }
+    }
+    if (is_visible) {
+      num_tested += count_tested_pixels(&screen, projected);
+    }
+  }
+  // projection of the three vertices of each triangle
+  double time_project = HUGE_VAL;
+  for (size_t repeat = 0; repeat < options->repeats; repeat++) {
+    const double tic = get_time();
+    for (size_t n = 0; n < num_triangles; n++) {
+      contour3d_vector_t projected[3] = {{0}};
+      for (size_t m = 0; m < 3; m++) {
+        contour3d_project(&camera, &screen, primitives[n].vertices + m, projected + m);
+      }
+      sink = projected[0].z + projected[1].z + projected[2].z;
+    }
+    time_project = fmin(time_project, get_time() - tic);
+  }
+  // rasterisation onto a fresh canvas
+  double time_render = HUGE_VAL;
+  for (size_t repeat = 0; repeat < options->repeats; repeat++) {
+    canvas_t canvas = {0};
+    const contour3d_color_t bg_color = {0x00, 0x00, 0x00};
+    if (0 != contour3d_canvas_init(MPI_COMM_NULL, false, false, screen.width, screen.height, 0, &bg_color, &canvas)) {
+      return 1;
+    }
+    const double tic = get_time();
+    for (size_t n = 0; n < num_triangles; n++) {
+      contour3d_contour_render_triangle(&camera, &light, &screen, primitives + n, &canvas);
+    }
+    time_render = fmin(time_render, get_time() - tic);
+    contour3d_canvas_finalise(&canvas);
+    contour3d_memory_free_all();
+  }
+  print_result(field, "triangulate", num_cells, "cell", time_triangulate);
+  print_result(field, "triangulate_batch", num_cells, "cell", times_triangulate[0]);
+  print_result(field, "triangulate_fast", num_cells, "cell", times_triangulate[1]);
+  print_result(field, "normals", num_normals, "triangle", time_normals);
+  print_result(field, "project", num_triangles, "triangle", time_project);
+  print_result(field, "render", num_triangles, "triangle", time_render);
+  print_result(field, "render", num_tested, "pixel", time_render);
+  free(primitives);
+  free(slices[2]);
+  free(slices[1]);
+  free(slices[0]);
+  free(array);
+  free(grid);
+  return 0;
+}
+
+int main (
+    int argc,
+    char * argv[]
+) {
+  options_t options = {
+    .glsize = 128,
+    .screen_sizes = {1440, 1080},
+    .repeats = 5,
+    .fields = {true, true, true},
+  };
+  if (0 != parse_options(argc, argv, &options)) {
+    show_usage(argv[0]);
+    return 1;
+  }
+  printf("field,kernel,count,unit,ns_per_unit\n");
+  for (field_t field = 0; field < NFIELDS; field++) {
+    if (!options.fields[field]) {
+      continue;
+    }
+    if (0 != run(&options, field)) {
+      return 1;
+    }
+  }
+  contour3d_memory_release();
+  return 0;
+}
@@ -0,0 +1,412 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "sdecomp.h"
+#include "contour3d.h"
+
+// benchmark driver: renders a synthetic field several times
+//   and prints the per-phase timings of each frame as CSV
+// the library should be built with CONTOUR3D_PROFILE (see "make bench")
+
+static const double pi = 3.1415926535897932;
+
+// at most this number of contour objects
+#define MAX_CONTOURS 16
+
+typedef struct {
+  size_t glsizes[3];
+  size_t num_contours;
+  size_t num_thresholds;
+  double thresholds[MAX_CONTOURS];
+  size_t screen_sizes[2];
+  size_t repeats;
+  contour3d_composite_mode_t composite_mode;
+  bool load_balancing;
+  size_t num_threads;
+  bool pipelined_extraction;
+  bool flush_each;
+  const char * label;
+  const char * output;
+  bool header;
+} options_t;
+
+static const char * const phase_names[CONTOUR3D_NPHASES] = {
+  "extend",
+  "triangulate",
+  "normals",
+  "exchange",
+  "rasterise",
+  "lines",
+  "composite",
+  "write",
+};
+
+static const char * const counter_names[CONTOUR3D_NCOUNTERS] = {
+  "cells",
+  "triangles",
+  "pixels_tested",
+  "pixels_written",
+};
+
+static int show_usage (
+    const char program[]
+) {
+  fprintf(stderr, "usage: %s [options]\n", program);
+  fprintf(stderr, "  --grid=N or --grid=NX,NY,NZ    number of grid points (128)\n");
+  fprintf(stderr, "  --contours=N                   number of contour objects (2)\n");
+  fprintf(stderr, "  --thresholds=T0,T1,...         iso-values in [-1 : +1] (evenly spaced)\n");
+  fprintf(stderr, "  --resolution=WxH               screen resolution (1440x1080)\n");
+  fprintf(stderr, "  --repeats=N                    number of measured frames (5)\n");
+  fprintf(stderr, "  --mode=last|first|auto         compositing strategy (last)\n");
+  fprintf(stderr, "  --balance                      enable load balancing\n");
+  fprintf(stderr, "  --threads=N                    number of threads of each process (1)\n");
+  fprintf(stderr, "  --pipeline                     pipeline the stages instead of splitting slabs\n");
+  fprintf(stderr, "  --flush                        call contour3d_flush after each frame\n");
+  fprintf(stderr, "  --label=NAME                   first column of the CSV (bench)\n");
+  fprintf(stderr, "  --output=FILE                  write the image of each frame\n");
+  fprintf(stderr, "  --header                       print the CSV header first\n");
+  return 0;
+}
+
+static int parse_options (
+    const int argc,
+    char * argv[],
+    options_t * const options
+) {
+  for (int n = 1; n < argc; n++) {
+    const char * const arg = argv[n];
+    char * const value = strchr(arg, '=');
+    const char * const v = NULL == value ? "" : value + 1;
+    if (0 == strncmp(arg, "--grid=", 7)) {
+      const int nitems = sscanf(v, "%zu,%zu,%zu", options->glsizes + 0, options->glsizes + 1, options->glsizes + 2);
+      if (1 == nitems) {
+        options->glsizes[1] = options->glsizes[0];
+        options->glsizes[2] = options->glsizes[0];
+      } else if (3 != nitems) {
+        return 1;
+      }
+    } else if (0 == strncmp(arg, "--contours=", 11)) {
+      if (1 != sscanf(v, "%zu", &options->num_contours)) {
+        return 1;
+      }
+    } else if (0 == strncmp(arg, "--thresholds=", 13)) {
+      options->num_thresholds = 0;
+      for (const char * p = v; options->num_thresholds < MAX_CONTOURS; p++) {
+        char * end = NULL;
+        options->thresholds[options->num_thresholds++] = strtod(p, &end);
+        if (end == p) {
+          return 1;
+        }
+        p = end;
+        if (',' != *p) {
+          break;
+        }
+      }
+    } else if (0 == strncmp(arg, "--resolution=", 13)) {
+      if (2 != sscanf(v, "%zux%zu", options->screen_sizes + 0, options->screen_sizes + 1)) {
+        return 1;
+      }
+    } else if (0 == strncmp(arg, "--repeats=", 10)) {
+      if (1 != sscanf(v, "%zu", &options->repeats)) {
+        return 1;
+      }
+    } else if (0 == strncmp(arg, "--mode=", 7)) {
+      if (0 == strcmp(v, "last")) {
+        options->composite_mode = CONTOUR3D_COMPOSITE_SORT_LAST;
+      } else if (0 == strcmp(v, "first")) {
+        options->composite_mode = CONTOUR3D_COMPOSITE_SORT_FIRST;
+      } else if (0 == strcmp(v, "auto")) {
+        options->composite_mode = CONTOUR3D_COMPOSITE_AUTO;
+      } else {
+        return 1;
+      }
+    } else if (0 == strcmp(arg, "--balance")) {
+      options->load_balancing = true;
+    } else if (0 == strncmp(arg, "--threads=", 10)) {
+      if (1 != sscanf(v, "%zu", &options->num_threads) || 0 == options->num_threads) {
+        return 1;
+      }
+    } else if (0 == strcmp(arg, "--pipeline")) {
+      options->pipelined_extraction = true;
+    } else if (0 == strcmp(arg, "--flush")) {
+      options->flush_each = true;
+    } else if (0 == strncmp(arg, "--label=", 8)) {
+      options->label = v;
+    } else if (0 == strncmp(arg, "--output=", 9)) {
+      options->output = v;
+    } else if (0 == strcmp(arg, "--header")) {
+      options->header = true;
+    } else {
+      return 1;
+    }
+  }
+  if (0 == options->num_contours || MAX_CONTOURS < options->num_contours) {
+    return 1;
+  }
+  if (0 == options->repeats) {
+    return 1;
+  }
+  for (size_t dim = 0; dim < 3; dim++) {
+    if (options->glsizes[dim] < 2) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static contour3d_vector_t converter (
+    const contour3d_vector_t orthogonal
+) {
+  return orthogonal;
+}
+
+// superposed sinusoidal functions with random phases, normalised to [-1 : +1],
+//   on a uniform grid in [-0.5 : +0.5]^3
+// NOTE: the phases are fixed so that the runs are comparable
+static int init_field (
+    const sdecomp_info_t * const sdecomp_info,
+    const sdecomp_pencil_t pencil,
+    const size_t glsizes[3],
+    double * grids[3],
+    double ** const array
+) {
+  for (size_t dim = 0; dim < 3; dim++) {
+    grids[dim] = calloc(glsizes[dim], sizeof(double));
+    if (NULL == grids[dim]) {
+      return 1;
+    }
+    for (size_t n = 0; n < glsizes[dim]; n++) {
+      grids[dim][n] = -0.5 + 0.5 * (2 * n + 1) / glsizes[dim];
+    }
+  }
+  size_t mysizes[3] = {0};
+  size_t offsets[3] = {0};
+  for (size_t dim = 0; dim < 3; dim++) {
+    if (0 != sdecomp.get_pencil_mysize(sdecomp_info, pencil, dim, glsizes[dim], mysizes + dim)) return 1;
+    if (0 != sdecomp.get_pencil_offset(sdecomp_info, pencil, dim, glsizes[dim], offsets + dim)) return 1;
+  }
+  const size_t nitems = mysizes[0] * mysizes[1] * mysizes[2];
+  *array = calloc(nitems, sizeof(double));
+  if (NULL == *array) {
+    return 1;
+  }
+  srand(0);
+  for (size_t kz = 1; kz < 5; kz += 1) {
+    for (size_t ky = 1; ky < 5; ky += 1) {
+      for (size_t kx = 1; kx < 5; kx += 1) {
+        const double yphase = 2. * pi * rand() / RAND_MAX;
+        const double zphase = 2. * pi * rand() / RAND_MAX;
+        for (size_t k = 0; k < mysizes[2]; k++) {
+          const double z = grids[2][k + offsets[2]];
+          for (size_t j = 0; j < mysizes[1]; j++) {
+            const double y = grids[1][j + offsets[1]];
+            for (size_t i = 0; i < mysizes[0]; i++) {
+              const double x = grids[0][i + offsets[0]];
+              (*array)[(k * mysizes[1] + j) * mysizes[0] + i] += 1.
+                * sin(2. * pi * kx * x)
+                * sin(2. * pi * ky * y + yphase)
+                * sin(2. * pi * kz * z + zphase);
+            }
+          }
+        }
+      }
+    }
+  }
+  double min = + 1. * DBL_MAX;
+  double max = - 1. * DBL_MAX;
+  for (size_t index = 0; index < nitems; index++) {
+    min = fmin(min, (*array)[index]);
+    max = fmax(max, (*array)[index]);
+  }
+  MPI_Comm comm_cart = MPI_COMM_NULL;
+  sdecomp.get_comm_cart(sdecomp_info, &comm_cart);
+  MPI_Allreduce(MPI_IN_PLACE, &min, 1, MPI_DOUBLE, MPI_MIN, comm_cart);
+  MPI_Allreduce(MPI_IN_PLACE, &max, 1, MPI_DOUBLE, MPI_MAX, comm_cart);
+  for (size_t index = 0; index < nitems; index++) {
+    (*array)[index] = ((*array)[index] - min) / (max - min) * 2. - 1.;
+  }
+  return 0;
+}
+
+static int print_header (
+    void
+) {
+  printf("label,nprocs,nx,ny,nz,contours,width,height,repeat,frame");
+  for (size_t n = 0; n < CONTOUR3D_NPHASES; n++) {
+    printf(",%s_min,%s_mean,%s_max", phase_names[n], phase_names[n], phase_names[n]);
+  }
+  for (size_t n = 0; n < CONTOUR3D_NCOUNTERS; n++) {
+    printf(",%s", counter_names[n]);
+  }
+  printf("\n");
+  return 0;
+}
+
+// one line per frame, where the counters are summed over all processes
+static int print_row (
+    const options_t * const options,
+    const int nprocs,
+    const size_t repeat,
+    const double frame,
+    const contour3d_profile_t * const profile
+) {
+  printf(
+      "%s,%d,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%.6e",
+      options->label,
+      nprocs,
+      options->glsizes[0],
+      options->glsizes[1],
+      options->glsizes[2],
+      options->num_contours,
+      options->screen_sizes[0],
+      options->screen_sizes[1],
+      repeat,
+      frame
+  );
+  for (size_t n = 0; n < CONTOUR3D_NPHASES; n++) {
+    const contour3d_summary_t * const time = profile->times + n;
+    printf(",%.6e,%.6e,%.6e", time->min, time->mean, time->max);
+  }
+  for (size_t n = 0; n < CONTOUR3D_NCOUNTERS; n++) {
+    printf(",%.0f", profile->counts[n].mean * nprocs);
+  }
+  printf("\n");
+  fflush(stdout);
+  return 0;
+}
+
+int main (
+    int argc,
+    char * argv[]
+) {
+  MPI_Init(NULL, NULL);
+  int nprocs = 0;
+  int myrank = 0;
+  MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+  MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+  options_t options = {
+    .glsizes = {128, 128, 128},
+    .num_contours = 2,
+    .num_thresholds = 0,
+    .screen_sizes = {1440, 1080},
+    .repeats = 5,
+    .composite_mode = CONTOUR3D_COMPOSITE_SORT_LAST,
+    .load_balancing = false,
+    .num_threads = 1,
+    .pipelined_extraction = false,
+    .label = "bench",
+    .output = NULL,
+    .header = false,
+  };
+  if (0 != parse_options(argc, argv, &options)) {
+    if (0 == myrank) {
+      show_usage(argv[0]);
+    }
+    MPI_Finalize();
+    return 1;
+  }
+  sdecomp_info_t * sdecomp_info = NULL;
+  if (0 != sdecomp.construct(
+        MPI_COMM_WORLD,
+        3,
+        (size_t [3]) {0, 0, 0},
+        (bool [3]) {true, true, true},
+        &sdecomp_info
+  )) return 1;
+  const sdecomp_pencil_t pencil = SDECOMP_X1PENCIL;
+  double * grids[3] = {NULL};
+  double * array = NULL;
+  if (0 != init_field(sdecomp_info, pencil, options.glsizes, grids, &array)) {
+    fprintf(stderr, "failed to initialise field\n");
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  // the same view as the demo
+  const contour3d_vector_t camera_position = {+8.660254037844386e-1, -1.5, +1.};
+  const contour3d_vector_t camera_look_at = {0., 0., 0.};
+  const contour3d_vector_t light_direction = {0., 2., -1.};
+  const contour3d_vector_t screen_center = {+4.330127018922194e-1, -7.500000000000003e-1, +5.000000000000003e-1};
+  const contour3d_vector_t screen_local[2] = {
+    {+1.154700538379251e+0, +6.666666666666665e-1, +0.000000000000000e+0},
+    {-2.500000000000000e-1, +4.330127018922195e-1, +8.660254037844386e-1},
+  };
+  const contour3d_color_t bg_color = {0x00, 0x00, 0x00};
+  contour3d_contour_obj_t contour_objs[MAX_CONTOURS] = {0};
+  for (size_t n = 0; n < options.num_contours; n++) {
+    // unless given, the thresholds are evenly spaced in (-1 : +1)
+    const double threshold = n < options.num_thresholds
+      ? options.thresholds[n]
+      : -1. + 2. * (n + 1) / (options.num_contours + 1);
+    contour_objs[n] = (contour3d_contour_obj_t){
+      .pencil    = pencil,
+      .glsizes   = {options.glsizes[0], options.glsizes[1], options.glsizes[2]},
+      .grids     = {grids[0], grids[1], grids[2]},
+      .converter = converter,
+      .converter_kind = CONTOUR3D_CONVERTER_IDENTITY,
+      .threshold = threshold,
+      .color     = {0xFF, (uint8_t)(0xFF * n / options.num_contours), 0x00},
+      .array     = array,
+    };
+  }
+  const contour3d_config_t config = {
+    .composite_mode = options.composite_mode,
+    .load_balancing = options.load_balancing,
+    .num_threads = options.num_threads,
+    .pipelined_extraction = options.pipelined_extraction,
+  };
+  contour3d_configure(&config);
+  if (0 == myrank && options.header) {
+    print_header();
+  }
+  // the first frame is a warm-up, which is not reported
+  int retval = 0;
+  for (size_t repeat = 0; repeat <= options.repeats; repeat++) {
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double tic = MPI_Wtime();
+    if (0 != contour3d_execute(
+          sdecomp_info,
+          &camera_position,
+          &camera_look_at,
+          &light_direction,
+          options.screen_sizes,
+          &screen_center,
+          screen_local,
+          &bg_color,
+          options.num_contours,
+          contour_objs,
+          0,
+          NULL,
+          options.output
+    )) {
+      fprintf(stderr, "contour3d failed\n");
+      retval = 1;
+      break;
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double toc = MPI_Wtime();
+    contour3d_profile_t profile = {0};
+    if (0 != contour3d_get_profile(&profile)) {
+      retval = 1;
+      break;
+    }
+    if (0 == myrank && 0 < repeat) {
+      print_row(&options, nprocs, repeat, toc - tic, &profile);
+    }
+    // the workers and the retained memory are released,
+    //   and should be recreated by the next frame
+    if (options.flush_each && 0 != contour3d_flush()) {
+      fprintf(stderr, "contour3d_flush failed\n");
+      retval = 1;
+      break;
+    }
+  }
+  contour3d_flush();
+  free(grids[0]);
+  free(grids[1]);
+  free(grids[2]);
+  free(array);
+  sdecomp.destruct(sdecomp_info);
+  MPI_Finalize();
+  return retval;
+}
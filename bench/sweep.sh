@@ -0,0 +1,48 @@
+#!/bin/sh
+# strong- and weak-scaling sweeps of the benchmark driver on one machine,
+#   whose results are written to a single CSV file
+#
+# environment variables (defaults in parentheses):
+#   BENCH    benchmark executable (./bench.out)
+#   MPIRUN   launcher, e.g. "mpirun --oversubscribe" (mpirun)
+#   NPROCS   numbers of processes (1 2 4)
+#   SWEEPS   "strong", "weak", or both (strong weak)
+#   GRID     grid points per direction; fixed for strong scaling,
+#              and per process for weak scaling (128)
+#   CSV      output file (bench.csv)
+# the remaining arguments are passed to the driver,
+#   e.g. --contours=4 --resolution=1920x1080 --repeats=10
+
+set -eu
+
+BENCH=${BENCH:-./bench.out}
+MPIRUN=${MPIRUN:-mpirun}
+NPROCS=${NPROCS:-"1 2 4"}
+SWEEPS=${SWEEPS:-"strong weak"}
+GRID=${GRID:-128}
+CSV=${CSV:-bench.csv}
+
+header="--header"
+: > "${CSV}"
+for sweep in ${SWEEPS}; do
+  for nprocs in ${NPROCS}; do
+    case ${sweep} in
+      strong)
+        grid=${GRID}
+        ;;
+      weak)
+        # the number of grid points grows with the number of processes,
+        #   keeping the work per process
+        grid=$(awk -v n="${GRID}" -v p="${nprocs}" 'BEGIN { printf "%d", n * p ^ (1. / 3.) + 0.5 }')
+        ;;
+      *)
+        echo "unknown sweep: ${sweep}" >&2
+        exit 1
+        ;;
+    esac
+    echo "${sweep}: ${nprocs} process(es), ${grid}^3 grid points" >&2
+    ${MPIRUN} -n "${nprocs}" "${BENCH}" ${header} --label="${sweep}" --grid="${grid}" "$@" >> "${CSV}"
+    header=""
+  done
+done
+echo "written to ${CSV}" >&2
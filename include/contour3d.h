@@ -1,6 +1,7 @@
 #if !defined(CONTOUR3D_H)
 #define CONTOUR3D_H
 
+#include <stdbool.h> // bool
 #include <stddef.h> // size_t
 #include <stdint.h> // uint8_t
 #include "sdecomp.h"
@@ -19,6 +20,39 @@ typedef struct {
   uint8_t b;
 } contour3d_color_t;
 
+// how the orthogonal coordinate of a contour object is mapped to the Cartesian coordinate
+typedef enum {
+  // through "batch_converter" or "converter" (default)
+  CONTOUR3D_CONVERTER_GENERAL  = 0,
+  // the orthogonal coordinate is Cartesian, "converter" is not used
+  CONTOUR3D_CONVERTER_IDENTITY = 1,
+  // Cartesian = A orthogonal + b, where "affine" is [A | b],
+  //   "converter" is not used
+  CONTOUR3D_CONVERTER_AFFINE   = 2,
+} contour3d_converter_kind_t;
+
+// tabulated colormaps (256 levels) to color objects by scalar values
+typedef enum {
+  // the uniform "color" of the object is used
+  CONTOUR3D_COLORMAP_NONE     = 0,
+  // black - white
+  CONTOUR3D_COLORMAP_GRAY     = 1,
+  // diverging blue - grey - red
+  CONTOUR3D_COLORMAP_COOLWARM = 2,
+  // dark blue - cyan - yellow - dark red
+  CONTOUR3D_COLORMAP_JET      = 3,
+  CONTOUR3D_NCOLORMAPS        = 4,
+} contour3d_colormap_t;
+
+// what a contour object draws from its array
+typedef enum {
+  // iso-surface at "threshold"
+  CONTOUR3D_CONTOUR_ISOSURFACE = 0,
+  // plane of the nodes whose index in "slice_dir" is "slice_index",
+  //   colored through "colormap" by the array (or by "color_array" if given)
+  CONTOUR3D_CONTOUR_SLICE      = 1,
+} contour3d_contour_kind_t;
+
 typedef struct {
   // pencil on which the array is defined
   // see also: https://github.com/NaokiHori/SimpleDecomp
@@ -31,12 +65,58 @@ typedef struct {
   contour3d_vector_t (* converter) (
       const contour3d_vector_t orthogonal
   );
+  // the same map applied in place to "npoints" points at once,
+  //   which is used instead of "converter" if given
+  // NOTE: iso-surfaces are found in the orthogonal coordinate,
+  //   and only their vertices are converted
+  // NOTE: both may be called concurrently from several threads (see "num_threads")
+  void (* batch_converter) (
+      const size_t npoints,
+      contour3d_vector_t * const points
+  );
+  // identity and affine maps are applied without calling "converter",
+  //   which, together with uniform grids, selects a specialised extraction kernel
+  contour3d_converter_kind_t converter_kind;
+  double affine[CONTOUR3D_NDIMS][CONTOUR3D_NDIMS + 1];
+  // the grids in x and y are uniformly spaced,
+  //   which is otherwise detected (up to round-off errors)
+  bool has_uniform_grids;
+  // only the lattices overlapping the box [clip_box[0] : clip_box[1]]
+  //   (on the orthogonal coordinate system) are extracted,
+  //   and the processes holding none of them skip the extraction and the halo exchange
+  bool has_clip_box;
+  contour3d_vector_t clip_box[2];
+  // iso-surface (default) or slice plane
+  contour3d_contour_kind_t kind;
+  // normal direction and global index of the slice plane,
+  //   which is only drawn by the processes holding it
+  sdecomp_dir_t slice_dir;
+  size_t slice_index;
   // where the iso-surface is formed
   double threshold;
   // object color
   contour3d_color_t color;
-  // three-dimensional array, from which a contour is generated
+  // color the iso-surface by a second field instead of "color",
+  //   which is interpolated at each triangle vertex and is looked up in "colormap",
+  //   whose ends correspond to "color_range[0]" and "color_range[1]"
+  // NOTE: "color_array" is defined on the same pencil
+  //   with the same "halo_widths" and "strides" as "array"
+  contour3d_colormap_t colormap;
+  double color_range[2];
+  double * color_array;
+  // three-dimensional array, from which a contour is generated,
+  //   starting from the first ghost value if any
   double * array;
+  // number of ghost layers on each side of "array" in each dimension (default: 0),
+  //   which hold the values of the neighbouring processes (e.g. exchanged by the solver)
+  // NOTE: with two or more in all dimensions,
+  //   "array" is read in place without being copied or communicated,
+  //   for which the edge and corner ghost cells (shared by two or three dimensions)
+  //   should be valid as well as the face ones
+  size_t halo_widths[CONTOUR3D_NDIMS];
+  // distances (in elements) between the neighbouring values in each dimension,
+  //   e.g. to skip padding, which are zeros for the packed layout (including the halos)
+  size_t strides[CONTOUR3D_NDIMS];
 } contour3d_contour_obj_t;
 
 typedef struct {
@@ -55,6 +135,238 @@ typedef struct {
   double width;
 } contour3d_line_obj_t;
 
+// how the images of all processes are combined
+typedef enum {
+  // each process renders its triangles onto a full-screen canvas,
+  //   which are depth-composited afterwards
+  CONTOUR3D_COMPOSITE_SORT_LAST  = 0,
+  // each process owns a band of screen rows,
+  //   and triangles are sent to the owners which rasterise them
+  CONTOUR3D_COMPOSITE_SORT_FIRST = 1,
+  // choose one of the above, comparing the number of triangles
+  //   with the number of pixels
+  CONTOUR3D_COMPOSITE_AUTO       = 2,
+} contour3d_composite_mode_t;
+
+// container of the frame stream, see "stream_format" below
+typedef enum {
+  // no stream is written
+  CONTOUR3D_STREAM_NONE = 0,
+  // yuv4mpeg2 (4:4:4, 8-bit), which most video encoders read directly
+  CONTOUR3D_STREAM_Y4M  = 1,
+  // headerless rgb24 frames, from the top row to the bottom
+  CONTOUR3D_STREAM_RGB  = 2,
+} contour3d_stream_format_t;
+
+// composited image handed to the caller, see "frame_callback" below
+// NOTE: the buffers belong to the library
+//   and are only valid during the callback
+typedef struct {
+  // number of pixels in x and y
+  size_t width;
+  size_t height;
+  // this buffer covers rows [offset : offset + height) of the whole screen,
+  //   which is non-zero only when the screen is partitioned (sort-first)
+  size_t offset;
+  // colors of the pixels, row-major from the bottom row (i.e. upside down)
+  const contour3d_color_t * colors;
+  // depths of the pixels with the same layout,
+  //   larger is nearer, -DBL_MAX where nothing is drawn
+  const double * depths;
+  // ids of the objects with the same layout (see "export_depth"),
+  //   which is NULL unless "export_depth" is set
+  const uint16_t * ids;
+} contour3d_framebuffer_t;
+
+// called once per frame with the composited image,
+//   whose return value should be zero unless an error occurs
+typedef int (*contour3d_frame_callback_t) (
+    const contour3d_framebuffer_t * framebuffer,
+    void * data
+);
+
+// optional settings, which are shared by all following "contour3d_execute" calls
+// NOTE: zero-initialised members give the default behaviour
+typedef struct {
+  // composite canvases inside each node through an MPI shared-memory window
+  //   before communicating among nodes,
+  //   so that only one canvas per node goes over the network
+  // NOTE: the window is kept until "contour3d_flush"
+  bool node_aware_compositing;
+  // sort-last (default), sort-first, or automatic choice
+  contour3d_composite_mode_t composite_mode;
+  // migrate triangles from overloaded to underloaded processes
+  //   before rasterising them (sort-last only),
+  //   reporting the load imbalance before and after
+  bool load_balancing;
+  // encode and write images on a background thread of the main process,
+  //   so that "contour3d_execute" returns once compositing is finished
+  // NOTE: "contour3d_flush" should be called before the program ends,
+  //   images whose canvases are partitioned (sort-first) are written as usual
+  bool async_output;
+  // maximum number of images waiting to be written (default: 2),
+  //   "contour3d_execute" blocks while the queue is full
+  //   or while their copies exceed "memory_budget"
+  size_t async_queue_size;
+  // called by the main process holding the composited image,
+  //   or by all processes with their own bands when the screen is partitioned (sort-first)
+  contour3d_frame_callback_t frame_callback;
+  // passed to "frame_callback" as it is
+  void * frame_callback_data;
+  // append every frame to a single stream in addition to (or instead of) the image files,
+  //   which is written by the main process (in the background if "async_output" is set)
+  // NOTE: the resolution should not change, and
+  //   "contour3d_flush" should be called to close the stream
+  contour3d_stream_format_t stream_format;
+  // destination of the stream (a regular file or a fifo),
+  //   or NULL to use an already-open file descriptor "stream_fd" (e.g. STDOUT_FILENO),
+  //   which is not closed by the library
+  // NOTE: "stream_fd" should be set explicitly, since 0 (stdin) is rejected,
+  //   and a reader which has gone away is reported as an error instead of SIGPIPE
+  const char * stream_path;
+  int stream_fd;
+  // frames per second recorded in the y4m header (default: 25)
+  size_t stream_frame_rate;
+  // write the depth and the object id of each pixel to a file
+  //   next to the image, whose extension is replaced by ".zid"
+  // ids are 0 for the background, 1 to num_contours for the contour objects,
+  //   and the following ones for the line objects
+  bool export_depth;
+  // upper limit of the memory used by each process (on each thread) in bytes,
+  //   where 0 means unlimited
+  // when a strategy does not fit, a lower-memory one is taken instead:
+  //   sort-first instead of sort-last, triangles exchanged in several rounds,
+  //   no load balancing, compositing in row strips, and retained memory is released
+  size_t memory_budget;
+  // print the timings and the counters of each frame by the main process,
+  //   which is only effective when the library is built with CONTOUR3D_PROFILE
+  bool print_profile;
+  // Chrome-trace (Perfetto) JSON file to which the begin / end events
+  //   of the phases and the MPI calls of all processes are written
+  //   by "contour3d_flush", or NULL not to trace
+  // only effective when the library is built with CONTOUR3D_PROFILE
+  const char * trace_path;
+  // number of threads of each process (default: 1) which extract triangles
+  //   from disjoint z slabs and rasterise them onto disjoint canvas rows,
+  //   so that fewer processes (e.g. one per socket) can be used
+  // NOTE: the other threads never call MPI,
+  //   and are kept until "contour3d_flush"
+  size_t num_threads;
+  // instead of splitting z slabs, pipeline the stages of each process
+  //   over two or three of the "num_threads" threads:
+  //   a layer is triangulated while the vertex normals of the one below are found
+  //   and the triangles of the one below it are rasterised (or stored)
+  // NOTE: slabs are used instead when the slices of the pipeline exceed "memory_budget"
+  bool pipelined_extraction;
+} contour3d_config_t;
+
+// update the settings, which should be called by all processes
+extern int contour3d_configure (
+    const contour3d_config_t * const config
+);
+
+// parts of the library whose memory usage is tracked separately
+typedef enum {
+  // canvases (z buffer, colors, and ids)
+  CONTOUR3D_MEMORY_CANVAS         = 0,
+  // scalar fields extended by the halo cells
+  CONTOUR3D_MEMORY_EXTENDED_ARRAY = 1,
+  // slices of lattices holding triangles
+  CONTOUR3D_MEMORY_SLICES         = 2,
+  // triangles stored for deferred rasterisation and their exchange
+  CONTOUR3D_MEMORY_PRIMITIVES     = 3,
+  // buffers to composite canvases
+  CONTOUR3D_MEMORY_COMPOSITING    = 4,
+  // buffers to encode and write images
+  CONTOUR3D_MEMORY_OUTPUT         = 5,
+  // anything else
+  CONTOUR3D_MEMORY_OTHERS         = 6,
+  CONTOUR3D_MEMORY_NSUBSYSTEMS    = 7,
+} contour3d_memory_subsystem_t;
+
+// memory used by the library on all threads of the process, in bytes,
+//   where memory is counted as free once it is no longer used
+typedef struct {
+  // in use at the moment, which is zero between frames
+  size_t current;
+  // maximum of "current" so far (high-water mark)
+  size_t peak;
+  // obtained from the system and kept for the following frames
+  size_t reserved;
+  // the same as "current" and "peak" for each subsystem
+  size_t subsystem_current[CONTOUR3D_MEMORY_NSUBSYSTEMS];
+  size_t subsystem_peak[CONTOUR3D_MEMORY_NSUBSYSTEMS];
+} contour3d_memory_stats_t;
+
+extern int contour3d_get_memory_stats (
+    contour3d_memory_stats_t * const stats
+);
+
+// phases of a frame which are timed separately
+typedef enum {
+  // halo exchange of the scalar fields
+  CONTOUR3D_PHASE_EXTEND      = 0,
+  // extraction of the triangles
+  CONTOUR3D_PHASE_TRIANGULATE = 1,
+  // computation of the vertex normals
+  CONTOUR3D_PHASE_NORMALS     = 2,
+  // redistribution and load balancing of the triangles
+  CONTOUR3D_PHASE_EXCHANGE    = 3,
+  // rasterisation of the triangles
+  CONTOUR3D_PHASE_RASTERISE   = 4,
+  // drawing of the line objects
+  CONTOUR3D_PHASE_LINES       = 5,
+  // depth compositing of the canvases
+  CONTOUR3D_PHASE_COMPOSITE   = 6,
+  // encoding and writing of the image
+  CONTOUR3D_PHASE_WRITE       = 7,
+  CONTOUR3D_NPHASES           = 8,
+} contour3d_phase_t;
+
+// work done in a frame
+typedef enum {
+  // lattice cells examined by the triangulation
+  CONTOUR3D_COUNTER_CELLS          = 0,
+  // triangles extracted from the scalar fields
+  CONTOUR3D_COUNTER_TRIANGLES      = 1,
+  // pixels inside the bounding boxes of the triangles
+  CONTOUR3D_COUNTER_PIXELS_TESTED  = 2,
+  // pixels updated by the triangles
+  CONTOUR3D_COUNTER_PIXELS_WRITTEN = 3,
+  CONTOUR3D_NCOUNTERS              = 4,
+} contour3d_counter_t;
+
+// minimum, average, and maximum over all processes
+typedef struct {
+  double min;
+  double mean;
+  double max;
+} contour3d_summary_t;
+
+// timings (in seconds) and counters of the last frame,
+//   which are summed over all objects before being reduced
+typedef struct {
+  contour3d_summary_t times[CONTOUR3D_NPHASES];
+  contour3d_summary_t counts[CONTOUR3D_NCOUNTERS];
+} contour3d_profile_t;
+
+// identical on all processes,
+//   returning non-zero if the library is built without CONTOUR3D_PROFILE
+extern int contour3d_get_profile (
+    contour3d_profile_t * const profile
+);
+
+// wait until all images queued by asynchronous output are written,
+//   close the stream, write the trace (if any), terminate the worker threads,
+//   free the shared window of node-aware compositing,
+//   and give the retained memory back to the system,
+//   returning non-zero if any of them failed
+// NOTE: collective when tracing or using node-aware compositing
+// NOTE: a failure is also reported by the next "contour3d_execute" call
+extern int contour3d_flush (
+    void
+);
+
 extern int contour3d_execute (
     // information about the pencil domain decomposition
     const sdecomp_info_t * const sdecomp_info,
@@ -81,7 +393,8 @@ extern int contour3d_execute (
     const size_t num_lines,
     // details of the lines (12 domain edges)
     const contour3d_line_obj_t * const contour3d_line_objs,
-    // output image file name
+    // output image file name, or NULL not to write a file
+    //   (e.g. when "frame_callback" consumes the image)
     const char fname[]
 );
 
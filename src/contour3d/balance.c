@@ -0,0 +1,207 @@
+#include <stdint.h>
+#include <mpi.h>
+#include "./struct.h"
+#include "./memory.h"
+#include "./logger.h"
+#include "./config.h"
+#include "./primitive.h"
+#include "./profile.h"
+#include "./balance.h"
+
+// iso-surfaces tend to concentrate in a few sub-domains,
+//   leaving the others idle while the heavily-loaded processes rasterise
+// here triangles are migrated from overloaded to underloaded processes
+//   before they are rasterised, so that all processes hold a similar number of them
+
+// ratio of the maximum to the mean load (1 is perfectly balanced)
+static double compute_imbalance (
+    const int nprocs,
+    const uint64_t * const counts
+) {
+  uint64_t total = 0;
+  uint64_t max = 0;
+  for (int rank = 0; rank < nprocs; rank++) {
+    total += counts[rank];
+    max = max < counts[rank] ? counts[rank] : max;
+  }
+  if (0 == total) {
+    return 1.;
+  }
+  return 1. * max / (1. * total / nprocs);
+}
+
+// number of triangles which "rank" should hold after balancing
+static uint64_t get_target (
+    const int nprocs,
+    const int rank,
+    const uint64_t total
+) {
+  return total / nprocs + ((uint64_t)rank < total % nprocs ? 1 : 0);
+}
+
+int contour3d_balance_primitives (
+    const MPI_Comm comm,
+    primitives_t * const primitives
+) {
+  int nprocs = 0;
+  int myrank = 0;
+  MPI_Comm_size(comm, &nprocs);
+  MPI_Comm_rank(comm, &myrank);
+  // share the loads of all processes
+  uint64_t * const counts = contour3d_memory_alloc(nprocs, sizeof(uint64_t));
+  uint64_t * const surpluses = contour3d_memory_alloc(nprocs, sizeof(uint64_t));
+  uint64_t * const deficits = contour3d_memory_alloc(nprocs, sizeof(uint64_t));
+  int * const sendcounts = contour3d_memory_alloc(nprocs, sizeof(int));
+  int * const recvcounts = contour3d_memory_alloc(nprocs, sizeof(int));
+  int * const sdispls = contour3d_memory_alloc(nprocs, sizeof(int));
+  int * const rdispls = contour3d_memory_alloc(nprocs, sizeof(int));
+  // the following is collective, and thus all processes give up together
+  int is_allocated =
+         NULL != counts && NULL != surpluses && NULL != deficits
+      && NULL != sendcounts && NULL != recvcounts && NULL != sdispls && NULL != rdispls;
+  if (!is_allocated) {
+    logger_error("failed to allocate buffers for load balancing");
+  }
+  CONTOUR3D_TRACE_BEGIN(EVENT_ALLREDUCE);
+  MPI_Allreduce(MPI_IN_PLACE, &is_allocated, 1, MPI_INT, MPI_LAND, comm);
+  CONTOUR3D_TRACE_END(EVENT_ALLREDUCE);
+  if (!is_allocated) {
+    // NULL is ignored
+    contour3d_memory_free(rdispls);
+    contour3d_memory_free(sdispls);
+    contour3d_memory_free(recvcounts);
+    contour3d_memory_free(sendcounts);
+    contour3d_memory_free(deficits);
+    contour3d_memory_free(surpluses);
+    contour3d_memory_free(counts);
+    return 1;
+  }
+  CONTOUR3D_TRACE_BEGIN(EVENT_ALLGATHER);
+  MPI_Allgather(
+      &(uint64_t){primitives->nitems}, 1, MPI_UINT64_T,
+      counts, 1, MPI_UINT64_T,
+      comm
+  );
+  CONTOUR3D_TRACE_END(EVENT_ALLGATHER);
+  uint64_t total = 0;
+  for (int rank = 0; rank < nprocs; rank++) {
+    total += counts[rank];
+  }
+  const double imbalance_before = compute_imbalance(nprocs, counts);
+  // find how many triangles each process gives / takes
+  for (int rank = 0; rank < nprocs; rank++) {
+    const uint64_t target = get_target(nprocs, rank, total);
+    surpluses[rank] = target < counts[rank] ? counts[rank] - target : 0;
+    deficits[rank]  = counts[rank] < target ? target - counts[rank] : 0;
+    sendcounts[rank] = 0;
+    recvcounts[rank] = 0;
+  }
+  // match overloaded and underloaded processes in the rank order,
+  //   which is deterministic and thus identical on all processes
+  for (int src = 0, dest = 0; src < nprocs && dest < nprocs; ) {
+    if (0 == surpluses[src]) {
+      src += 1;
+      continue;
+    }
+    if (0 == deficits[dest]) {
+      dest += 1;
+      continue;
+    }
+    const uint64_t batch = surpluses[src] < deficits[dest] ? surpluses[src] : deficits[dest];
+    if (myrank == src) {
+      sendcounts[dest] = batch;
+    }
+    if (myrank == dest) {
+      recvcounts[src] = batch;
+    }
+    surpluses[src] -= batch;
+    deficits[dest] -= batch;
+    counts[src] -= batch;
+    counts[dest] += batch;
+  }
+  const double imbalance_after = compute_imbalance(nprocs, counts);
+  // overloaded processes give their last triangles,
+  //   while underloaded processes append what they receive
+  size_t nsends = 0;
+  size_t nrecvs = 0;
+  for (int rank = 0; rank < nprocs; rank++) {
+    nsends += sendcounts[rank];
+    nrecvs += recvcounts[rank];
+  }
+  if (0 != contour3d_config_get()->memory_budget) {
+    // the list may be copied to be grown, and balancing is skipped
+    //   if any process cannot afford it, which is harmless
+    //   since each process renders what it has anyway
+    int is_affordable = (primitives->nitems + nrecvs) * sizeof(primitive_t) <= contour3d_memory_get_available();
+    MPI_Allreduce(MPI_IN_PLACE, &is_affordable, 1, MPI_INT, MPI_LAND, comm);
+    if (!is_affordable) {
+      if (0 == myrank) {
+        logger_info("load balancing skipped to stay within the memory budget");
+      }
+      contour3d_memory_free(rdispls);
+      contour3d_memory_free(sdispls);
+      contour3d_memory_free(recvcounts);
+      contour3d_memory_free(sendcounts);
+      contour3d_memory_free(deficits);
+      contour3d_memory_free(surpluses);
+      contour3d_memory_free(counts);
+      return 0;
+    }
+  }
+  const size_t nkeeps = primitives->nitems - nsends;
+  for (int sdispl = nkeeps, rdispl = 0, rank = 0; rank < nprocs; rank++) {
+    sdispls[rank] = sdispl;
+    rdispls[rank] = rdispl;
+    sdispl += sendcounts[rank];
+    rdispl += recvcounts[rank];
+  }
+  int is_reserved = 0 == contour3d_primitive_reserve(primitives, primitives->nitems + nrecvs);
+  if (!is_reserved) {
+    logger_error("failed to allocate buffer for load balancing");
+  }
+  CONTOUR3D_TRACE_BEGIN(EVENT_ALLREDUCE);
+  MPI_Allreduce(MPI_IN_PLACE, &is_reserved, 1, MPI_INT, MPI_LAND, comm);
+  CONTOUR3D_TRACE_END(EVENT_ALLREDUCE);
+  if (!is_reserved) {
+    contour3d_memory_free(rdispls);
+    contour3d_memory_free(sdispls);
+    contour3d_memory_free(recvcounts);
+    contour3d_memory_free(sendcounts);
+    contour3d_memory_free(deficits);
+    contour3d_memory_free(surpluses);
+    contour3d_memory_free(counts);
+    return 1;
+  }
+  MPI_Datatype primitive_type = MPI_DATATYPE_NULL;
+  contour3d_primitive_create_type(&primitive_type);
+  // NOTE: received triangles are stored after the existing ones,
+  //   which does not overlap with the sent ones
+  CONTOUR3D_TRACE_BEGIN(EVENT_ALLTOALL);
+  MPI_Alltoallv(
+      primitives->items, sendcounts, sdispls, primitive_type,
+      primitives->items + primitives->nitems, recvcounts, rdispls, primitive_type,
+      comm
+  );
+  CONTOUR3D_TRACE_END(EVENT_ALLTOALL);
+  MPI_Type_free(&primitive_type);
+  // either of the two is zero
+  primitives->nitems = nkeeps + nrecvs;
+  if (0 == myrank) {
+    logger_info(
+        "load balancing: %llu triangles, imbalance (max / mean) %.3f -> %.3f",
+        (unsigned long long)total,
+        imbalance_before,
+        imbalance_after
+    );
+  }
+  // clean-up
+  contour3d_memory_free(rdispls);
+  contour3d_memory_free(sdispls);
+  contour3d_memory_free(recvcounts);
+  contour3d_memory_free(sendcounts);
+  contour3d_memory_free(deficits);
+  contour3d_memory_free(surpluses);
+  contour3d_memory_free(counts);
+  return 0;
+}
+
@@ -0,0 +1,12 @@
+#if !defined(CONTOUR3D_BALANCE_H)
+#define CONTOUR3D_BALANCE_H
+
+#include <mpi.h>
+#include "./primitive.h"
+
+extern int contour3d_balance_primitives (
+    const MPI_Comm comm,
+    primitives_t * const primitives
+);
+
+#endif // CONTOUR3D_BALANCE_H
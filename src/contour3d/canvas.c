@@ -0,0 +1,235 @@
+#include <stdint.h>
+#include <float.h> // DBL_MAX
+#include "contour3d.h"
+#include "./struct.h"
+#include "./memory.h"
+#include "./logger.h"
+#include "./canvas.h"
+
+// processes sharing the same node, their node-local main processes,
+//   and the window holding their pixels,
+//   which are created at the first node-aware frame and are kept until "contour3d_flush"
+//   so that no communicator nor window is created per frame
+// the window stays in a passive-target epoch (lock_all) during its lifetime,
+//   and the accesses are ordered by MPI_Win_sync and the node barriers
+static MPI_Comm node_comm_parent = MPI_COMM_NULL;
+static MPI_Comm node_comm = MPI_COMM_NULL;
+static MPI_Comm node_comm_leaders = MPI_COMM_NULL;
+static MPI_Win node_win = MPI_WIN_NULL;
+static size_t node_nbytes = 0;
+static void * node_memory = NULL;
+
+// collective among the processes which created the window
+int contour3d_canvas_release (
+    void
+) {
+  if (MPI_WIN_NULL != node_win) {
+    MPI_Win_unlock_all(node_win);
+    MPI_Win_free(&node_win);
+  }
+  if (MPI_COMM_NULL != node_comm_leaders) {
+    MPI_Comm_free(&node_comm_leaders);
+  }
+  if (MPI_COMM_NULL != node_comm) {
+    MPI_Comm_free(&node_comm);
+  }
+  node_comm_parent = MPI_COMM_NULL;
+  node_nbytes = 0;
+  node_memory = NULL;
+  return 0;
+}
+
+// split the processes on the same node
+//   and allocate a segment of "nbytes" per process in a window shared by them,
+//   so that the canvases of the neighbours can be accessed directly
+static int create_shared (
+    const MPI_Comm comm,
+    const size_t nbytes
+) {
+  int myrank = 0;
+  MPI_Comm_rank(comm, &myrank);
+  MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, myrank, MPI_INFO_NULL, &node_comm);
+  int mynoderank = 0;
+  MPI_Comm_rank(node_comm, &mynoderank);
+  // node-local main processes, ordered so that the main process (0) is still the root
+  MPI_Comm_split(comm, 0 == mynoderank ? 0 : MPI_UNDEFINED, myrank, &node_comm_leaders);
+  // each process has its own segment, which does not have to be contiguous
+  MPI_Info info = MPI_INFO_NULL;
+  MPI_Info_create(&info);
+  MPI_Info_set(info, "alloc_shared_noncontig", "true");
+  const int error = MPI_Win_allocate_shared(
+      nbytes,
+      1,
+      info,
+      node_comm,
+      &node_memory,
+      &node_win
+  );
+  MPI_Info_free(&info);
+  if (MPI_SUCCESS != error) {
+    logger_error("failed to allocate shared window");
+    node_win = MPI_WIN_NULL;
+    contour3d_canvas_release();
+    return 1;
+  }
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, node_win);
+  node_comm_parent = comm;
+  node_nbytes = nbytes;
+  return 0;
+}
+
+// pixels inside the shared window,
+//   which is re-created only when the communicator changes or a larger canvas is needed
+static int allocate_shared (
+    const MPI_Comm comm,
+    const size_t nbytes,
+    canvas_t * const canvas
+) {
+  if (comm != node_comm_parent || node_nbytes < nbytes) {
+    contour3d_canvas_release();
+    if (0 != create_shared(comm, nbytes)) {
+      return 1;
+    }
+  }
+  canvas->comm_node = node_comm;
+  canvas->comm_leaders = node_comm_leaders;
+  canvas->win = node_win;
+  canvas->depths = node_memory;
+  return 0;
+}
+
+// allocate pixels and fill them with the background color
+int contour3d_canvas_init (
+    const MPI_Comm comm,
+    const bool is_shared,
+    const bool has_ids,
+    const size_t width,
+    const size_t height,
+    const size_t offset,
+    const contour3d_color_t * const bg_color,
+    canvas_t * const canvas
+) {
+  canvas->comm_node = MPI_COMM_NULL;
+  canvas->comm_leaders = MPI_COMM_NULL;
+  canvas->win = MPI_WIN_NULL;
+  const size_t nitems = width * height;
+  const size_t nbytes = contour3d_canvas_get_size(nitems, has_ids);
+  if (is_shared) {
+    if (0 != allocate_shared(comm, nbytes, canvas)) {
+      return 1;
+    }
+  } else {
+    canvas->depths = contour3d_memory_alloc(nbytes, sizeof(uint8_t));
+  }
+  if (NULL == canvas->depths) {
+    logger_error("canvas allocation failed");
+    return 1;
+  }
+  contour3d_canvas_locate(canvas->depths, nitems, has_ids, &canvas->depths, &canvas->ids, &canvas->colors);
+  for (/* each pixel */ size_t n = 0; n < nitems; n++) {
+    // fill canvas with the default background color
+    canvas->colors[n] = *bg_color;
+    // assign negative infinity as the minimum distance
+    canvas->depths[n] = -1. * DBL_MAX;
+  }
+  if (has_ids) {
+    for (/* each pixel */ size_t n = 0; n < nitems; n++) {
+      canvas->ids[n] = 0;
+    }
+  }
+  canvas->width  = width;
+  canvas->height = height;
+  canvas->offset = offset;
+  canvas->is_partitioned = false;
+  // nothing has been drawn yet
+  canvas->active = (rect_t){
+    .imin = 0,
+    .imax = 0,
+    .jmin = 0,
+    .jmax = 0,
+  };
+  return 0;
+}
+
+// the shared window is kept for the following frames
+int contour3d_canvas_finalise (
+    canvas_t * const canvas
+) {
+  if (MPI_WIN_NULL == canvas->win) {
+    contour3d_memory_free(canvas->depths);
+  }
+  canvas->comm_node = MPI_COMM_NULL;
+  canvas->comm_leaders = MPI_COMM_NULL;
+  canvas->win = MPI_WIN_NULL;
+  canvas->depths = NULL;
+  canvas->ids = NULL;
+  canvas->colors = NULL;
+  return 0;
+}
+
+// number of bytes to store the given number of pixels
+size_t contour3d_canvas_get_size (
+    const size_t nitems,
+    const bool has_ids
+) {
+  return nitems * (
+      + sizeof(double)
+      + (has_ids ? sizeof(uint16_t) : 0)
+      + sizeof(contour3d_color_t)
+  );
+}
+
+// find the arrays of "nitems" pixels in the given memory,
+//   which are depths, ids (if any), and colors in this order
+//   so that every array is aligned
+int contour3d_canvas_locate (
+    void * const memory,
+    const size_t nitems,
+    const bool has_ids,
+    double ** const depths,
+    uint16_t ** const ids,
+    contour3d_color_t ** const colors
+) {
+  uint8_t * const base = memory;
+  const size_t ids_bytes = has_ids ? nitems * sizeof(uint16_t) : 0;
+  *depths = (double *)base;
+  *ids = has_ids ? (uint16_t *)(base + nitems * sizeof(double)) : NULL;
+  *colors = (contour3d_color_t *)(base + nitems * sizeof(double) + ids_bytes);
+  return 0;
+}
+
+bool contour3d_canvas_rect_is_empty (
+    const rect_t * const rect
+) {
+  return rect->imax <= rect->imin || rect->jmax <= rect->jmin;
+}
+
+// smallest rectangle containing both rectangles
+rect_t contour3d_canvas_rect_union (
+    const rect_t * const rect0,
+    const rect_t * const rect1
+) {
+  if (contour3d_canvas_rect_is_empty(rect0)) {
+    return *rect1;
+  }
+  if (contour3d_canvas_rect_is_empty(rect1)) {
+    return *rect0;
+  }
+  const rect_t rect = {
+    .imin = rect0->imin < rect1->imin ? rect0->imin : rect1->imin,
+    .imax = rect0->imax > rect1->imax ? rect0->imax : rect1->imax,
+    .jmin = rect0->jmin < rect1->jmin ? rect0->jmin : rect1->jmin,
+    .jmax = rect0->jmax > rect1->jmax ? rect0->jmax : rect1->jmax,
+  };
+  return rect;
+}
+
+// extend the active region of the canvas to contain the given rectangle
+int contour3d_canvas_touch (
+    canvas_t * const canvas,
+    const rect_t * const rect
+) {
+  canvas->active = contour3d_canvas_rect_union(&canvas->active, rect);
+  return 0;
+}
+
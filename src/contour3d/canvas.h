@@ -0,0 +1,55 @@
+#if !defined(CONTOUR3D_CANVAS_H)
+#define CONTOUR3D_CANVAS_H
+
+#include <stdbool.h>
+#include "contour3d.h"
+#include "./struct.h"
+
+extern int contour3d_canvas_init (
+    const MPI_Comm comm,
+    const bool is_shared,
+    const bool has_ids,
+    const size_t width,
+    const size_t height,
+    const size_t offset,
+    const contour3d_color_t * const bg_color,
+    canvas_t * const canvas
+);
+
+extern int contour3d_canvas_finalise (
+    canvas_t * const canvas
+);
+
+extern int contour3d_canvas_release (
+    void
+);
+
+extern size_t contour3d_canvas_get_size (
+    const size_t nitems,
+    const bool has_ids
+);
+
+extern int contour3d_canvas_locate (
+    void * const memory,
+    const size_t nitems,
+    const bool has_ids,
+    double ** const depths,
+    uint16_t ** const ids,
+    contour3d_color_t ** const colors
+);
+
+extern bool contour3d_canvas_rect_is_empty (
+    const rect_t * const rect
+);
+
+extern rect_t contour3d_canvas_rect_union (
+    const rect_t * const rect0,
+    const rect_t * const rect1
+);
+
+extern int contour3d_canvas_touch (
+    canvas_t * const canvas,
+    const rect_t * const rect
+);
+
+#endif // CONTOUR3D_CANVAS_H
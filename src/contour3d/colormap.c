@@ -0,0 +1,84 @@
+#include <stddef.h>
+#include <math.h>
+#include <pthread.h>
+#include "contour3d.h"
+#include "./colormap.h"
+
+// colormaps are tabulated once, so that the rasteriser only looks up
+//   the level interpolated on each pixel
+// NOTE: the tables are shared by all threads and are never modified after built
+
+static contour3d_color_t tables[CONTOUR3D_NCOLORMAPS][CONTOUR3D_COLORMAP_NLEVELS];
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static uint8_t to_uint8 (
+    const double value
+) {
+  return (uint8_t)(255. * fmin(1., fmax(0., value)) + 0.5);
+}
+
+// piecewise-linear interpolation between the given colors at even intervals
+static contour3d_color_t blend (
+    const size_t ncolors,
+    const double colors[][3],
+    const double t
+) {
+  const double s = t * (ncolors - 1);
+  const size_t n = s < ncolors - 1 ? (size_t)s : ncolors - 2;
+  const double w = s - n;
+  return (contour3d_color_t){
+    .r = to_uint8((1. - w) * colors[n][0] + w * colors[n + 1][0]),
+    .g = to_uint8((1. - w) * colors[n][1] + w * colors[n + 1][1]),
+    .b = to_uint8((1. - w) * colors[n][2] + w * colors[n + 1][2]),
+  };
+}
+
+static void build (
+    void
+) {
+  // diverging blue - grey - red
+  const double coolwarm[][3] = {
+    {0.230, 0.299, 0.754},
+    {0.865, 0.865, 0.865},
+    {0.706, 0.016, 0.150},
+  };
+  // dark blue - blue - cyan - yellow - red - dark red
+  const double jet[][3] = {
+    {0.0, 0.0, 0.5},
+    {0.0, 0.0, 1.0},
+    {0.0, 1.0, 1.0},
+    {1.0, 1.0, 0.0},
+    {1.0, 0.0, 0.0},
+    {0.5, 0.0, 0.0},
+  };
+  const double gray[][3] = {
+    {0., 0., 0.},
+    {1., 1., 1.},
+  };
+  for (size_t n = 0; n < CONTOUR3D_COLORMAP_NLEVELS; n++) {
+    const double t = 1. * n / (CONTOUR3D_COLORMAP_NLEVELS - 1);
+    tables[CONTOUR3D_COLORMAP_NONE    ][n] = (contour3d_color_t){0xFF, 0xFF, 0xFF};
+    tables[CONTOUR3D_COLORMAP_GRAY    ][n] = blend(sizeof(gray) / sizeof(gray[0]), gray, t);
+    tables[CONTOUR3D_COLORMAP_COOLWARM][n] = blend(sizeof(coolwarm) / sizeof(coolwarm[0]), coolwarm, t);
+    tables[CONTOUR3D_COLORMAP_JET     ][n] = blend(sizeof(jet) / sizeof(jet[0]), jet, t);
+  }
+}
+
+// table of CONTOUR3D_COLORMAP_NLEVELS colors from the lower end to the upper end
+const contour3d_color_t * contour3d_colormap_get_table (
+    const contour3d_colormap_t colormap
+) {
+  pthread_once(&once, build);
+  return tables[colormap < CONTOUR3D_NCOLORMAPS ? colormap : CONTOUR3D_COLORMAP_NONE];
+}
+
+// index of the table for the given value,
+//   where values out of "range" are clamped to the ends
+uint8_t contour3d_colormap_get_level (
+    const double range[2],
+    const double value
+) {
+  const double width = range[1] - range[0];
+  const double t = 0. == width ? 0.5 : (value - range[0]) / width;
+  return (uint8_t)((CONTOUR3D_COLORMAP_NLEVELS - 1) * fmin(1., fmax(0., t)) + 0.5);
+}
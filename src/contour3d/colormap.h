@@ -0,0 +1,19 @@
+#if !defined(CONTOUR3D_COLORMAP_H)
+#define CONTOUR3D_COLORMAP_H
+
+#include <stdint.h>
+#include "contour3d.h"
+
+// number of entries of a colormap table
+#define CONTOUR3D_COLORMAP_NLEVELS 256
+
+extern const contour3d_color_t * contour3d_colormap_get_table (
+    const contour3d_colormap_t colormap
+);
+
+extern uint8_t contour3d_colormap_get_level (
+    const double range[2],
+    const double value
+);
+
+#endif // CONTOUR3D_COLORMAP_H
@@ -0,0 +1,431 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <mpi.h>
+#include "sdecomp.h"
+#include "./struct.h"
+#include "./memory.h"
+#include "./logger.h"
+#include "./canvas.h"
+#include "./config.h"
+#include "./profile.h"
+#include "./composite.h"
+
+// arrays of pixels, see canvas_t
+typedef struct {
+  double * depths;
+  uint16_t * ids;
+  contour3d_color_t * colors;
+} arrays_t;
+
+// take out the nearest pixel
+static inline void merge_pixel (
+    const arrays_t * restrict const in,
+    const size_t inindex,
+    const arrays_t * restrict const inout,
+    const size_t inoutindex
+) {
+  if (inout->depths[inoutindex] < in->depths[inindex]) {
+    inout->depths[inoutindex] = in->depths[inindex];
+    inout->colors[inoutindex] = in->colors[inindex];
+    if (NULL != inout->ids) {
+      inout->ids[inoutindex] = in->ids[inindex];
+    }
+  }
+}
+
+// arrays stored in the given memory
+static arrays_t locate_arrays (
+    void * const memory,
+    const size_t nitems,
+    const bool has_ids
+) {
+  arrays_t arrays = {0};
+  contour3d_canvas_locate(memory, nitems, has_ids, &arrays.depths, &arrays.ids, &arrays.colors);
+  return arrays;
+}
+
+// create a datatype to store contour3d_color_t
+static int create_color_type (
+    MPI_Datatype * const color_type
+) {
+  MPI_Datatype base_type = MPI_DATATYPE_NULL;
+  MPI_Type_create_struct(
+      1,
+      (int []) {3},
+      (MPI_Aint []) {
+        offsetof(contour3d_color_t, r),
+      },
+      (MPI_Datatype []) {
+        MPI_UNSIGNED_CHAR,
+      },
+      &base_type
+  );
+  MPI_Type_create_resized(base_type, 0, sizeof(contour3d_color_t), color_type);
+  MPI_Type_commit(color_type);
+  MPI_Type_free(&base_type);
+  return 0;
+}
+
+// active regions of all processes in the communicator
+static rect_t * gather_rects (
+    const MPI_Comm comm,
+    const rect_t * const rect
+) {
+  int nprocs = 0;
+  MPI_Comm_size(comm, &nprocs);
+  rect_t * const rects = contour3d_memory_alloc(nprocs, sizeof(rect_t));
+  uint64_t * const buf = contour3d_memory_alloc(4 * nprocs, sizeof(uint64_t));
+  if (NULL == rects || NULL == buf) {
+    logger_error("failed to allocate rectangles");
+    contour3d_memory_free(buf);
+    contour3d_memory_free(rects);
+    return NULL;
+  }
+  CONTOUR3D_TRACE_BEGIN(EVENT_ALLGATHER);
+  MPI_Allgather(
+      (uint64_t [4]) {rect->imin, rect->imax, rect->jmin, rect->jmax}, 4, MPI_UINT64_T,
+      buf, 4, MPI_UINT64_T,
+      comm
+  );
+  CONTOUR3D_TRACE_END(EVENT_ALLGATHER);
+  for (int rank = 0; rank < nprocs; rank++) {
+    rects[rank].imin = buf[4 * rank + 0];
+    rects[rank].imax = buf[4 * rank + 1];
+    rects[rank].jmin = buf[4 * rank + 2];
+    rects[rank].jmax = buf[4 * rank + 3];
+  }
+  contour3d_memory_free(buf);
+  return rects;
+}
+
+// bounding box of the regions touched by the processes "rank_min" to "rank_max - 1"
+static rect_t merge_rects (
+    const rect_t * const rects,
+    const int rank_min,
+    const int rank_max
+) {
+  rect_t rect = rects[rank_min];
+  for (int rank = rank_min + 1; rank < rank_max; rank++) {
+    rect = contour3d_canvas_rect_union(&rect, rects + rank);
+  }
+  return rect;
+}
+
+// combine the datatypes of the depths, the colors and the ids (if any),
+//   which are freed, to a single datatype
+//   relative to the beginning of the depths
+static int combine_types (
+    const arrays_t * const arrays,
+    MPI_Datatype types[3],
+    MPI_Datatype * const combined
+) {
+  const int ntypes = NULL == arrays->ids ? 2 : 3;
+  const char * const base = (const char *)arrays->depths;
+  MPI_Type_create_struct(
+      ntypes,
+      (int []) {1, 1, 1},
+      (MPI_Aint []) {
+        0,
+        (const char *)arrays->colors - base,
+        NULL == arrays->ids ? 0 : (const char *)arrays->ids - base,
+      },
+      types,
+      combined
+  );
+  MPI_Type_commit(combined);
+  for (int n = 0; n < ntypes; n++) {
+    MPI_Type_free(types + n);
+  }
+  return 0;
+}
+
+// a datatype which describes the given rectangle on the canvas
+static int create_rect_type (
+    const canvas_t * const canvas,
+    const rect_t * const rect,
+    const MPI_Datatype color_type,
+    MPI_Datatype * const rect_type
+) {
+  const arrays_t arrays = {
+    .depths = canvas->depths,
+    .ids = canvas->ids,
+    .colors = canvas->colors,
+  };
+  MPI_Datatype types[3] = {MPI_DOUBLE, color_type, MPI_UINT16_T};
+  for (size_t n = 0; n < 3; n++) {
+    MPI_Type_create_subarray(
+        2,
+        (int []) {canvas->height, canvas->width},
+        (int []) {rect->jmax - rect->jmin, rect->imax - rect->imin},
+        (int []) {rect->jmin, rect->imin},
+        MPI_ORDER_C,
+        types[n],
+        types + n
+    );
+  }
+  if (NULL == arrays.ids) {
+    MPI_Type_free(types + 2);
+  }
+  return combine_types(&arrays, types, rect_type);
+}
+
+// a datatype which describes the contiguous arrays of "nitems" pixels
+static int create_buffer_type (
+    const arrays_t * const arrays,
+    const size_t nitems,
+    const MPI_Datatype color_type,
+    MPI_Datatype * const buffer_type
+) {
+  MPI_Datatype types[3] = {MPI_DOUBLE, color_type, MPI_UINT16_T};
+  for (size_t n = 0; n < 3; n++) {
+    MPI_Type_contiguous(nitems, types[n], types + n);
+  }
+  if (NULL == arrays->ids) {
+    MPI_Type_free(types + 2);
+  }
+  return combine_types(arrays, types, buffer_type);
+}
+
+// number of rows exchanged at once,
+//   which is limited by the memory budget of the receiver
+static size_t get_strip_height (
+    const rect_t * const rect,
+    const bool has_ids
+) {
+  const size_t rect_width  = rect->imax - rect->imin;
+  const size_t rect_height = rect->jmax - rect->jmin;
+  if (0 == contour3d_config_get()->memory_budget) {
+    return rect_height;
+  }
+  const size_t row_bytes = contour3d_canvas_get_size(rect_width, has_ids);
+  const size_t nrows = contour3d_memory_get_available() / row_bytes;
+  return nrows < 1 ? 1 : rect_height < nrows ? rect_height : nrows;
+}
+
+// communicate among all processes to obtain the nearest pixel color,
+//   which is held by the main process
+// only the active regions are exchanged using a binomial tree,
+//   and the processes which touched nothing contribute nothing
+// the receiver tells the height of the row strips, which are limited by the memory budget,
+//   or zero when it failed to allocate the buffer
+static int extract_nearest (
+    const MPI_Comm comm,
+    canvas_t * const canvas
+) {
+  int nprocs = 0;
+  int myrank = 0;
+  MPI_Comm_size(comm, &nprocs);
+  MPI_Comm_rank(comm, &myrank);
+  // share the active regions of all processes,
+  //   so that each process knows which pixels are to be exchanged
+  rect_t * const rects = gather_rects(comm, &canvas->active);
+  if (NULL == rects) {
+    logger_error("failed to gather active regions");
+    return 1;
+  }
+  MPI_Datatype color_type = MPI_DATATYPE_NULL;
+  create_color_type(&color_type);
+  // at each step, processes whose "step" bit is set
+  //   send the region merged so far to their partners and leave,
+  //   while the others receive and keep the nearest pixels
+  const size_t width = canvas->width;
+  // set when I failed to receive, after which I keep telling my senders to skip
+  int is_failed = 0;
+  for (int step = 1; step < nprocs; step <<= 1) {
+    if (myrank & step) {
+      const int dest = myrank - step;
+      const int rank_max = myrank + step < nprocs ? myrank + step : nprocs;
+      const rect_t rect = merge_rects(rects, myrank, rank_max);
+      if (contour3d_canvas_rect_is_empty(&rect)) {
+        break;
+      }
+      // zero when the receiver failed to prepare its buffer
+      uint64_t strip_height = 0;
+      CONTOUR3D_TRACE_BEGIN(EVENT_RECV);
+      MPI_Recv(&strip_height, 1, MPI_UINT64_T, dest, 1, comm, MPI_STATUS_IGNORE);
+      CONTOUR3D_TRACE_END(EVENT_RECV);
+      for (size_t jmin = rect.jmin; 0 != strip_height && jmin < rect.jmax; jmin += strip_height) {
+        const size_t jmax = jmin + strip_height < rect.jmax ? jmin + strip_height : rect.jmax;
+        const rect_t strip = {.imin = rect.imin, .imax = rect.imax, .jmin = jmin, .jmax = jmax};
+        MPI_Datatype rect_type = MPI_DATATYPE_NULL;
+        create_rect_type(canvas, &strip, color_type, &rect_type);
+        CONTOUR3D_TRACE_BEGIN(EVENT_SEND);
+        MPI_Send(canvas->depths, 1, rect_type, dest, 0, comm);
+        CONTOUR3D_TRACE_END(EVENT_SEND);
+        MPI_Type_free(&rect_type);
+      }
+      break;
+    }
+    const int src = myrank + step;
+    if (nprocs <= src) {
+      continue;
+    }
+    const int rank_max = src + step < nprocs ? src + step : nprocs;
+    const rect_t rect = merge_rects(rects, src, rank_max);
+    if (contour3d_canvas_rect_is_empty(&rect)) {
+      continue;
+    }
+    const size_t rect_width  = rect.imax - rect.imin;
+    const bool has_ids = NULL != canvas->ids;
+    // the buffer is prepared before the sender is told the strip height,
+    //   which is zero to let it skip sending after a failure
+    uint64_t strip_height = get_strip_height(&rect, has_ids);
+    void * const buffer = is_failed ? NULL : contour3d_memory_alloc(
+        contour3d_canvas_get_size(rect_width * strip_height, has_ids),
+        sizeof(uint8_t)
+    );
+    if (NULL == buffer) {
+      if (!is_failed) {
+        logger_error("failed to allocate compositing buffer");
+      }
+      is_failed = 1;
+      strip_height = 0;
+    }
+    CONTOUR3D_TRACE_BEGIN(EVENT_SEND);
+    MPI_Send(&strip_height, 1, MPI_UINT64_T, src, 1, comm);
+    CONTOUR3D_TRACE_END(EVENT_SEND);
+    if (is_failed) {
+      continue;
+    }
+    const arrays_t inout = {
+      .depths = canvas->depths,
+      .ids = canvas->ids,
+      .colors = canvas->colors,
+    };
+    for (size_t jmin = rect.jmin; jmin < rect.jmax; jmin += strip_height) {
+      const size_t jmax = jmin + strip_height < rect.jmax ? jmin + strip_height : rect.jmax;
+      const size_t nitems = rect_width * (jmax - jmin);
+      const arrays_t in = locate_arrays(buffer, nitems, has_ids);
+      MPI_Datatype buffer_type = MPI_DATATYPE_NULL;
+      create_buffer_type(&in, nitems, color_type, &buffer_type);
+      CONTOUR3D_TRACE_BEGIN(EVENT_RECV);
+      MPI_Recv(buffer, 1, buffer_type, src, 0, comm, MPI_STATUS_IGNORE);
+      CONTOUR3D_TRACE_END(EVENT_RECV);
+      MPI_Type_free(&buffer_type);
+      for (size_t j = jmin; j < jmax; j++) {
+        for (size_t i = 0; i < rect_width; i++) {
+          const size_t inindex = (j - jmin) * rect_width + i;
+          const size_t inoutindex = j * width + (i + rect.imin);
+          merge_pixel(&in, inindex, &inout, inoutindex);
+        }
+      }
+    }
+    contour3d_memory_free(buffer);
+    contour3d_canvas_touch(canvas, &rect);
+  }
+  // clean-up
+  MPI_Type_free(&color_type);
+  contour3d_memory_free(rects);
+  // all processes fail together
+  CONTOUR3D_TRACE_BEGIN(EVENT_ALLREDUCE);
+  MPI_Allreduce(MPI_IN_PLACE, &is_failed, 1, MPI_INT, MPI_MAX, comm);
+  CONTOUR3D_TRACE_END(EVENT_ALLREDUCE);
+  return is_failed;
+}
+
+// depth-composite the canvases of the processes sharing the same node,
+//   whose result is stored in the canvas of the node-local main process
+// each process on the node takes care of a part of the rows,
+//   reading the other canvases directly from the shared window
+static int composite_in_node (
+    canvas_t * const canvas
+) {
+  const MPI_Comm comm_node = canvas->comm_node;
+  const MPI_Win win = canvas->win;
+  int nprocs = 0;
+  int myrank = 0;
+  MPI_Comm_size(comm_node, &nprocs);
+  MPI_Comm_rank(comm_node, &myrank);
+  // gathering the active regions also waits for all processes to finish drawing,
+  //   whose pixels are made visible to the others by the memory barriers around it
+  MPI_Win_sync(win);
+  rect_t * const rects = gather_rects(comm_node, &canvas->active);
+  MPI_Win_sync(win);
+  if (NULL == rects) {
+    logger_error("failed to gather active regions");
+    return 1;
+  }
+  const rect_t node_rect = merge_rects(rects, 0, nprocs);
+  if (!contour3d_canvas_rect_is_empty(&node_rect)) {
+    const size_t width = canvas->width;
+    // rows which I am responsible for
+    const size_t nrows = node_rect.jmax - node_rect.jmin;
+    const size_t jmin = node_rect.jmin + nrows * (myrank + 0) / nprocs;
+    const size_t jmax = node_rect.jmin + nrows * (myrank + 1) / nprocs;
+    // all segments have the same layout
+    const size_t nitems = width * canvas->height;
+    const bool has_ids = NULL != canvas->ids;
+    void * memory = NULL;
+    {
+      MPI_Aint size = 0;
+      int disp_unit = 0;
+      MPI_Win_shared_query(win, 0, &size, &disp_unit, &memory);
+    }
+    const arrays_t inout = locate_arrays(memory, nitems, has_ids);
+    for (int rank = 1; rank < nprocs; rank++) {
+      const rect_t * const rect = rects + rank;
+      if (contour3d_canvas_rect_is_empty(rect)) {
+        continue;
+      }
+      {
+        MPI_Aint size = 0;
+        int disp_unit = 0;
+        MPI_Win_shared_query(win, rank, &size, &disp_unit, &memory);
+      }
+      const arrays_t in = locate_arrays(memory, nitems, has_ids);
+      const size_t jmin_ = jmin < rect->jmin ? rect->jmin : jmin;
+      const size_t jmax_ = jmax < rect->jmax ? jmax : rect->jmax;
+      for (size_t j = jmin_; j < jmax_; j++) {
+        for (size_t i = rect->imin; i < rect->imax; i++) {
+          const size_t index = j * width + i;
+          merge_pixel(&in, index, &inout, index);
+        }
+      }
+    }
+  }
+  // wait for all processes to finish compositing,
+  //   after which the segments may be overwritten by the next frame
+  CONTOUR3D_TRACE_BEGIN(EVENT_WIN_SYNC);
+  MPI_Win_sync(win);
+  MPI_Barrier(comm_node);
+  MPI_Win_sync(win);
+  CONTOUR3D_TRACE_END(EVENT_WIN_SYNC);
+  if (0 == myrank) {
+    canvas->active = node_rect;
+  }
+  contour3d_memory_free(rects);
+  return 0;
+}
+
+// gather the nearest pixels to the main process
+static int composite (
+    const sdecomp_info_t * const sdecomp_info,
+    canvas_t * const canvas
+) {
+  MPI_Comm comm_cart = MPI_COMM_NULL;
+  sdecomp.get_comm_cart(sdecomp_info, &comm_cart);
+  if (MPI_COMM_NULL == canvas->comm_node) {
+    return extract_nearest(comm_cart, canvas);
+  }
+  // two-level compositing:
+  //   first inside each node, and then among the node-local main processes
+  if (0 != composite_in_node(canvas)) {
+    logger_error("failed to composite canvases inside node");
+    return 1;
+  }
+  if (MPI_COMM_NULL == canvas->comm_leaders) {
+    return 0;
+  }
+  return extract_nearest(canvas->comm_leaders, canvas);
+}
+
+int contour3d_composite (
+    const sdecomp_info_t * const sdecomp_info,
+    canvas_t * const canvas
+) {
+  const contour3d_memory_subsystem_t subsystem = contour3d_memory_set_subsystem(CONTOUR3D_MEMORY_COMPOSITING);
+  const int retval = composite(sdecomp_info, canvas);
+  contour3d_memory_set_subsystem(subsystem);
+  return retval;
+}
+
@@ -0,0 +1,12 @@
+#if !defined(CONTOUR3D_COMPOSITE_H)
+#define CONTOUR3D_COMPOSITE_H
+
+#include "sdecomp.h"
+#include "./struct.h"
+
+extern int contour3d_composite (
+    const sdecomp_info_t * const sdecomp_info,
+    canvas_t * const canvas
+);
+
+#endif // CONTOUR3D_COMPOSITE_H
@@ -0,0 +1,24 @@
+#include "contour3d.h"
+#include "./logger.h"
+#include "./config.h"
+
+// settings shared by all frames, default: all zero
+static contour3d_config_t config = {0};
+
+int contour3d_configure (
+    const contour3d_config_t * const new_config
+) {
+  if (NULL == new_config) {
+    logger_error("configuration is not given");
+    return 1;
+  }
+  config = *new_config;
+  return 0;
+}
+
+const contour3d_config_t * contour3d_config_get (
+    void
+) {
+  return &config;
+}
+
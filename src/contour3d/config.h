@@ -0,0 +1,10 @@
+#if !defined(CONTOUR3D_CONFIG_H)
+#define CONTOUR3D_CONFIG_H
+
+#include "contour3d.h"
+
+extern const contour3d_config_t * contour3d_config_get (
+    void
+);
+
+#endif // CONTOUR3D_CONFIG_H
@@ -0,0 +1,113 @@
+#include <stdbool.h>
+#include <mpi.h>
+#include "sdecomp.h"
+#include "contour3d.h"
+#include "../memory.h"
+#include "../logger.h"
+#include "./internal.h"
+
+// a clip box limits the lattices from which triangles are extracted
+//   to those overlapping the box (on the orthogonal coordinate system)
+// a process is involved when it holds a node needed by anyone,
+//   i.e. the nodes of the clipped lattices and of their neighbours
+//   (which are used to find the vertex normals)
+// the others skip the halo exchange and the extraction,
+//   and are excluded from the halo exchanges of their neighbours,
+//   whose ghost values are then not used after narrowing
+
+// lattices [lattices[0] : lattices[1]) overlapping [lower : upper],
+//   which are empty when nothing overlaps
+static void find_lattices (
+    const size_t nitems,
+    const double * const grid,
+    const double lower,
+    const double upper,
+    size_t lattices[2]
+) {
+  lattices[0] = 0;
+  lattices[1] = 0;
+  for (/* each lattice */ size_t n = 0; n + 1 < nitems; n++) {
+    if (grid[n + 1] < lower || upper < grid[n]) {
+      continue;
+    }
+    if (lattices[1] <= lattices[0]) {
+      lattices[0] = n;
+    }
+    lattices[1] = n + 1;
+  }
+}
+
+// find the clipped lattices and share which processes are involved,
+//   which is collective and is thus called by all processes
+int contour3d_contour_init_clip (
+    const sdecomp_info_t * const sdecomp_info,
+    const contour3d_contour_obj_t * const contour_obj,
+    clip_t * const clip
+) {
+  const contour3d_vector_t * const box = contour_obj->clip_box;
+  const double lowers[CONTOUR3D_NDIMS] = {box[0].x, box[0].y, box[0].z};
+  const double uppers[CONTOUR3D_NDIMS] = {box[1].x, box[1].y, box[1].z};
+  int is_involved = 1;
+  for (sdecomp_dir_t dir = 0; dir < CONTOUR3D_NDIMS; dir++) {
+    const size_t glsize = contour_obj->glsizes[dir];
+    size_t * const lattices = clip->lattices[dir];
+    find_lattices(glsize, contour_obj->grids[dir], lowers[dir], uppers[dir], lattices);
+    size_t mysize = 0;
+    size_t offset = 0;
+    if (0 != sdecomp.get_pencil_mysize(sdecomp_info, contour_obj->pencil, dir, glsize, &mysize)) {
+      logger_error("sdecomp.get_pencil_mysize failed");
+      return 1;
+    }
+    if (0 != sdecomp.get_pencil_offset(sdecomp_info, contour_obj->pencil, dir, glsize, &offset)) {
+      logger_error("sdecomp.get_pencil_offset failed");
+      return 1;
+    }
+    // nodes needed by anyone: [nmin : nmax)
+    const size_t nmin = 0 == lattices[0] ? 0 : lattices[0] - 1;
+    const size_t nmax = lattices[1] + 2;
+    if (lattices[1] <= lattices[0] || offset + mysize <= nmin || nmax <= offset) {
+      is_involved = 0;
+    }
+  }
+  MPI_Comm comm_cart = MPI_COMM_NULL;
+  sdecomp.get_comm_cart(sdecomp_info, &comm_cart);
+  int nprocs = 0;
+  MPI_Comm_size(comm_cart, &nprocs);
+  clip->is_involved = is_involved;
+  clip->involved = contour3d_memory_alloc(nprocs, sizeof(int));
+  if (NULL == clip->involved) {
+    logger_error("failed to allocate clip flags");
+    return 1;
+  }
+  MPI_Allgather(&is_involved, 1, MPI_INT, clip->involved, 1, MPI_INT, comm_cart);
+  return 0;
+}
+
+// narrow the extended array to the clipped lattices and one more on each side,
+//   giving the shift of the first value,
+//   which returns false when no lattice is left to be extracted
+bool contour3d_contour_narrow (
+    const clip_t * const clip,
+    const size_t strides_ext[CONTOUR3D_NDIMS],
+    size_t mysizes_ext[CONTOUR3D_NDIMS],
+    size_t offsets_ext[CONTOUR3D_NDIMS],
+    size_t * const shift
+) {
+  *shift = 0;
+  for (sdecomp_dir_t dir = 0; dir < CONTOUR3D_NDIMS; dir++) {
+    // lattices whose triangles are emitted (in the global indices),
+    //   since the edge ones are only used to find the vertex normals
+    const size_t lower = offsets_ext[dir] + 1;
+    const size_t upper = offsets_ext[dir] + mysizes_ext[dir] - 2;
+    const size_t * const lattices = clip->lattices[dir];
+    const size_t begin = lower < lattices[0] ? lattices[0] : lower;
+    const size_t end = lattices[1] < upper ? lattices[1] : upper;
+    if (end <= begin) {
+      return false;
+    }
+    *shift += (begin - 1 - offsets_ext[dir]) * strides_ext[dir];
+    mysizes_ext[dir] = end - begin + 3;
+    offsets_ext[dir] = begin - 1;
+  }
+  return true;
+}
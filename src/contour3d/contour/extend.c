@@ -5,13 +5,30 @@
 #include "../struct.h"
 #include "../memory.h"
 #include "../logger.h"
+#include "../profile.h"
 #include "./internal.h"
 
+// neighbours which are not involved (see "clip.c") neither send nor receive
+static void exclude_neighbours (
+    const int * const involved,
+    int neighbours[2]
+) {
+  if (NULL == involved) {
+    return;
+  }
+  for (size_t n = 0; n < 2; n++) {
+    if (MPI_PROC_NULL != neighbours[n] && !involved[neighbours[n]]) {
+      neighbours[n] = MPI_PROC_NULL;
+    }
+  }
+}
+
 static int communicate_in_x (
     const sdecomp_info_t * const sdecomp_info,
     const sdecomp_pencil_t pencil,
     const size_t n_add,
     const size_t mysizes_tmp[CONTOUR3D_NDIMS],
+    const int * const involved,
     double * const array_tmp
 ) {
   MPI_Comm comm_cart = MPI_COMM_NULL;
@@ -19,6 +36,7 @@ static int communicate_in_x (
   // check negative / positive neighbour ranks
   int neighbours[2] = {MPI_PROC_NULL, MPI_PROC_NULL};
   sdecomp.get_neighbours(sdecomp_info, pencil, SDECOMP_XDIR, neighbours);
+  exclude_neighbours(involved, neighbours);
   // define datatype
   MPI_Datatype dtype = MPI_DATATYPE_NULL;
   MPI_Type_create_hvector(
@@ -33,21 +51,25 @@ static int communicate_in_x (
   {
     const size_t soffset = mysizes_tmp[0] - 2 * n_add;
     const size_t roffset =                  0 * n_add;
+    CONTOUR3D_TRACE_BEGIN(EVENT_SENDRECV);
     MPI_Sendrecv(
         array_tmp + soffset, 1, dtype, neighbours[1], 0,
         array_tmp + roffset, 1, dtype, neighbours[0], 0,
         comm_cart, MPI_STATUS_IGNORE
     );
+    CONTOUR3D_TRACE_END(EVENT_SENDRECV);
   }
   // send to negative, receive from positive
   {
     const size_t soffset =                  1 * n_add;
     const size_t roffset = mysizes_tmp[0] - 1 * n_add;
+    CONTOUR3D_TRACE_BEGIN(EVENT_SENDRECV);
     MPI_Sendrecv(
         array_tmp + soffset, 1, dtype, neighbours[0], 0,
         array_tmp + roffset, 1, dtype, neighbours[1], 0,
         comm_cart, MPI_STATUS_IGNORE
     );
+    CONTOUR3D_TRACE_END(EVENT_SENDRECV);
   }
   // clean-up used datatype
   MPI_Type_free(&dtype);
@@ -59,6 +81,7 @@ static int communicate_in_y (
     const sdecomp_pencil_t pencil,
     const size_t n_add,
     const size_t mysizes_tmp[CONTOUR3D_NDIMS],
+    const int * const involved,
     double * const array_tmp
 ) {
   MPI_Comm comm_cart = MPI_COMM_NULL;
@@ -66,6 +89,7 @@ static int communicate_in_y (
   // check negative / positive neighbour ranks
   int neighbours[2] = {MPI_PROC_NULL, MPI_PROC_NULL};
   sdecomp.get_neighbours(sdecomp_info, pencil, SDECOMP_YDIR, neighbours);
+  exclude_neighbours(involved, neighbours);
   // define datatype
   MPI_Datatype dtype = MPI_DATATYPE_NULL;
   MPI_Type_create_hvector(
@@ -80,21 +104,25 @@ static int communicate_in_y (
   {
     const size_t soffset = (mysizes_tmp[1] - 2 * n_add) * mysizes_tmp[0];
     const size_t roffset = (                 0 * n_add) * mysizes_tmp[0];
+    CONTOUR3D_TRACE_BEGIN(EVENT_SENDRECV);
     MPI_Sendrecv(
         array_tmp + soffset, 1, dtype, neighbours[1], 0,
         array_tmp + roffset, 1, dtype, neighbours[0], 0,
         comm_cart, MPI_STATUS_IGNORE
     );
+    CONTOUR3D_TRACE_END(EVENT_SENDRECV);
   }
   // send to negative, receive from positive
   {
     const size_t soffset = (                 1 * n_add) * mysizes_tmp[0];
     const size_t roffset = (mysizes_tmp[1] - 1 * n_add) * mysizes_tmp[0];
+    CONTOUR3D_TRACE_BEGIN(EVENT_SENDRECV);
     MPI_Sendrecv(
         array_tmp + soffset, 1, dtype, neighbours[0], 0,
         array_tmp + roffset, 1, dtype, neighbours[1], 0,
         comm_cart, MPI_STATUS_IGNORE
     );
+    CONTOUR3D_TRACE_END(EVENT_SENDRECV);
   }
   // clean-up used datatype
   MPI_Type_free(&dtype);
@@ -106,6 +134,7 @@ static int communicate_in_z (
     const sdecomp_pencil_t pencil,
     const size_t n_add,
     const size_t mysizes_tmp[CONTOUR3D_NDIMS],
+    const int * const involved,
     double * const array_tmp
 ) {
   MPI_Comm comm_cart = MPI_COMM_NULL;
@@ -113,6 +142,7 @@ static int communicate_in_z (
   // check negative / positive neighbour ranks
   int neighbours[2] = {MPI_PROC_NULL, MPI_PROC_NULL};
   sdecomp.get_neighbours(sdecomp_info, pencil, SDECOMP_ZDIR, neighbours);
+  exclude_neighbours(involved, neighbours);
   // define datatype
   MPI_Datatype dtype = MPI_DATATYPE_NULL;
   MPI_Type_contiguous(
@@ -125,34 +155,67 @@ static int communicate_in_z (
   {
     const size_t soffset = (mysizes_tmp[2] - 2 * n_add) * mysizes_tmp[1] * mysizes_tmp[0];
     const size_t roffset = (                 0 * n_add) * mysizes_tmp[1] * mysizes_tmp[0];
+    CONTOUR3D_TRACE_BEGIN(EVENT_SENDRECV);
     MPI_Sendrecv(
         array_tmp + soffset, 1, dtype, neighbours[1], 0,
         array_tmp + roffset, 1, dtype, neighbours[0], 0,
         comm_cart, MPI_STATUS_IGNORE
     );
+    CONTOUR3D_TRACE_END(EVENT_SENDRECV);
   }
   // send to negative, receive from positive
   {
     const size_t soffset = (                 1 * n_add) * mysizes_tmp[1] * mysizes_tmp[0];
     const size_t roffset = (mysizes_tmp[2] - 1 * n_add) * mysizes_tmp[1] * mysizes_tmp[0];
+    CONTOUR3D_TRACE_BEGIN(EVENT_SENDRECV);
     MPI_Sendrecv(
         array_tmp + soffset, 1, dtype, neighbours[0], 0,
         array_tmp + roffset, 1, dtype, neighbours[1], 0,
         comm_cart, MPI_STATUS_IGNORE
     );
+    CONTOUR3D_TRACE_END(EVENT_SENDRECV);
   }
   // clean-up used datatype
   MPI_Type_free(&dtype);
   return 0;
 }
 
-// extend the given three-dimensional domain to avoid gaps between processes
+// strides of the given array (or of "color_array", which shares the layout),
+//   which may have halos and padded dimensions,
+//   and its first value which is not a halo
+void contour3d_contour_find_layout (
+    const contour3d_contour_obj_t * const contour_obj,
+    double * const array,
+    const size_t mysizes[CONTOUR3D_NDIMS],
+    size_t strides[CONTOUR3D_NDIMS],
+    double ** const interior
+) {
+  const size_t * const halos = contour_obj->halo_widths;
+  for (sdecomp_dir_t dir = 0; dir < CONTOUR3D_NDIMS; dir++) {
+    strides[dir] = 0 != contour_obj->strides[dir] ? contour_obj->strides[dir]
+      : 0 == dir ? 1
+      : strides[dir - 1] * (mysizes[dir - 1] + 2 * halos[dir - 1]);
+  }
+  *interior = array
+    + halos[0] * strides[0]
+    + halos[1] * strides[1]
+    + halos[2] * strides[2];
+}
+
+// extend the given three-dimensional domain to avoid gaps between processes,
+//   whose values are at "array_ext[i * strides_ext[0] + j * strides_ext[1] + k * strides_ext[2]]"
+// when the given array holds enough ghost layers,
+//   it is read in place ("is_in_place"), which should not be freed
+// "involved" flags the processes joining the halo exchange, or is NULL for all
 int contour3d_contour_extend_domain (
     const sdecomp_info_t * const sdecomp_info,
     const contour3d_contour_obj_t * const contour_obj,
     size_t mysizes_ext[CONTOUR3D_NDIMS],
     size_t offsets_ext[CONTOUR3D_NDIMS],
-    double ** const array_ext
+    size_t strides_ext[CONTOUR3D_NDIMS],
+    double ** const array_ext,
+    bool * const is_in_place,
+    const int * const involved
 ) {
   // number of local grid points and offsets of the original array
   size_t mysizes[CONTOUR3D_NDIMS] = {0};
@@ -187,32 +250,10 @@ int contour3d_contour_extend_domain (
     mysizes_tmp[dir] = mysizes[dir] + 2 * n_add;
     offsets_tmp[dir] = offsets[dir];
   }
-  // allocate the extended array and pack the original array
-  double * const array_tmp = contour3d_memory_alloc(
-      mysizes_tmp[0] * mysizes_tmp[1] * mysizes_tmp[2],
-      sizeof(double)
-  );
-  if (NULL == array_tmp) {
-    logger_error("failed to allocate temporary array");
-    return 1;
-  }
-  const double * const array = contour_obj->array;
-  for (size_t k = 0; k < mysizes[2]; k++) {
-    for (size_t j = 0; j < mysizes[1]; j++) {
-      for (size_t i = 0; i < mysizes[0]; i++) {
-        const size_t index     = ((k +     0) *     mysizes[1] + (j +     0)) *     mysizes[0] + (i +     0);
-        const size_t index_tmp = ((k + n_add) * mysizes_tmp[1] + (j + n_add)) * mysizes_tmp[0] + (i + n_add);
-        array_tmp[index_tmp] = array[index];
-      }
-    }
-  }
-  // exchange edge values
-  // NOTE: straightforward but verbose implementation
-  communicate_in_x(sdecomp_info, contour_obj->pencil, n_add, mysizes_tmp, array_tmp);
-  communicate_in_y(sdecomp_info, contour_obj->pencil, n_add, mysizes_tmp, array_tmp);
-  communicate_in_z(sdecomp_info, contour_obj->pencil, n_add, mysizes_tmp, array_tmp);
-  // now allocate another array, where the edge cells
-  //   of the edge processes are excluded to avoid out-of-bounds access
+  // the resulting array, where the edge cells
+  //   of the edge processes are excluded to avoid out-of-bounds access,
+  //   is a sub-box of the temporary array and is compacted in place,
+  //   so that only one array is held at a time
   int nprocss[CONTOUR3D_NDIMS] = {0};
   int myranks[CONTOUR3D_NDIMS] = {0};
   for (sdecomp_dir_t dir = 0; dir < CONTOUR3D_NDIMS; dir++) {
@@ -250,15 +291,49 @@ int contour3d_contour_extend_domain (
       mysizes_ext[dir] -= n_add;
     }
   }
-  // allocate the resulting extended array and pack the temporal array
-  *array_ext = contour3d_memory_alloc(
-      mysizes_ext[0] * mysizes_ext[1] * mysizes_ext[2],
+  // layout of the given array, which may have halos and padded dimensions
+  const size_t * const halos = contour_obj->halo_widths;
+  size_t strides[CONTOUR3D_NDIMS] = {0};
+  double * array = NULL;
+  contour3d_contour_find_layout(contour_obj, contour_obj->array, mysizes, strides, &array);
+  // the ghost layers already hold the values of the neighbours,
+  //   and thus the extended array is a view of the given array
+  //   without copying or communicating
+  if (n_add <= halos[0] && n_add <= halos[1] && n_add <= halos[2]) {
+    *array_ext = array
+      - (clip[0][0] ? 0 : n_add) * strides[0]
+      - (clip[1][0] ? 0 : n_add) * strides[1]
+      - (clip[2][0] ? 0 : n_add) * strides[2];
+    for (sdecomp_dir_t dir = 0; dir < CONTOUR3D_NDIMS; dir++) {
+      strides_ext[dir] = strides[dir];
+    }
+    *is_in_place = true;
+    return 0;
+  }
+  // allocate the temporary array and pack the original array
+  double * const array_tmp = contour3d_memory_alloc(
+      mysizes_tmp[0] * mysizes_tmp[1] * mysizes_tmp[2],
       sizeof(double)
   );
-  if (NULL == *array_ext) {
-    logger_error("failed to allocate extended array");
+  if (NULL == array_tmp) {
+    logger_error("failed to allocate temporary array");
     return 1;
   }
+  for (size_t k = 0; k < mysizes[2]; k++) {
+    for (size_t j = 0; j < mysizes[1]; j++) {
+      for (size_t i = 0; i < mysizes[0]; i++) {
+        const size_t index     = k * strides[2] + j * strides[1] + i * strides[0];
+        const size_t index_tmp = ((k + n_add) * mysizes_tmp[1] + (j + n_add)) * mysizes_tmp[0] + (i + n_add);
+        array_tmp[index_tmp] = array[index];
+      }
+    }
+  }
+  // exchange edge values
+  // NOTE: straightforward but verbose implementation
+  communicate_in_x(sdecomp_info, contour_obj->pencil, n_add, mysizes_tmp, involved, array_tmp);
+  communicate_in_y(sdecomp_info, contour_obj->pencil, n_add, mysizes_tmp, involved, array_tmp);
+  communicate_in_z(sdecomp_info, contour_obj->pencil, n_add, mysizes_tmp, involved, array_tmp);
+  // pack the temporal array to the resulting array
   // mimimum indices are n_add or 0, depending on the negative-clipping flags
   const size_t imin = clip[0][0] ? n_add : 0;
   const size_t jmin = clip[1][0] ? n_add : 0;
@@ -267,17 +342,30 @@ int contour3d_contour_extend_domain (
   const size_t imax = imin + mysizes_ext[0];
   const size_t jmax = jmin + mysizes_ext[1];
   const size_t kmax = kmin + mysizes_ext[2];
-  // copy from array_tmp to array_ext
+  // copy from array_tmp to array_ext in place,
+  //   which is safe since index_ext never exceeds index_tmp
   for (size_t index_ext = 0, k = kmin; k < kmax; k++) {
     for (size_t j = jmin; j < jmax; j++) {
       for (size_t i = imin; i < imax; i++) {
         const size_t index_tmp = (k * mysizes_tmp[1] + j) * mysizes_tmp[0] + i;
-        (*array_ext)[index_ext++] = array_tmp[index_tmp];
+        array_tmp[index_ext++] = array_tmp[index_tmp];
       }
     }
   }
-  // clean-up
-  contour3d_memory_free(array_tmp);
+  // shrink, which is done in place as this is the last allocation
+  *array_ext = contour3d_memory_realloc(
+      array_tmp,
+      mysizes_ext[0] * mysizes_ext[1] * mysizes_ext[2],
+      sizeof(double)
+  );
+  if (NULL == *array_ext) {
+    logger_error("failed to shrink extended array");
+    return 1;
+  }
+  strides_ext[0] = 1;
+  strides_ext[1] = mysizes_ext[0];
+  strides_ext[2] = mysizes_ext[0] * mysizes_ext[1];
+  *is_in_place = false;
   return 0;
 }
 
@@ -4,6 +4,40 @@
 #include "sdecomp.h"
 #include "contour3d.h"
 #include "../struct.h"
+#include "../primitive.h"
+
+// how the lattice corners of a contour object are mapped to the Cartesian coordinate,
+//   which is found once per object
+typedef struct {
+  // the corners in x and y are "origins + (offsets + index) * spacings" when uniform,
+  //   where "offsets" are the global indices of the extended array,
+  //   and are read from the grids otherwise
+  bool is_uniform;
+  double origins[2];
+  double spacings[2];
+  size_t offsets[2];
+  // converters applied to the intersections,
+  //   both NULL when the orthogonal coordinate is Cartesian up to "affine"
+  //   and the batched one is preferred when given
+  contour3d_vector_t (* converter) (
+      const contour3d_vector_t orthogonal
+  );
+  void (* batch_converter) (
+      const size_t npoints,
+      contour3d_vector_t * const points
+  );
+  // [A | b] applied to the triangle vertices, or NULL for the identity
+  const double (* affine)[CONTOUR3D_NDIMS + 1];
+} mapping_t;
+
+// lattices overlapping the clip box of a contour object
+typedef struct {
+  // [lattices[dim][0] : lattices[dim][1]) in the global indices
+  size_t lattices[CONTOUR3D_NDIMS][2];
+  // whether each process (of the Cartesian communicator) holds a node needed by anyone
+  int is_involved;
+  int * involved;
+} clip_t;
 
 extern int contour3d_process_contour_obj (
     const sdecomp_info_t * const sdecomp_info,
@@ -11,7 +45,9 @@ extern int contour3d_process_contour_obj (
     const contour3d_vector_t * const light,
     const screen_t * const screen,
     const contour3d_contour_obj_t * const contour_obj,
-    pixel_t * const canvas
+    const uint16_t id,
+    primitives_t * const primitives,
+    canvas_t * const canvas
 );
 
 extern int contour3d_contour_extend_domain (
@@ -19,16 +55,64 @@ extern int contour3d_contour_extend_domain (
     const contour3d_contour_obj_t * const contour_obj,
     size_t mysizes_ext[3],
     size_t offsets_ext[3],
-    double ** array_ext
+    size_t strides_ext[3],
+    double ** array_ext,
+    bool * const is_in_place,
+    const int * const involved
+);
+
+extern void contour3d_contour_find_layout (
+    const contour3d_contour_obj_t * const contour_obj,
+    double * const array,
+    const size_t mysizes[CONTOUR3D_NDIMS],
+    size_t strides[CONTOUR3D_NDIMS],
+    double ** const interior
+);
+
+extern int contour3d_contour_init_clip (
+    const sdecomp_info_t * const sdecomp_info,
+    const contour3d_contour_obj_t * const contour_obj,
+    clip_t * const clip
+);
+
+extern bool contour3d_contour_narrow (
+    const clip_t * const clip,
+    const size_t strides_ext[CONTOUR3D_NDIMS],
+    size_t mysizes_ext[CONTOUR3D_NDIMS],
+    size_t offsets_ext[CONTOUR3D_NDIMS],
+    size_t * const shift
+);
+
+extern int contour3d_contour_process_slice (
+    const sdecomp_info_t * const sdecomp_info,
+    const camera_t * const camera,
+    const contour3d_vector_t * const light,
+    const screen_t * const screen,
+    const contour3d_contour_obj_t * const contour_obj,
+    const uint16_t id,
+    primitives_t * const primitives,
+    canvas_t * const canvas
+);
+
+extern int contour3d_contour_init_mapping (
+    const contour3d_contour_obj_t * const contour_obj,
+    const size_t offsets[2],
+    mapping_t * const mapping
+);
+
+extern int contour3d_contour_convert_points (
+    const mapping_t * const mapping,
+    const size_t npoints,
+    contour3d_vector_t * const points
 );
 
 extern int contour3d_contour_triangulate_slice (
     const size_t glsizes[2],
+    const size_t strides[3],
     double * const grids[3],
-    contour3d_vector_t (* const coordinate_converter) (
-      const contour3d_vector_t orthogonal
-    ),
+    const mapping_t * const mapping,
     const double * const array,
+    const double * const color_array,
     const double threshold,
     lattice_t * const lattices
 );
@@ -42,9 +126,17 @@ extern int contour3d_contour_render_triangle (
     const camera_t * const camera,
     const contour3d_vector_t * const light,
     const screen_t * const screen,
-    const contour3d_color_t * const fg_color,
-    const triangle_t * const triangle,
-    pixel_t * const canvas
+    const primitive_t * const triangle,
+    canvas_t * const canvas
+);
+
+extern int contour3d_contour_render_primitives (
+    const camera_t * const camera,
+    const contour3d_vector_t * const light,
+    const screen_t * const screen,
+    const size_t nlists,
+    const primitives_t * const lists[],
+    canvas_t * const canvas
 );
 
 #endif // CONTOUR3D_CONTOUR_INTERNAL_H
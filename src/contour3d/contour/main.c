@@ -1,12 +1,781 @@
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
 #include "sdecomp.h"
 #include "contour3d.h"
 #include "../struct.h"
+#include "../primitive.h"
 #include "../memory.h"
 #include "../logger.h"
+#include "../config.h"
+#include "../pool.h"
+#include "../profile.h"
+#include "../colormap.h"
 #include "./internal.h"
 
 // three slices are used to compute vertex normals in the middle slice
 #define N_SLICES 3
+// slices shared by the stages of the pipeline,
+//   the ones beyond three let the triangulation go ahead of the others
+#define N_RING 5
+// triangulation, vertex normals, and emission (storing or rendering)
+#define N_STAGES 3
+
+// extended array of a contour object, which is shared by the threads
+typedef struct {
+  const contour3d_contour_obj_t * contour_obj;
+  uint16_t id;
+  size_t mysizes_ext[CONTOUR3D_NDIMS];
+  size_t offsets_ext[CONTOUR3D_NDIMS];
+  // distances between the neighbouring values of the extended array,
+  //   which may be a view of the given array
+  size_t strides_ext[CONTOUR3D_NDIMS];
+  const double * array_ext;
+  // second field to color the surface, extended in the same way, or NULL
+  const double * color_ext;
+  // how the lattice corners are converted, decided once per object
+  mapping_t mapping;
+} extended_t;
+
+// work shared by the threads, each of which handles a z slab
+//   and keeps its triangles in its own list,
+//   except for the calling thread which handles the first slab as a single thread does
+typedef struct {
+  const extended_t * extended;
+  // lattice layers [kmin : kmax) whose triangles are emitted
+  size_t kmin;
+  size_t kmax;
+  const camera_t * camera;
+  const contour3d_vector_t * light;
+  const screen_t * screen;
+  canvas_t * canvas;
+  primitives_t * const * lists;
+  // lattices and triangles emitted by each thread
+  size_t * num_cells;
+  size_t * num_emitted;
+} job_t;
+
+static void free_slices (
+    lattice_t * slices[N_SLICES]
+) {
+  // in the reverse order of the allocations,
+  //   so that the memory can be reused by the next object
+  for (/* each slice */ size_t n = 0; n < N_SLICES; n++) {
+    contour3d_memory_free(slices[N_SLICES - n - 1]);
+  }
+}
+
+static int allocate_slices (
+    const size_t slice_sizes[2],
+    lattice_t * slices[N_SLICES]
+) {
+  const contour3d_memory_subsystem_t subsystem = contour3d_memory_set_subsystem(CONTOUR3D_MEMORY_SLICES);
+  for (/* each slice */ size_t n = 0; n < N_SLICES; n++) {
+    slices[n] = contour3d_memory_alloc(slice_sizes[0] * slice_sizes[1], sizeof(lattice_t));
+  }
+  contour3d_memory_set_subsystem(subsystem);
+  for (/* each slice */ size_t n = 0; n < N_SLICES; n++) {
+    if (NULL == slices[n]) {
+      logger_error("failed to allocate slice %zu", n);
+      free_slices(slices);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// extract triangles from the lattice layer at k
+static int triangulate_layer (
+    const extended_t * const extended,
+    const size_t k,
+    lattice_t * const lattices
+) {
+  const contour3d_contour_obj_t * const contour_obj = extended->contour_obj;
+  const size_t * const mysizes_ext = extended->mysizes_ext;
+  const size_t * const offsets_ext = extended->offsets_ext;
+  CONTOUR3D_PROFILE_START(CONTOUR3D_PHASE_TRIANGULATE);
+  if (0 != contour3d_contour_triangulate_slice(
+        (size_t [2]) {
+          mysizes_ext[0],
+          mysizes_ext[1],
+        },
+        extended->strides_ext,
+        (double * const [N_SLICES]) {
+          contour_obj->grids[0] + offsets_ext[0],
+          contour_obj->grids[1] + offsets_ext[1],
+          contour_obj->grids[2] + offsets_ext[2] + k,
+        },
+        &extended->mapping,
+        extended->array_ext + k * extended->strides_ext[2],
+        NULL == extended->color_ext ? NULL : extended->color_ext + k * extended->strides_ext[2],
+        contour_obj->threshold,
+        lattices
+  )) {
+    logger_error("failed to triangulate a slice at k = %zu", k);
+    return 1;
+  }
+  CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_TRIANGULATE);
+  return 0;
+}
+
+// compute the vertex normals of the triangles in the middle slice at k
+//   by using three slices
+static int compute_normals (
+    const extended_t * const extended,
+    const size_t k,
+    lattice_t * const slices[N_SLICES]
+) {
+  CONTOUR3D_PROFILE_START(CONTOUR3D_PHASE_NORMALS);
+  if (0 != contour3d_contour_compute_vertex_normals(
+        (size_t [2]) {
+          extended->mysizes_ext[0],
+          extended->mysizes_ext[1],
+        },
+        slices
+  )) {
+    logger_error("failed to find vertex normals at k = %zu", k);
+    return 1;
+  }
+  CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_NORMALS);
+  return 0;
+}
+
+// hand the triangles of the lattice layer at k, whose vertex normals are known,
+//   over to "primitives" when given, or render them immediately otherwise
+static int emit_layer (
+    const extended_t * const extended,
+    const size_t k,
+    const lattice_t * const lattices,
+    const camera_t * const camera,
+    const contour3d_vector_t * const light,
+    const screen_t * const screen,
+    primitives_t * const primitives,
+    canvas_t * const canvas,
+    size_t * const num_emitted
+) {
+  const contour3d_contour_obj_t * const contour_obj = extended->contour_obj;
+  const size_t slice_sizes[] = {extended->mysizes_ext[0] - 1, extended->mysizes_ext[1] - 1};
+  // storing deferred triangles is not regarded as rasterisation
+  if (NULL == primitives) {
+    CONTOUR3D_PROFILE_START(CONTOUR3D_PHASE_RASTERISE);
+  }
+  // NOTE: edge lattices (i, j = 0, mysize_ext - 1) are clipped
+  //   since neighbouring lattices are necessary to average
+  for (/* each y */ size_t j = 1; j < slice_sizes[1] - 1; j++) {
+    for (/* each x */ size_t i = 1; i < slice_sizes[0] - 1; i++) {
+      const lattice_t * const lattice = lattices + j * slice_sizes[0] + i;
+      const size_t num_triangles = lattice->num_triangles;
+      const triangle_t * const triangles = lattice->triangles;
+      *num_emitted += num_triangles;
+      for (/* each triangle */ size_t index_triangle = 0; index_triangle < num_triangles; index_triangle++) {
+        const triangle_t * const triangle = triangles + index_triangle;
+        primitive_t primitive = {
+          .vertices = {
+            triangle->vertices[0],
+            triangle->vertices[1],
+            triangle->vertices[2],
+          },
+          .vertex_normals = {
+            triangle->vertex_normals[0],
+            triangle->vertex_normals[1],
+            triangle->vertex_normals[2],
+          },
+          .color = contour_obj->color,
+          .id = extended->id,
+          .colormap = NULL == extended->color_ext ? CONTOUR3D_COLORMAP_NONE : contour_obj->colormap,
+        };
+        if (NULL != extended->color_ext) {
+          for (size_t n = 0; n < 3; n++) {
+            primitive.levels[n] = contour3d_colormap_get_level(contour_obj->color_range, triangle->values[n]);
+          }
+        }
+        // keep the triangle when the rasterisation is deferred,
+        //   otherwise render it immediately
+        if (NULL != primitives) {
+          if (0 != contour3d_primitive_push(primitives, &primitive)) {
+            logger_error("failed to store triangle at k = %zu", k);
+            return 1;
+          }
+          continue;
+        }
+        if (0 != contour3d_contour_render_triangle(
+              camera,
+              light,
+              screen,
+              &primitive,
+              canvas
+        )) {
+          logger_error("failed to render triangle at k = %zu", k);
+          return 1;
+        }
+      }
+    }
+  }
+  if (NULL == primitives) {
+    CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_RASTERISE);
+  }
+  return 0;
+}
+
+// extract the triangles of the lattice layers [kmin : kmax),
+//   which are kept when "primitives" is given or rendered immediately otherwise
+// NOTE: one more layer on both sides is triangulated
+//   to compute the vertex normals
+static int extract_slab (
+    const extended_t * const extended,
+    const size_t kmin,
+    const size_t kmax,
+    lattice_t * const slices[N_SLICES],
+    const camera_t * const camera,
+    const contour3d_vector_t * const light,
+    const screen_t * const screen,
+    primitives_t * const primitives,
+    canvas_t * const canvas,
+    size_t * const num_cells,
+    size_t * const num_emitted
+) {
+  const size_t slice_sizes[] = {extended->mysizes_ext[0] - 1, extended->mysizes_ext[1] - 1};
+  *num_cells = 0;
+  *num_emitted = 0;
+  for (/* each z */ size_t k = kmin - 1; k < kmax + 1; k++) {
+    // extract triangles from a slice at k
+    if (0 != triangulate_layer(extended, k, slices[k % N_SLICES])) {
+      return 1;
+    }
+    // render only when three slices are available
+    if (k < kmin + 1) {
+      continue;
+    }
+    // render info at k - 1
+    if (0 != compute_normals(extended, k - 1, (lattice_t * [N_SLICES]) {
+          slices[(k - 2) % N_SLICES],
+          slices[(k - 1) % N_SLICES],
+          slices[(k    ) % N_SLICES],
+    })) {
+      return 1;
+    }
+    if (0 != emit_layer(
+          extended,
+          k - 1,
+          slices[(k - 1) % N_SLICES],
+          camera,
+          light,
+          screen,
+          primitives,
+          canvas,
+          num_emitted
+    )) {
+      return 1;
+    }
+    // only the emitted layers are counted,
+    //   while the ones on both sides are also triangulated by the neighbouring slabs
+    *num_cells += slice_sizes[0] * slice_sizes[1];
+  }
+  return 0;
+}
+
+// extract the triangles of the slab assigned to this thread
+static int extract_task (
+    const size_t rank,
+    const size_t nthreads,
+    void * const data
+) {
+  const job_t * const job = data;
+  const extended_t * const extended = job->extended;
+  // contiguous layers, so that the triangles of the threads
+  //   follow each other in the same order as a single thread
+  const size_t nlayers = job->kmax - job->kmin;
+  const size_t kmin = job->kmin + nlayers * (rank    ) / nthreads;
+  const size_t kmax = job->kmin + nlayers * (rank + 1) / nthreads;
+  const size_t slice_sizes[] = {extended->mysizes_ext[0] - 1, extended->mysizes_ext[1] - 1};
+  lattice_t * slices[N_SLICES] = {NULL};
+  if (0 != allocate_slices(slice_sizes, slices)) {
+    return 1;
+  }
+  // only the calling thread may render immediately,
+  //   since the others do not touch the canvas in the meantime
+  const int retval = extract_slab(
+      extended,
+      kmin,
+      kmax,
+      slices,
+      job->camera,
+      job->light,
+      job->screen,
+      job->lists[rank],
+      job->canvas,
+      job->num_cells + rank,
+      job->num_emitted + rank
+  );
+  free_slices(slices);
+  return retval;
+}
+
+// the other threads give back their triangles once they have been consumed,
+//   so that they are not counted against the memory budget any longer
+static int release_task (
+    const size_t rank,
+    const size_t nthreads,
+    void * const data
+) {
+  (void)nthreads;
+  (void)data;
+  if (0 != rank) {
+    contour3d_memory_free_all();
+  }
+  return 0;
+}
+
+// extract the triangles with several threads,
+//   whose lists are appended (deferred) or rasterised together afterwards
+static int extract_threaded (
+    const extended_t * const extended,
+    const size_t kmin,
+    const size_t kmax,
+    const size_t nthreads,
+    const camera_t * const camera,
+    const contour3d_vector_t * const light,
+    const screen_t * const screen,
+    primitives_t * const primitives,
+    canvas_t * const canvas
+) {
+  primitives_t * const locals = contour3d_memory_alloc(nthreads, sizeof(primitives_t));
+  primitives_t ** const lists = contour3d_memory_alloc(nthreads, sizeof(primitives_t *));
+  size_t * const counts = contour3d_memory_alloc(2 * nthreads, sizeof(size_t));
+  if (NULL == locals || NULL == lists || NULL == counts) {
+    logger_error("failed to allocate per-thread lists");
+    return 1;
+  }
+  for (/* each thread */ size_t n = 0; n < nthreads; n++) {
+    locals[n] = (primitives_t){0};
+    lists[n] = locals + n;
+  }
+  // the first slab goes to the stored triangles or to the canvas directly
+  lists[0] = primitives;
+  job_t job = {
+    .extended = extended,
+    .kmin = kmin,
+    .kmax = kmax,
+    .camera = camera,
+    .light = light,
+    .screen = screen,
+    .canvas = canvas,
+    .lists = lists,
+    .num_cells = counts,
+    .num_emitted = counts + nthreads,
+  };
+  if (0 != contour3d_pool_run(nthreads, extract_task, &job)) {
+    logger_error("failed to extract triangles with %zu threads", nthreads);
+    contour3d_pool_run(nthreads, release_task, NULL);
+    return 1;
+  }
+  for (/* each thread */ size_t n = 0; n < nthreads; n++) {
+    CONTOUR3D_PROFILE_COUNT(CONTOUR3D_COUNTER_CELLS, job.num_cells[n]);
+    CONTOUR3D_PROFILE_COUNT(CONTOUR3D_COUNTER_TRIANGLES, job.num_emitted[n]);
+  }
+  // the lists of the other threads follow in the order of the slabs,
+  //   which are only read now that the threads have finished
+  int retval = 0;
+  if (NULL != primitives) {
+    size_t nitems = primitives->nitems;
+    for (/* each thread */ size_t n = 1; n < nthreads; n++) {
+      nitems += lists[n]->nitems;
+    }
+    if (0 != contour3d_primitive_reserve(primitives, nitems)) {
+      retval = 1;
+    } else {
+      for (/* each thread */ size_t n = 1; n < nthreads; n++) {
+        memcpy(primitives->items + primitives->nitems, lists[n]->items, lists[n]->nitems * sizeof(primitive_t));
+        primitives->nitems += lists[n]->nitems;
+      }
+    }
+  } else {
+    CONTOUR3D_PROFILE_START(CONTOUR3D_PHASE_RASTERISE);
+    retval = contour3d_contour_render_primitives(
+        camera,
+        light,
+        screen,
+        nthreads - 1,
+        (const primitives_t * const *)lists + 1,
+        canvas
+    );
+    CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_RASTERISE);
+  }
+  if (0 != contour3d_pool_run(nthreads, release_task, NULL)) {
+    retval = 1;
+  }
+  contour3d_memory_free(counts);
+  contour3d_memory_free(lists);
+  contour3d_memory_free(locals);
+  return retval;
+}
+
+// layers flowing through the stages, each of which runs on its own thread,
+//   where the progress is counted in lattice layers from kmin - 1
+typedef struct {
+  const extended_t * extended;
+  // lattice layers [kmin : kmax) whose triangles are emitted
+  size_t kmin;
+  size_t kmax;
+  // the layer at kmin - 1 + n is kept in ring[n % N_RING]
+  lattice_t * const * ring;
+  const camera_t * camera;
+  const contour3d_vector_t * light;
+  const screen_t * screen;
+  primitives_t * primitives;
+  canvas_t * canvas;
+  pthread_mutex_t mutex;
+  // broadcast whenever a stage makes progress or fails
+  pthread_cond_t cond;
+  // layers triangulated, and middle layers whose normals are found / emitted
+  size_t ntriangulated;
+  size_t nnormals;
+  size_t nemitted;
+  bool has_failed;
+  size_t num_cells;
+  size_t num_emitted;
+} pipeline_t;
+
+// block until the counter reaches "target",
+//   returning false if another stage has failed
+static bool wait_for (
+    pipeline_t * const pipeline,
+    const size_t * const counter,
+    const size_t target
+) {
+  pthread_mutex_lock(&pipeline->mutex);
+  while (*counter < target && !pipeline->has_failed) {
+    pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+  }
+  const bool retval = !pipeline->has_failed;
+  pthread_mutex_unlock(&pipeline->mutex);
+  return retval;
+}
+
+// report the result of a stage for one layer
+static int advance (
+    pipeline_t * const pipeline,
+    size_t * const counter,
+    const int result
+) {
+  pthread_mutex_lock(&pipeline->mutex);
+  if (0 != result) {
+    pipeline->has_failed = true;
+  } else {
+    *counter += 1;
+  }
+  pthread_cond_broadcast(&pipeline->cond);
+  pthread_mutex_unlock(&pipeline->mutex);
+  return result;
+}
+
+static int run_triangulation (
+    pipeline_t * const pipeline
+) {
+  const extended_t * const extended = pipeline->extended;
+  const size_t nlayers = pipeline->kmax - pipeline->kmin + 2;
+  for (/* each layer */ size_t n = 0; n < nlayers; n++) {
+    // the slice is overwritten once its last readers,
+    //   the normals of the layer above and the emission of itself, are done
+    if (N_RING <= n) {
+      if (!wait_for(pipeline, &pipeline->nnormals, n - N_RING + 1)) {
+        return 1;
+      }
+      if (!wait_for(pipeline, &pipeline->nemitted, n - N_RING)) {
+        return 1;
+      }
+    }
+    const size_t k = pipeline->kmin - 1 + n;
+    if (0 != advance(pipeline, &pipeline->ntriangulated, triangulate_layer(extended, k, pipeline->ring[n % N_RING]))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// vertex normals and / or emission of the middle layers
+static int run_middle_stages (
+    pipeline_t * const pipeline,
+    const bool has_normals,
+    const bool has_emission
+) {
+  const extended_t * const extended = pipeline->extended;
+  lattice_t * const * const ring = pipeline->ring;
+  const size_t nlayers = pipeline->kmax - pipeline->kmin;
+  for (/* each middle layer */ size_t n = 0; n < nlayers; n++) {
+    const size_t k = pipeline->kmin + n;
+    if (has_normals) {
+      if (!wait_for(pipeline, &pipeline->ntriangulated, n + 3)) {
+        return 1;
+      }
+      if (0 != advance(pipeline, &pipeline->nnormals, compute_normals(extended, k, (lattice_t * [N_SLICES]) {
+              ring[(n    ) % N_RING],
+              ring[(n + 1) % N_RING],
+              ring[(n + 2) % N_RING],
+      }))) {
+        return 1;
+      }
+    }
+    if (has_emission) {
+      if (!wait_for(pipeline, &pipeline->nnormals, n + 1)) {
+        return 1;
+      }
+      if (0 != advance(pipeline, &pipeline->nemitted, emit_layer(
+              extended,
+              k,
+              ring[(n + 1) % N_RING],
+              pipeline->camera,
+              pipeline->light,
+              pipeline->screen,
+              pipeline->primitives,
+              pipeline->canvas,
+              &pipeline->num_emitted
+      ))) {
+        return 1;
+      }
+      // only the emitted layers are counted, as the slabs do
+      pipeline->num_cells += (extended->mysizes_ext[0] - 1) * (extended->mysizes_ext[1] - 1);
+    }
+  }
+  return 0;
+}
+
+// the calling thread emits the triangles, so that the canvas and the stored triangles
+//   are only touched by it and in the same order as a single thread
+static int pipeline_task (
+    const size_t rank,
+    const size_t nthreads,
+    void * const data
+) {
+  pipeline_t * const pipeline = data;
+  if (1 == rank) {
+    return run_triangulation(pipeline);
+  }
+  if (2 == rank) {
+    return run_middle_stages(pipeline, true, false);
+  }
+  // with two threads, the vertex normals are also found by the calling thread
+  return run_middle_stages(pipeline, nthreads < N_STAGES, true);
+}
+
+// extract the triangles by pipelining the stages on two or three threads
+static int extract_pipelined (
+    const extended_t * const extended,
+    const size_t kmin,
+    const size_t kmax,
+    const size_t nthreads,
+    const camera_t * const camera,
+    const contour3d_vector_t * const light,
+    const screen_t * const screen,
+    primitives_t * const primitives,
+    canvas_t * const canvas
+) {
+  const size_t slice_sizes[] = {extended->mysizes_ext[0] - 1, extended->mysizes_ext[1] - 1};
+  lattice_t * ring[N_RING] = {NULL};
+  const contour3d_memory_subsystem_t subsystem = contour3d_memory_set_subsystem(CONTOUR3D_MEMORY_SLICES);
+  for (/* each slice */ size_t n = 0; n < N_RING; n++) {
+    ring[n] = contour3d_memory_alloc(slice_sizes[0] * slice_sizes[1], sizeof(lattice_t));
+  }
+  contour3d_memory_set_subsystem(subsystem);
+  int retval = 0;
+  for (/* each slice */ size_t n = 0; n < N_RING; n++) {
+    if (NULL == ring[n]) {
+      logger_error("failed to allocate slice %zu", n);
+      retval = 1;
+    }
+  }
+  pipeline_t pipeline = {
+    .extended = extended,
+    .kmin = kmin,
+    .kmax = kmax,
+    .ring = ring,
+    .camera = camera,
+    .light = light,
+    .screen = screen,
+    .primitives = primitives,
+    .canvas = canvas,
+    .ntriangulated = 0,
+    .nnormals = 0,
+    .nemitted = 0,
+    .has_failed = false,
+    .num_cells = 0,
+    .num_emitted = 0,
+  };
+  pthread_mutex_init(&pipeline.mutex, NULL);
+  pthread_cond_init(&pipeline.cond, NULL);
+  if (0 == retval && 0 != contour3d_pool_run(nthreads, pipeline_task, &pipeline)) {
+    logger_error("failed to extract triangles with %zu stages", nthreads);
+    retval = 1;
+  }
+  pthread_cond_destroy(&pipeline.cond);
+  pthread_mutex_destroy(&pipeline.mutex);
+  if (0 == retval) {
+    CONTOUR3D_PROFILE_COUNT(CONTOUR3D_COUNTER_CELLS, pipeline.num_cells);
+    CONTOUR3D_PROFILE_COUNT(CONTOUR3D_COUNTER_TRIANGLES, pipeline.num_emitted);
+  }
+  for (/* each slice */ size_t n = 0; n < N_RING; n++) {
+    contour3d_memory_free(ring[N_RING - n - 1]);
+  }
+  return retval;
+}
+
+// extract the triangles of the extended array,
+//   choosing the pipeline, the slabs, or a single thread
+static int extract (
+    const extended_t * const extended,
+    const camera_t * const camera,
+    const contour3d_vector_t * const light,
+    const screen_t * const screen,
+    primitives_t * const primitives,
+    canvas_t * const canvas
+) {
+  // NOTE: vertices of a lattice coincide with the surrounding scalars,
+  //         yielding smaller size by 1
+  const size_t slice_sizes[] = {extended->mysizes_ext[0] - 1, extended->mysizes_ext[1] - 1};
+  // the first and the last layers are only used to find the vertex normals
+  const size_t kmin = 1;
+  const size_t kmax = extended->mysizes_ext[2] - 2;
+  size_t nthreads = contour3d_pool_get_nthreads();
+  // the ring holds more slices than a single thread needs,
+  //   and thus the slabs are used instead unless it fits the budget
+  const size_t ring_size = N_RING * contour3d_memory_get_footprint(slice_sizes[0] * slice_sizes[1], sizeof(lattice_t));
+  const bool is_pipelined = contour3d_config_get()->pipelined_extraction
+    && 1 < nthreads
+    && kmin < kmax
+    && ring_size <= contour3d_memory_get_available();
+  if (is_pipelined) {
+    return extract_pipelined(
+        extended,
+        kmin,
+        kmax,
+        nthreads < N_STAGES ? nthreads : N_STAGES,
+        camera,
+        light,
+        screen,
+        primitives,
+        canvas
+    );
+  }
+  // each thread needs at least one layer
+  if (kmax < kmin + nthreads) {
+    nthreads = kmin < kmax ? kmax - kmin : 1;
+  }
+  if (1 < nthreads) {
+    return extract_threaded(extended, kmin, kmax, nthreads, camera, light, screen, primitives, canvas);
+  }
+  // prepare working place to store three slices
+  lattice_t * slices[N_SLICES] = {NULL};
+  if (0 != allocate_slices(slice_sizes, slices)) {
+    return 1;
+  }
+  size_t num_cells = 0;
+  size_t num_emitted = 0;
+  const int retval = extract_slab(
+      extended,
+      kmin,
+      kmax,
+      slices,
+      camera,
+      light,
+      screen,
+      primitives,
+      canvas,
+      &num_cells,
+      &num_emitted
+  );
+  if (0 == retval) {
+    CONTOUR3D_PROFILE_COUNT(CONTOUR3D_COUNTER_CELLS, num_cells);
+    CONTOUR3D_PROFILE_COUNT(CONTOUR3D_COUNTER_TRIANGLES, num_emitted);
+  }
+  free_slices(slices);
+  return retval;
+}
+
+// number of lattices in y extracted at once,
+//   so that the slices of all threads fit in a half of the memory left
+//   (the rest is for the triangles)
+static size_t get_strip_width (
+    const extended_t * const extended
+) {
+  const size_t nlattices = extended->mysizes_ext[1] - 3;
+  if (0 == contour3d_config_get()->memory_budget) {
+    return nlattices;
+  }
+  // one more lattice on each side is triangulated to find the vertex normals
+  const size_t row_bytes = contour3d_pool_get_nthreads() * N_SLICES * (extended->mysizes_ext[0] - 1) * sizeof(lattice_t);
+  const size_t nrows = contour3d_memory_get_available() / 2 / row_bytes;
+  const size_t width = nrows < 3 ? 1 : nrows - 2;
+  return nlattices < width ? nlattices : width;
+}
+
+// extract the triangles in strips of lattices in y
+//   when the slices of the whole extended array do not fit in the memory budget,
+//   each of which is a view of the extended array
+//   with one more lattice on each side, in the same manner as a clip box
+static int extract_strips (
+    const extended_t * const extended,
+    const camera_t * const camera,
+    const contour3d_vector_t * const light,
+    const screen_t * const screen,
+    primitives_t * const primitives,
+    canvas_t * const canvas
+) {
+  // lattices [1 : nlattices + 1) are emitted
+  const size_t nlattices = extended->mysizes_ext[1] - 3;
+  const size_t width = get_strip_width(extended);
+  if (nlattices <= width) {
+    return extract(extended, camera, light, screen, primitives, canvas);
+  }
+  for (/* each strip */ size_t begin = 1; begin < nlattices + 1; begin += width) {
+    const size_t end = nlattices + 1 < begin + width ? nlattices + 1 : begin + width;
+    const size_t shift = (begin - 1) * extended->strides_ext[1];
+    extended_t strip = *extended;
+    strip.mysizes_ext[1] = end - begin + 3;
+    strip.offsets_ext[1] += begin - 1;
+    strip.array_ext += shift;
+    strip.color_ext = NULL == extended->color_ext ? NULL : extended->color_ext + shift;
+    strip.mapping.offsets[1] += begin - 1;
+    if (0 != extract(&strip, camera, light, screen, primitives, canvas)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// when the stored triangles outgrow the memory budget under sort-last,
+//   whose full-screen canvas is prepared beforehand,
+//   they are rasterised onto it without being balanced to make room,
+//   discarding the triangles of the current object from "nstored" on,
+//   which is then extracted again and rendered immediately
+// nothing is done otherwise, and the failure is reported
+static int spill_primitives (
+    const camera_t * const camera,
+    const contour3d_vector_t * const light,
+    const screen_t * const screen,
+    const size_t nstored,
+    primitives_t * const primitives,
+    canvas_t * const canvas
+) {
+  if (NULL == primitives || NULL == canvas->colors || canvas->is_partitioned) {
+    return 1;
+  }
+  primitives->nitems = nstored;
+  CONTOUR3D_PROFILE_START(CONTOUR3D_PHASE_RASTERISE);
+  if (0 != contour3d_contour_render_primitives(
+        camera,
+        light,
+        screen,
+        1,
+        (const primitives_t * const []) {primitives},
+        canvas
+  )) {
+    return 1;
+  }
+  CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_RASTERISE);
+  contour3d_primitive_finalise(primitives);
+  logger_info("stored triangles are rasterised to stay within the memory budget");
+  return 0;
+}
 
 int contour3d_process_contour_obj (
     const sdecomp_info_t * const sdecomp_info,
@@ -14,107 +783,125 @@ int contour3d_process_contour_obj (
     const contour3d_vector_t * const light,
     const screen_t * const screen,
     const contour3d_contour_obj_t * const contour_obj,
-    pixel_t * const canvas
+    const uint16_t id,
+    primitives_t * const primitives,
+    canvas_t * const canvas
 ) {
+  const size_t nstored = NULL == primitives ? 0 : primitives->nitems;
+  if (CONTOUR3D_CONTOUR_SLICE == contour_obj->kind) {
+    if (0 == contour3d_contour_process_slice(sdecomp_info, camera, light, screen, contour_obj, id, primitives, canvas)) {
+      return 0;
+    }
+    if (0 != spill_primitives(camera, light, screen, nstored, primitives, canvas)) {
+      return 1;
+    }
+    return contour3d_contour_process_slice(sdecomp_info, camera, light, screen, contour_obj, id, NULL, canvas);
+  }
+  // lattices overlapping the clip box and the processes holding them,
+  //   where the others only join this collective call
+  clip_t clip = {
+    .is_involved = 1,
+    .involved = NULL,
+  };
+  if (contour_obj->has_clip_box) {
+    if (0 != contour3d_contour_init_clip(sdecomp_info, contour_obj, &clip)) {
+      logger_error("failed to clip the domain");
+      return 1;
+    }
+    if (!clip.is_involved) {
+      contour3d_memory_free(clip.involved);
+      return 0;
+    }
+  }
   // create an extended array for edge treatment
   //   and obtain its local size
-  size_t mysizes_ext[CONTOUR3D_NDIMS] = {0};
-  size_t offsets_ext[CONTOUR3D_NDIMS] = {0};
+  extended_t extended = {
+    .contour_obj = contour_obj,
+    .id = id,
+  };
   double * array_ext = NULL;
+  bool is_in_place = false;
+  const contour3d_memory_subsystem_t subsystem = contour3d_memory_set_subsystem(CONTOUR3D_MEMORY_EXTENDED_ARRAY);
+  CONTOUR3D_PROFILE_START(CONTOUR3D_PHASE_EXTEND);
   if (0 != contour3d_contour_extend_domain(
         sdecomp_info,
         contour_obj,
-        mysizes_ext,
-        offsets_ext,
-        &array_ext
+        extended.mysizes_ext,
+        extended.offsets_ext,
+        extended.strides_ext,
+        &array_ext,
+        &is_in_place,
+        clip.involved
   )) {
     logger_error("failed to extend domain");
     return 1;
   }
-  // prepare working place to store three slices
-  // NOTE: vertices of a lattice coincide with the surrounding scalars,
-  //         yielding smaller size by 1
-  const size_t slice_sizes[] = {mysizes_ext[0] - 1, mysizes_ext[1] - 1};
-  lattice_t * slices[N_SLICES] = {
-    contour3d_memory_alloc(slice_sizes[0] * slice_sizes[1], sizeof(lattice_t)),
-    contour3d_memory_alloc(slice_sizes[0] * slice_sizes[1], sizeof(lattice_t)),
-    contour3d_memory_alloc(slice_sizes[0] * slice_sizes[1], sizeof(lattice_t)),
-  };
-  for (/* each slice */ size_t n = 0; n < N_SLICES; n++) {
-    if (NULL == slices[n]) {
-      logger_error("failed to allocate slice %zu", n);
+  // the second field, whose layout is identical to the first one
+  double * color_ext = NULL;
+  if (CONTOUR3D_COLORMAP_NONE != contour_obj->colormap) {
+    if (NULL == contour_obj->color_array) {
+      logger_error("colormap is given without color_array");
       return 1;
     }
-  }
-  for (/* each z */ size_t k = 0; k < mysizes_ext[2] - 1; k++) {
-    // extract triangles from a slice at k
-    if (0 != contour3d_contour_triangulate_slice(
-          (size_t [2]) {
-            mysizes_ext[0],
-            mysizes_ext[1],
-          },
-          (double * const [N_SLICES]) {
-            contour_obj->grids[0] + offsets_ext[0],
-            contour_obj->grids[1] + offsets_ext[1],
-            contour_obj->grids[2] + offsets_ext[2] + k,
-          },
-          contour_obj->converter,
-          array_ext + k * mysizes_ext[0] * mysizes_ext[1],
-          contour_obj->threshold,
-          slices[k % N_SLICES]
+    contour3d_contour_obj_t color_obj = *contour_obj;
+    color_obj.array = contour_obj->color_array;
+    size_t mysizes_color[CONTOUR3D_NDIMS] = {0};
+    size_t offsets_color[CONTOUR3D_NDIMS] = {0};
+    size_t strides_color[CONTOUR3D_NDIMS] = {0};
+    if (0 != contour3d_contour_extend_domain(
+          sdecomp_info,
+          &color_obj,
+          mysizes_color,
+          offsets_color,
+          strides_color,
+          &color_ext,
+          &is_in_place,
+          clip.involved
     )) {
-      logger_error("failed to triangulate a slice at k = %zu", k);
+      logger_error("failed to extend domain of color_array");
       return 1;
     }
-    // render only when three slices are available
-    if (k < 2) {
-      continue;
-    }
-    // render info at k - 1
-    // compute the vertex normals of the triangles in the middle slice
-    //   by using three slices
-    if (0 != contour3d_contour_compute_vertex_normals(
-          (size_t [2]) {
-            mysizes_ext[0],
-            mysizes_ext[1],
-          },
-          (lattice_t * [N_SLICES]) {
-            slices[(k - 2) % N_SLICES],
-            slices[(k - 1) % N_SLICES],
-            slices[(k    ) % N_SLICES],
-          }
+  }
+  CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_EXTEND);
+  contour3d_memory_set_subsystem(subsystem);
+  // what is freed at the end (in the reverse order),
+  //   which is nothing when the given arrays are read in place
+  double * const allocated = is_in_place ? NULL : array_ext;
+  double * const color_allocated = is_in_place ? NULL : color_ext;
+  // only the clipped lattices (and their neighbours) are kept,
+  //   which may leave nothing on this process
+  bool has_lattices = true;
+  if (contour_obj->has_clip_box) {
+    size_t shift = 0;
+    has_lattices = contour3d_contour_narrow(
+        &clip,
+        extended.strides_ext,
+        extended.mysizes_ext,
+        extended.offsets_ext,
+        &shift
+    );
+    array_ext += shift;
+    color_ext = NULL == color_ext ? NULL : color_ext + shift;
+  }
+  extended.array_ext = array_ext;
+  extended.color_ext = color_ext;
+  int retval = 0;
+  if (has_lattices) {
+    if (0 != contour3d_contour_init_mapping(
+          contour_obj,
+          extended.offsets_ext,
+          &extended.mapping
     )) {
-      logger_error("failed to find vertex normals at k = %zu", k - 1);
+      logger_error("failed to find the coordinate mapping");
       return 1;
     }
-    // NOTE: edge lattices (i, j = 0, mysize_ext - 1) are clipped
-    //   since neighbouring lattices are necessary to average
-    for (/* each y */ size_t j = 1; j < slice_sizes[1] - 1; j++) {
-      for (/* each x */ size_t i = 1; i < slice_sizes[0] - 1; i++) {
-        const lattice_t * const lattice = slices[(k - 1) % N_SLICES] + j * slice_sizes[0] + i;
-        const size_t num_triangles = lattice->num_triangles;
-        const triangle_t * const triangles = lattice->triangles;
-        for (/* each triangle */ size_t index_triangle = 0; index_triangle < num_triangles; index_triangle++) {
-          const triangle_t * const triangle = triangles + index_triangle;
-          if (0 != contour3d_contour_render_triangle(
-                camera,
-                light,
-                screen,
-                &contour_obj->color,
-                triangle,
-                canvas
-          )) {
-            logger_error("failed to render triangle at k = %zu", k - 1);
-            return 1;
-          }
-        }
-      }
+    retval = extract_strips(&extended, camera, light, screen, primitives, canvas);
+    if (0 != retval && 0 == spill_primitives(camera, light, screen, nstored, primitives, canvas)) {
+      retval = extract_strips(&extended, camera, light, screen, NULL, canvas);
     }
   }
-  for (/* each slice */ size_t n = 0; n < N_SLICES; n++) {
-    contour3d_memory_free(slices[n]);
-  }
-  contour3d_memory_free(array_ext);
-  return 0;
+  contour3d_memory_free(color_allocated);
+  contour3d_memory_free(allocated);
+  contour3d_memory_free(clip.involved);
+  return retval;
 }
-
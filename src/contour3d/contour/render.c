@@ -1,8 +1,15 @@
+#include <stdbool.h>
 #include <math.h>
 #include "contour3d.h"
 #include "../struct.h"
 #include "../project.h"
 #include "../vector.h"
+#include "../canvas.h"
+#include "../memory.h"
+#include "../logger.h"
+#include "../pool.h"
+#include "../profile.h"
+#include "../colormap.h"
 #include "./internal.h"
 
 static inline double dblmin3 (
@@ -49,16 +56,15 @@ int contour3d_contour_render_triangle (
     const camera_t * const camera,
     const contour3d_vector_t * const light,
     const screen_t * const screen,
-    const contour3d_color_t * const fg_color,
-    const triangle_t * const triangle,
-    pixel_t * const canvas
+    const primitive_t * const triangle,
+    canvas_t * const canvas
 ) {
   const size_t width  = screen->width;
   const size_t height = screen->height;
   // consider a triangle projected onto the screen
   // if at least one vertex returns non-zero value,
   //   I assume this triangle is out-of-range
-  triangle_t projected = {0};
+  primitive_t projected = {0};
   for (size_t dim = 0; dim < 3; dim++) {
     if (0 != contour3d_project(
           camera,
@@ -83,10 +89,24 @@ int contour3d_contour_render_triangle (
   const int_fast32_t ymin = (0.5 + dblmin3(v0->y, v1->y, v2->y)) * height - 1;
   const int_fast32_t ymax = (0.5 + dblmax3(v0->y, v1->y, v2->y)) * height + 1;
   // avoid out-of-bounds access
+  // NOTE: the canvas may only cover a part of the screen rows,
+  //   and thus the range is further limited
+  const int_fast32_t jlower = canvas->offset;
+  const int_fast32_t jupper = canvas->offset + canvas->height - 1;
   const size_t imin = intmin( width - 1, intmax(0, xmin));
   const size_t imax = intmin( width - 1, intmax(0, xmax));
-  const size_t jmin = intmin(height - 1, intmax(0, ymin));
-  const size_t jmax = intmin(height - 1, intmax(0, ymax));
+  const size_t jmin = intmax(jlower, intmin(height - 1, intmax(0, ymin)));
+  const size_t jmax = intmin(jupper, intmin(height - 1, intmax(0, ymax)));
+  if (jmax < jmin) {
+    return 0;
+  }
+  // colors looked up by the levels interpolated on each pixel, or NULL
+  const contour3d_color_t * const table = CONTOUR3D_COLORMAP_NONE == triangle->colormap
+    ? NULL
+    : contour3d_colormap_get_table(triangle->colormap);
+  // flag to tell whether at least one pixel is updated by this triangle
+  bool is_touched = false;
+  size_t num_written = 0;
   // perform in-out check for each pixel inside the bounding box
   for (size_t j = jmin; j <= jmax; j++) {
     for (size_t i = imin; i <= imax; i++) {
@@ -114,8 +134,8 @@ int contour3d_contour_render_triangle (
         continue;
       }
       // we know this pixel is inside the triangle now
-      pixel_t * const pixel = canvas + j * width + i;
-      double * const dist1 = &pixel->depth;
+      const size_t index = (j - canvas->offset) * width + i;
+      double * const dist1 = canvas->depths + index;
       // compute depth by using harmonic average in the barycentric coordinate
       const double dist0 = 1. / (
           + w0 / v0->z
@@ -130,6 +150,8 @@ int contour3d_contour_render_triangle (
       // we found this facet comes the nearest
       // update the nearest distance for later elements
       *dist1 = dist0;
+      is_touched = true;
+      num_written += 1;
       // adjust facet color (make it darker) depending on
       //   the angle between the normal vector and the light
       // first obtain the local face normal
@@ -154,11 +176,139 @@ int contour3d_contour_render_triangle (
           fabs(contour3d_vector_inner_product(face_normal, *light))
       );
       // decide the final colour
-      pixel->color.r = (uint8_t)(factor * fg_color->r);
-      pixel->color.g = (uint8_t)(factor * fg_color->g);
-      pixel->color.b = (uint8_t)(factor * fg_color->b);
+      const contour3d_color_t * fg_color = &triangle->color;
+      if (NULL != table) {
+        const double level = w0 * triangle->levels[0] + w1 * triangle->levels[1] + w2 * triangle->levels[2];
+        fg_color = table + (uint8_t)fmin(CONTOUR3D_COLORMAP_NLEVELS - 1, fmax(0., level + 0.5));
+      }
+      contour3d_color_t * const color = canvas->colors + index;
+      color->r = (uint8_t)(factor * fg_color->r);
+      color->g = (uint8_t)(factor * fg_color->g);
+      color->b = (uint8_t)(factor * fg_color->b);
+      if (NULL != canvas->ids) {
+        canvas->ids[index] = triangle->id;
+      }
+    }
+  }
+  CONTOUR3D_PROFILE_COUNT(CONTOUR3D_COUNTER_PIXELS_TESTED, (imax - imin + 1) * (jmax - jmin + 1));
+  CONTOUR3D_PROFILE_COUNT(CONTOUR3D_COUNTER_PIXELS_WRITTEN, num_written);
+  // record the region which this triangle has modified
+  if (is_touched) {
+    contour3d_canvas_touch(canvas, &(rect_t){
+        .imin = imin,
+        .imax = imax + 1,
+        .jmin = jmin,
+        .jmax = jmax + 1,
+    });
+  }
+  return 0;
+}
+
+
+// triangles shared by the threads, each of which rasterises all of them
+//   onto its own band of canvas rows
+typedef struct {
+  const camera_t * camera;
+  const contour3d_vector_t * light;
+  const screen_t * screen;
+  size_t nlists;
+  const primitives_t * const * lists;
+  canvas_t * canvas;
+  // pixels touched in each band
+  rect_t * actives;
+} job_t;
+
+static int render_band (
+    const size_t rank,
+    const size_t nthreads,
+    void * const data
+) {
+  job_t * const job = data;
+  const canvas_t * const canvas = job->canvas;
+  const size_t width = canvas->width;
+  const size_t jmin = canvas->height * (rank    ) / nthreads;
+  const size_t jmax = canvas->height * (rank + 1) / nthreads;
+  // view of the rows [jmin : jmax) of the canvas
+  canvas_t band = *canvas;
+  band.offset = canvas->offset + jmin;
+  band.height = jmax - jmin;
+  band.depths = canvas->depths + jmin * width;
+  band.ids = NULL == canvas->ids ? NULL : canvas->ids + jmin * width;
+  band.colors = canvas->colors + jmin * width;
+  band.active = (rect_t){0};
+  for (/* each list */ size_t m = 0; m < job->nlists; m++) {
+    const primitives_t * const primitives = job->lists[m];
+    for (/* each triangle */ size_t n = 0; n < primitives->nitems; n++) {
+      if (0 != contour3d_contour_render_triangle(
+            job->camera,
+            job->light,
+            job->screen,
+            primitives->items + n,
+            &band
+      )) {
+        logger_error("failed to render triangle");
+        return 1;
+      }
     }
   }
+  job->actives[rank] = band.active;
   return 0;
 }
 
+// rasterise the triangles of the given lists in this order,
+//   where the rows of the canvas are shared by the threads
+// NOTE: each pixel sees the triangles in the same order
+//   irrespective of the number of threads, and thus so does the result
+int contour3d_contour_render_primitives (
+    const camera_t * const camera,
+    const contour3d_vector_t * const light,
+    const screen_t * const screen,
+    const size_t nlists,
+    const primitives_t * const lists[],
+    canvas_t * const canvas
+) {
+  size_t nthreads = contour3d_pool_get_nthreads();
+  if (canvas->height < nthreads) {
+    nthreads = canvas->height;
+  }
+  if (nthreads <= 1) {
+    for (/* each list */ size_t m = 0; m < nlists; m++) {
+      for (/* each triangle */ size_t n = 0; n < lists[m]->nitems; n++) {
+        if (0 != contour3d_contour_render_triangle(
+              camera,
+              light,
+              screen,
+              lists[m]->items + n,
+              canvas
+        )) {
+          logger_error("failed to render triangle");
+          return 1;
+        }
+      }
+    }
+    return 0;
+  }
+  rect_t * const actives = contour3d_memory_alloc(nthreads, sizeof(rect_t));
+  if (NULL == actives) {
+    logger_error("failed to allocate active regions");
+    return 1;
+  }
+  for (/* each band */ size_t n = 0; n < nthreads; n++) {
+    actives[n] = (rect_t){0};
+  }
+  job_t job = {
+    .camera = camera,
+    .light = light,
+    .screen = screen,
+    .nlists = nlists,
+    .lists = lists,
+    .canvas = canvas,
+    .actives = actives,
+  };
+  const int retval = contour3d_pool_run(nthreads, render_band, &job);
+  for (/* each band */ size_t n = 0; n < nthreads; n++) {
+    contour3d_canvas_touch(canvas, actives + n);
+  }
+  contour3d_memory_free(actives);
+  return retval;
+}
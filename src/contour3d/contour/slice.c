@@ -0,0 +1,270 @@
+#include <stdbool.h>
+#include "sdecomp.h"
+#include "contour3d.h"
+#include "../struct.h"
+#include "../primitive.h"
+#include "../memory.h"
+#include "../logger.h"
+#include "../profile.h"
+#include "../colormap.h"
+#include "./internal.h"
+
+// a slice plane is drawn by the processes holding the plane,
+//   each of which visits one index plane of its own array
+// every node is the center of a cell (two triangles)
+//   bounded by the midpoints to the neighbouring nodes,
+//   whose color is given by the node value,
+//   so that no halo is needed and the cells of the processes meet without gaps
+// NOTE: the cells are not shaded, i.e. their vertex normals are along the light
+
+// cell boundaries around the nodes [offset : offset + nitems),
+//   which are clamped to the domain ends
+static void find_faces (
+    const size_t glsize,
+    const double * const grid,
+    const size_t offset,
+    const size_t nitems,
+    double * const faces
+) {
+  for (/* each face */ size_t n = 0; n < nitems + 1; n++) {
+    const size_t index = offset + n;
+    faces[n] =
+        0 == index      ? grid[0]
+      : glsize == index ? grid[glsize - 1]
+      : 0.5 * (grid[index - 1] + grid[index]);
+  }
+}
+
+// keep the triangle when the rasterisation is deferred,
+//   otherwise render it immediately
+static int emit (
+    const camera_t * const camera,
+    const contour3d_vector_t * const light,
+    const screen_t * const screen,
+    const primitive_t * const primitive,
+    primitives_t * const primitives,
+    canvas_t * const canvas
+) {
+  if (NULL != primitives) {
+    if (0 != contour3d_primitive_push(primitives, primitive)) {
+      logger_error("failed to store triangle of a slice");
+      return 1;
+    }
+    return 0;
+  }
+  if (0 != contour3d_contour_render_triangle(camera, light, screen, primitive, canvas)) {
+    logger_error("failed to render triangle of a slice");
+    return 1;
+  }
+  return 0;
+}
+
+static bool is_in_box (
+    const contour3d_vector_t box[2],
+    const double position[CONTOUR3D_NDIMS]
+) {
+  return
+       box[0].x <= position[0] && position[0] <= box[1].x
+    && box[0].y <= position[1] && position[1] <= box[1].y
+    && box[0].z <= position[2] && position[2] <= box[1].z;
+}
+
+static int draw_cells (
+    const contour3d_contour_obj_t * const contour_obj,
+    const uint16_t id,
+    const size_t dims[CONTOUR3D_NDIMS],
+    const size_t mysizes[CONTOUR3D_NDIMS],
+    const size_t offsets[CONTOUR3D_NDIMS],
+    const size_t strides[CONTOUR3D_NDIMS],
+    const double * const plane,
+    const contour3d_vector_t * const corners,
+    const camera_t * const camera,
+    const contour3d_vector_t * const light,
+    const screen_t * const screen,
+    primitives_t * const primitives,
+    canvas_t * const canvas,
+    size_t * const num_emitted
+) {
+  // normal direction and the in-plane directions
+  const size_t d0 = dims[0];
+  const size_t d1 = dims[1];
+  const size_t d2 = dims[2];
+  const size_t nitems = mysizes[d1] + 1;
+  const bool is_colormapped = CONTOUR3D_COLORMAP_NONE != contour_obj->colormap;
+  *num_emitted = 0;
+  for (/* each in-plane node */ size_t b = 0; b < mysizes[d2]; b++) {
+    for (/* each in-plane node */ size_t a = 0; a < mysizes[d1]; a++) {
+      if (contour_obj->has_clip_box) {
+        double position[CONTOUR3D_NDIMS] = {0.};
+        position[d0] = contour_obj->grids[d0][contour_obj->slice_index];
+        position[d1] = contour_obj->grids[d1][offsets[d1] + a];
+        position[d2] = contour_obj->grids[d2][offsets[d2] + b];
+        if (!is_in_box(contour_obj->clip_box, position)) {
+          continue;
+        }
+      }
+      const uint8_t level = is_colormapped
+        ? contour3d_colormap_get_level(contour_obj->color_range, plane[a * strides[d1] + b * strides[d2]])
+        : 0;
+      const contour3d_vector_t * const c00 = corners + (b    ) * nitems + (a    );
+      const contour3d_vector_t * const c10 = corners + (b    ) * nitems + (a + 1);
+      const contour3d_vector_t * const c01 = corners + (b + 1) * nitems + (a    );
+      const contour3d_vector_t * const c11 = corners + (b + 1) * nitems + (a + 1);
+      const contour3d_vector_t * const triangles[2][3] = {
+        {c00, c10, c11},
+        {c00, c11, c01},
+      };
+      for (/* each triangle */ size_t n = 0; n < 2; n++) {
+        const primitive_t primitive = {
+          .vertices = {
+            *triangles[n][0],
+            *triangles[n][1],
+            *triangles[n][2],
+          },
+          .vertex_normals = {
+            *light,
+            *light,
+            *light,
+          },
+          .color = contour_obj->color,
+          .id = id,
+          .colormap = contour_obj->colormap,
+          .levels = {level, level, level},
+        };
+        if (0 != emit(camera, light, screen, &primitive, primitives, canvas)) {
+          return 1;
+        }
+        *num_emitted += 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// draw the slice plane of a contour object
+//   when this process holds it, otherwise do nothing
+int contour3d_contour_process_slice (
+    const sdecomp_info_t * const sdecomp_info,
+    const camera_t * const camera,
+    const contour3d_vector_t * const light,
+    const screen_t * const screen,
+    const contour3d_contour_obj_t * const contour_obj,
+    const uint16_t id,
+    primitives_t * const primitives,
+    canvas_t * const canvas
+) {
+  const sdecomp_dir_t dir = contour_obj->slice_dir;
+  if (CONTOUR3D_NDIMS <= (size_t)dir || contour_obj->glsizes[dir] <= contour_obj->slice_index) {
+    logger_error("slice plane is out of the domain");
+    return 1;
+  }
+  size_t mysizes[CONTOUR3D_NDIMS] = {0};
+  size_t offsets[CONTOUR3D_NDIMS] = {0};
+  for (sdecomp_dir_t d = 0; d < CONTOUR3D_NDIMS; d++) {
+    if (0 != sdecomp.get_pencil_mysize(sdecomp_info, contour_obj->pencil, d, contour_obj->glsizes[d], mysizes + d)) {
+      logger_error("sdecomp.get_pencil_mysize failed");
+      return 1;
+    }
+    if (0 != sdecomp.get_pencil_offset(sdecomp_info, contour_obj->pencil, d, contour_obj->glsizes[d], offsets + d)) {
+      logger_error("sdecomp.get_pencil_offset failed");
+      return 1;
+    }
+  }
+  // only the processes holding the plane do any work
+  const size_t index = contour_obj->slice_index;
+  if (index < offsets[dir] || offsets[dir] + mysizes[dir] <= index) {
+    return 0;
+  }
+  // normal direction, followed by the in-plane directions
+  const size_t dims[CONTOUR3D_NDIMS] = {
+    dir,
+    SDECOMP_XDIR == dir ? SDECOMP_YDIR : SDECOMP_XDIR,
+    SDECOMP_ZDIR == dir ? SDECOMP_YDIR : SDECOMP_ZDIR,
+  };
+  // colored by the second field if given
+  size_t strides[CONTOUR3D_NDIMS] = {0};
+  double * interior = NULL;
+  contour3d_contour_find_layout(
+      contour_obj,
+      NULL == contour_obj->color_array ? contour_obj->array : contour_obj->color_array,
+      mysizes,
+      strides,
+      &interior
+  );
+  const double * const plane = interior + (index - offsets[dir]) * strides[dir];
+  // same conversion as the isosurfaces
+  mapping_t mapping = {0};
+  if (0 != contour3d_contour_init_mapping(contour_obj, offsets, &mapping)) {
+    return 1;
+  }
+  // cell corners, converted to the Cartesian coordinate at once
+  const size_t nitems[2] = {mysizes[dims[1]] + 1, mysizes[dims[2]] + 1};
+  const contour3d_memory_subsystem_t subsystem = contour3d_memory_set_subsystem(CONTOUR3D_MEMORY_SLICES);
+  double * const faces = contour3d_memory_alloc(nitems[0] + nitems[1], sizeof(double));
+  contour3d_vector_t * const corners = contour3d_memory_alloc(nitems[0] * nitems[1], sizeof(contour3d_vector_t));
+  contour3d_memory_set_subsystem(subsystem);
+  if (NULL == faces || NULL == corners) {
+    logger_error("failed to allocate slice corners");
+    contour3d_memory_free(corners);
+    contour3d_memory_free(faces);
+    return 1;
+  }
+  for (/* each in-plane direction */ size_t n = 0; n < 2; n++) {
+    const size_t d = dims[n + 1];
+    find_faces(
+        contour_obj->glsizes[d],
+        contour_obj->grids[d],
+        offsets[d],
+        mysizes[d],
+        faces + n * nitems[0]
+    );
+  }
+  for (size_t b = 0; b < nitems[1]; b++) {
+    for (size_t a = 0; a < nitems[0]; a++) {
+      double position[CONTOUR3D_NDIMS] = {0.};
+      position[dims[0]] = contour_obj->grids[dims[0]][index];
+      position[dims[1]] = faces[a];
+      position[dims[2]] = faces[nitems[0] + b];
+      corners[b * nitems[0] + a] = (contour3d_vector_t){position[0], position[1], position[2]};
+    }
+  }
+  if (0 != contour3d_contour_convert_points(&mapping, nitems[0] * nitems[1], corners)) {
+    logger_error("failed to convert slice corners");
+    contour3d_memory_free(corners);
+    contour3d_memory_free(faces);
+    return 1;
+  }
+  // storing deferred triangles is not regarded as rasterisation
+  if (NULL == primitives) {
+    CONTOUR3D_PROFILE_START(CONTOUR3D_PHASE_RASTERISE);
+  }
+  size_t num_emitted = 0;
+  if (0 != draw_cells(
+        contour_obj,
+        id,
+        dims,
+        mysizes,
+        offsets,
+        strides,
+        plane,
+        corners,
+        camera,
+        light,
+        screen,
+        primitives,
+        canvas,
+        &num_emitted
+  )) {
+    contour3d_memory_free(corners);
+    contour3d_memory_free(faces);
+    return 1;
+  }
+  if (NULL == primitives) {
+    CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_RASTERISE);
+  }
+  CONTOUR3D_PROFILE_COUNT(CONTOUR3D_COUNTER_CELLS, mysizes[dims[1]] * mysizes[dims[2]]);
+  CONTOUR3D_PROFILE_COUNT(CONTOUR3D_COUNTER_TRIANGLES, num_emitted);
+  contour3d_memory_free(corners);
+  contour3d_memory_free(faces);
+  return 0;
+}
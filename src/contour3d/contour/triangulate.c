@@ -11,6 +11,16 @@
 #define N_TETRAHEDRA 6
 // number of vertices of a tetrahedron
 #define N_VERTICES 4
+// number of triangle vertices handed to the batched converter at once
+#define BATCH_SIZE 1024
+
+// the body of the loop over the lattices should be inlined into the loop,
+//   so that the compile-time arguments are folded into each of its instances
+#if defined(__GNUC__)
+#define INSTANTIATED inline __attribute__((always_inline))
+#else
+#define INSTANTIATED inline
+#endif
 
 // cube_index:
 //   lower floor | upper floor
@@ -34,14 +44,18 @@ static const size_t edge_table[8][8] = {
 typedef struct {
   contour3d_vector_t position;
   double value;
+  // second field to color the surface
+  double color_value;
   size_t cube_index;
 } vertex_t;
 
-static int interpolate (
+static INSTANTIATED int interpolate (
+    const bool has_colors,
     const double vt,
     const vertex_t * restrict const vertex0,
     const vertex_t * restrict const vertex1,
-    contour3d_vector_t * const pt
+    contour3d_vector_t * const pt,
+    double * const color_value
 ) {
   contour3d_vector_t (* const add) (
       const contour3d_vector_t v0,
@@ -64,10 +78,16 @@ static int interpolate (
     // two points are so close
     // just use the original value
     *pt = *p0;
+    if (has_colors) {
+      *color_value = vertex0->color_value;
+    }
   } else {
     // simple linear interpolation
     const double factor = (vt - v0) / (v1 - v0);
     *pt = add(*p0, mul(factor, sub(*p1, *p0)));
+    if (has_colors) {
+      *color_value = vertex0->color_value + factor * (vertex1->color_value - vertex0->color_value);
+    }
   }
   return 0;
 }
@@ -92,9 +112,23 @@ static int compute_face_normal (
   return 0;
 }
 
-static int kernel (
+// map the vertices on the orthogonal coordinate by [A | b]
+static inline void apply_affine (
+    const double affine[CONTOUR3D_NDIMS][CONTOUR3D_NDIMS + 1],
+    contour3d_vector_t * const vertex
+) {
+  const contour3d_vector_t v = *vertex;
+  vertex->x = affine[0][0] * v.x + affine[0][1] * v.y + affine[0][2] * v.z + affine[0][3];
+  vertex->y = affine[1][0] * v.x + affine[1][1] * v.y + affine[1][2] * v.z + affine[1][3];
+  vertex->z = affine[2][0] * v.x + affine[2][1] * v.y + affine[2][2] * v.z + affine[2][3];
+}
+
+static INSTANTIATED int kernel (
+    const bool has_colors,
     const bool reverse,
     const double threshold,
+    const double (* const affine)[CONTOUR3D_NDIMS + 1],
+    const bool is_converted_later,
     const size_t * const tail_indices,
     const size_t * const head_indices,
     const vertex_t vertices[N_VERTICES],
@@ -115,10 +149,12 @@ static int kernel (
     const size_t head = head_indices[order[n]];
     // find intersection
     interpolate(
+        has_colors,
         threshold,
         vertices + tail,
         vertices + head,
-        triangle->vertices + n
+        triangle->vertices + n,
+        triangle->values + n
     );
     // find a cube edge on which this vertex is sitting,
     //   which is used to smoothen the vertex normal in the later stage
@@ -126,16 +162,27 @@ static int kernel (
     const size_t head_id = vertices[head].cube_index;
     triangle->cube_indices[n] = edge_table[tail_id][head_id];
   }
-  compute_face_normal(triangle);
+  // an affine map commutes with the linear interpolation,
+  //   and thus only the intersections are mapped
+  if (NULL != affine) {
+    for (size_t n = 0; n < 3; n++) {
+      apply_affine(affine, triangle->vertices + n);
+    }
+  }
+  // the face normal is found after the vertices are converted
+  if (!is_converted_later) {
+    compute_face_normal(triangle);
+  }
   return 0;
 }
 
-static int triangulate_tetrahedron (
-    const double grids[3][2],
-    contour3d_vector_t (* const coordinate_converter) (
-      const contour3d_vector_t orthogonal
-    ),
+static INSTANTIATED int triangulate_tetrahedron (
+    const contour3d_vector_t corners[8],
+    const double (* const affine)[CONTOUR3D_NDIMS + 1],
+    const bool is_converted_later,
+    const bool has_colors,
     const double * const array,
+    const double * const color_array,
     const double threshold,
     const size_t tetrahedron_index,
     size_t * const num_triangles,
@@ -156,18 +203,10 @@ static int triangulate_tetrahedron (
   for (size_t n = 0; n < N_VERTICES; n++) {
     vertex_t * const vertex = tetrahedron + n;
     const size_t cube_index = cube_indices[tetrahedron_index][n];
-    // indices in xyz, see above schematic
-    const size_t i = cube_index % 2 == 0 ? 0 : 1;
-    const size_t j = cube_index % 4 <  2 ? 0 : 1;
-    const size_t k = cube_index     <  4 ? 0 : 1;
-    const double value = array[k * 4 + j * 2 + i];
-    // convert from a general to the cartesian coordinate systems
-    const contour3d_vector_t cartesian = {
-      grids[0][i],
-      grids[1][j],
-      grids[2][k],
-    };
-    vertex->position = coordinate_converter(cartesian);
+    // see above schematic for the indices
+    vertex->position = corners[cube_index];
+    const double value = array[cube_index];
+    vertex->color_value = has_colors ? color_array[cube_index] : 0.;
     vertex->cube_index = cube_index;
     vertex->value = value;
   }
@@ -203,67 +242,67 @@ static int triangulate_tetrahedron (
   //   following the right-hand rule
   if (/* 0001 */ 1 == mask) {
     kernel(
-        reverse, threshold,
+        has_colors, reverse, threshold, affine, is_converted_later,
         (size_t []) {0, 0, 0, }, (size_t []) {1, 3, 2, },
         tetrahedron,
         triangles + (*num_triangles)++
     );
   } else if (/* 0010 */ 2 == mask) {
     kernel(
-        reverse, threshold,
+        has_colors, reverse, threshold, affine, is_converted_later,
         (size_t []) {1, 1, 1, }, (size_t []) {0, 2, 3, },
         tetrahedron,
         triangles + (*num_triangles)++
     );
   } else if (/* 0011 */ 3 == mask) {
     kernel(
-        reverse, threshold,
+        has_colors, reverse, threshold, affine, is_converted_later,
         (size_t []) {0, 1, 0, }, (size_t []) {2, 3, 3, },
         tetrahedron,
         triangles + (*num_triangles)++
     );
     kernel(
-        reverse, threshold,
+        has_colors, reverse, threshold, affine, is_converted_later,
         (size_t []) {0, 1, 1, }, (size_t []) {2, 2, 3, },
         tetrahedron,
         triangles + (*num_triangles)++
     );
   } else if (/* 0100 */ 4 == mask) {
     kernel(
-        reverse, threshold,
+        has_colors, reverse, threshold, affine, is_converted_later,
         (size_t []) {2, 2, 2, }, (size_t []) {0, 3, 1, },
         tetrahedron,
         triangles + (*num_triangles)++
     );
   } else if (/* 0101 */ 5 == mask) {
     kernel(
-        reverse, threshold,
+        has_colors, reverse, threshold, affine, is_converted_later,
         (size_t []) {2, 0, 2, }, (size_t []) {1, 3, 3, },
         tetrahedron,
         triangles + (*num_triangles)++
     );
     kernel(
-        reverse, threshold,
+        has_colors, reverse, threshold, affine, is_converted_later,
         (size_t []) {2, 0, 0, }, (size_t []) {1, 1, 3, },
         tetrahedron,
         triangles + (*num_triangles)++
     );
   } else if (/* 0110 */ 6 == mask) {
     kernel(
-        reverse, threshold,
+        has_colors, reverse, threshold, affine, is_converted_later,
         (size_t []) {0, 2, 1, }, (size_t []) {2, 3, 3, },
         tetrahedron,
         triangles + (*num_triangles)++
     );
     kernel(
-        reverse, threshold,
+        has_colors, reverse, threshold, affine, is_converted_later,
         (size_t []) {0, 1, 0, }, (size_t []) {2, 3, 1, },
         tetrahedron,
         triangles + (*num_triangles)++
     );
   } else if (/* 0111 */ 7 == mask) {
     kernel(
-        reverse, threshold,
+        has_colors, reverse, threshold, affine, is_converted_later,
         (size_t []) {3, 3, 3, }, (size_t []) {0, 2, 1, },
         tetrahedron,
         triangles + (*num_triangles)++
@@ -275,6 +314,16 @@ static int triangulate_tetrahedron (
   return 0;
 }
 
+// position in an array of the given strides
+static inline size_t ravel_strided (
+    const size_t strides[3],
+    const size_t i,
+    const size_t j,
+    const size_t k
+) {
+  return i * strides[0] + j * strides[1] + k * strides[2];
+}
+
 static inline size_t ravel (
     const size_t glsizes[2],
     const size_t i,
@@ -284,13 +333,113 @@ static inline size_t ravel (
   return (k * glsizes[1] + j) * glsizes[0] + i;
 }
 
-int contour3d_contour_triangulate_slice (
+// check if the grid points are "origin + index * spacing" up to round-off errors
+static bool is_uniform (
+    const size_t nitems,
+    const double * const grid,
+    double * const origin,
+    double * const spacing
+) {
+  if (nitems < 2) {
+    return false;
+  }
+  *origin = grid[0];
+  *spacing = (grid[nitems - 1] - grid[0]) / (nitems - 1);
+  const double tolerance = 1.e-10 * fabs(*spacing);
+  for (size_t n = 0; n < nitems; n++) {
+    if (tolerance < fabs(*origin + n * *spacing - grid[n])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// find how the lattice corners are mapped to the Cartesian coordinate,
+//   where "offsets" are the global indices (x and y) of the extended array
+// NOTE: uniformity is checked on the whole grids,
+//         so that all processes compute the same positions on their boundaries
+int contour3d_contour_init_mapping (
+    const contour3d_contour_obj_t * const contour_obj,
+    const size_t offsets[2],
+    mapping_t * const mapping
+) {
+  mapping->is_uniform = true;
+  for (size_t dim = 0; dim < 2; dim++) {
+    const size_t nitems = contour_obj->glsizes[dim];
+    const double * const grid = contour_obj->grids[dim];
+    mapping->offsets[dim] = offsets[dim];
+    if (contour_obj->has_uniform_grids && 1 < nitems) {
+      mapping->origins[dim] = grid[0];
+      mapping->spacings[dim] = (grid[nitems - 1] - grid[0]) / (nitems - 1);
+    } else if (!is_uniform(nitems, grid, mapping->origins + dim, mapping->spacings + dim)) {
+      mapping->is_uniform = false;
+    }
+  }
+  mapping->converter = NULL;
+  mapping->batch_converter = NULL;
+  mapping->affine = NULL;
+  switch (contour_obj->converter_kind) {
+    case CONTOUR3D_CONVERTER_GENERAL:
+      if (NULL == contour_obj->converter && NULL == contour_obj->batch_converter) {
+        logger_error("converter is not given");
+        return 1;
+      }
+      mapping->converter = contour_obj->converter;
+      mapping->batch_converter = contour_obj->batch_converter;
+      break;
+    case CONTOUR3D_CONVERTER_IDENTITY:
+      break;
+    case CONTOUR3D_CONVERTER_AFFINE:
+      mapping->affine = (const double (*)[CONTOUR3D_NDIMS + 1])contour_obj->affine;
+      break;
+    default:
+      logger_error("unknown converter kind: %d", (int)contour_obj->converter_kind);
+      return 1;
+  }
+  return 0;
+}
+
+// convert points on the orthogonal coordinate system to the Cartesian one
+//   in the same manner as the triangle vertices (e.g. the corners of slice cells)
+int contour3d_contour_convert_points (
+    const mapping_t * const mapping,
+    const size_t npoints,
+    contour3d_vector_t * const points
+) {
+  if (NULL != mapping->affine) {
+    for (/* each point */ size_t n = 0; n < npoints; n++) {
+      apply_affine(mapping->affine, points + n);
+    }
+    return 0;
+  }
+  if (NULL != mapping->batch_converter) {
+    mapping->batch_converter(npoints, points);
+    return 0;
+  }
+  if (NULL != mapping->converter) {
+    for (/* each point */ size_t n = 0; n < npoints; n++) {
+      points[n] = mapping->converter(points[n]);
+    }
+  }
+  return 0;
+}
+
+// the loop over the lattices, which is instantiated separately
+//   for each combination of the compile-time arguments
+//   ("is_uniform", "is_converted_later", and "has_colors")
+static inline int triangulate_lattices (
     const size_t glsizes[2],
+    const size_t strides[3],
     double * const grids[3],
-    contour3d_vector_t (* const coordinate_converter) (
-      const contour3d_vector_t orthogonal
-    ),
+    const bool is_uniform,
+    const double origins[2],
+    const double spacings[2],
+    const size_t offsets[2],
+    const double (* const affine)[CONTOUR3D_NDIMS + 1],
+    const bool is_converted_later,
+    const bool has_colors,
     const double * const array,
+    const double * const color_array,
     const double threshold,
     lattice_t * const lattices
 ) {
@@ -300,21 +449,36 @@ int contour3d_contour_triangulate_slice (
     for (/* each x */ size_t i = 0; i < imax; i++) {
       lattice_t * const lattice = lattices + j * imax + i;
       // pack information
-      const double localgrids[CONTOUR3D_NDIMS][2] = {
-        {grids[0][i], grids[0][i + 1]},
-        {grids[1][j], grids[1][j + 1]},
-        {grids[2][0], grids[2][    1]},
-      };
+      // positions of the corners in the orthogonal coordinate system
+      contour3d_vector_t corners[8];
+      for (size_t n = 0; n < 8; n++) {
+        // indices in xyz, see above schematic
+        const size_t ii = i + (n % 2 == 0 ? 0 : 1);
+        const size_t jj = j + (n % 4 <  2 ? 0 : 1);
+        const size_t kk =     (n     <  4 ? 0 : 1);
+        corners[n] = (contour3d_vector_t) {
+          is_uniform ? origins[0] + (offsets[0] + ii) * spacings[0] : grids[0][ii],
+          is_uniform ? origins[1] + (offsets[1] + jj) * spacings[1] : grids[1][jj],
+          grids[2][kk],
+        };
+      }
       const double scalars[8] = {
-        array[ravel(glsizes, i    , j    , 0)],
-        array[ravel(glsizes, i + 1, j    , 0)],
-        array[ravel(glsizes, i    , j + 1, 0)],
-        array[ravel(glsizes, i + 1, j + 1, 0)],
-        array[ravel(glsizes, i    , j    , 1)],
-        array[ravel(glsizes, i + 1, j    , 1)],
-        array[ravel(glsizes, i    , j + 1, 1)],
-        array[ravel(glsizes, i + 1, j + 1, 1)],
+        array[ravel_strided(strides, i    , j    , 0)],
+        array[ravel_strided(strides, i + 1, j    , 0)],
+        array[ravel_strided(strides, i    , j + 1, 0)],
+        array[ravel_strided(strides, i + 1, j + 1, 0)],
+        array[ravel_strided(strides, i    , j    , 1)],
+        array[ravel_strided(strides, i + 1, j    , 1)],
+        array[ravel_strided(strides, i    , j + 1, 1)],
+        array[ravel_strided(strides, i + 1, j + 1, 1)],
       };
+      // the second field, which is not interpolated at all when not given
+      double color_scalars[8] = {0.};
+      if (has_colors) {
+        for (size_t n = 0; n < 8; n++) {
+          color_scalars[n] = color_array[ravel_strided(strides, i + n % 2, j + n / 2 % 2, n / 4)];
+        }
+      }
       // there are six tetrahedra in one lattice
       // tessellate each tetrahedron
       size_t * const num_triangles = &lattice->num_triangles;
@@ -324,9 +488,12 @@ int contour3d_contour_triangulate_slice (
       *num_triangles = 0;
       for (/* each tetrahedron */ size_t n = 0; n < N_TETRAHEDRA; n++) {
         if (0 != triangulate_tetrahedron(
-              localgrids,
-              coordinate_converter,
+              corners,
+              affine,
+              is_converted_later,
+              has_colors,
               scalars,
+              color_scalars,
               threshold,
               n,
               num_triangles,
@@ -341,3 +508,107 @@ int contour3d_contour_triangulate_slice (
   return 0;
 }
 
+// convert the triangle vertices of a slice to the Cartesian coordinate system,
+//   gathering them so that the batched converter is called once per "BATCH_SIZE" points,
+//   and find the face normals
+static int convert_vertices (
+    const size_t nlattices,
+    const mapping_t * const mapping,
+    lattice_t * const lattices
+) {
+  contour3d_vector_t points[BATCH_SIZE];
+  contour3d_vector_t * targets[BATCH_SIZE];
+  size_t npoints = 0;
+  for (size_t n = 0; n < nlattices; n++) {
+    lattice_t * const lattice = lattices + n;
+    for (size_t m = 0; m < lattice->num_triangles; m++) {
+      triangle_t * const triangle = lattice->triangles + m;
+      for (size_t l = 0; l < 3; l++) {
+        contour3d_vector_t * const vertex = triangle->vertices + l;
+        if (NULL == mapping->batch_converter) {
+          *vertex = mapping->converter(*vertex);
+          continue;
+        }
+        points[npoints] = *vertex;
+        targets[npoints] = vertex;
+        npoints += 1;
+        if (BATCH_SIZE == npoints) {
+          mapping->batch_converter(npoints, points);
+          for (size_t p = 0; p < npoints; p++) {
+            *targets[p] = points[p];
+          }
+          npoints = 0;
+        }
+      }
+    }
+  }
+  if (0 != npoints) {
+    mapping->batch_converter(npoints, points);
+    for (size_t p = 0; p < npoints; p++) {
+      *targets[p] = points[p];
+    }
+  }
+  for (size_t n = 0; n < nlattices; n++) {
+    lattice_t * const lattice = lattices + n;
+    for (size_t m = 0; m < lattice->num_triangles; m++) {
+      compute_face_normal(lattice->triangles + m);
+    }
+  }
+  return 0;
+}
+
+// pick the instance for the grids, which are either uniform or given point by point
+static inline int triangulate_mapped (
+    const size_t glsizes[2],
+    const size_t strides[3],
+    double * const grids[3],
+    const mapping_t * const mapping,
+    const bool is_converted_later,
+    const bool has_colors,
+    const double * const array,
+    const double * const color_array,
+    const double threshold,
+    lattice_t * const lattices
+) {
+  if (mapping->is_uniform) {
+    return triangulate_lattices(
+        glsizes, strides, grids, true, mapping->origins, mapping->spacings, mapping->offsets, mapping->affine, is_converted_later, has_colors, array, color_array, threshold, lattices
+    );
+  }
+  return triangulate_lattices(
+      glsizes, strides, grids, false, NULL, NULL, NULL, mapping->affine, is_converted_later, has_colors, array, color_array, threshold, lattices
+  );
+}
+
+// "grids" are those of the slice, i.e. x and y of the extended array
+//   and z from the lower side of the slice,
+//   and "strides" are those of the arrays (the second field is optional)
+int contour3d_contour_triangulate_slice (
+    const size_t glsizes[2],
+    const size_t strides[3],
+    double * const grids[3],
+    const mapping_t * const mapping,
+    const double * const array,
+    const double * const color_array,
+    const double threshold,
+    lattice_t * const lattices
+) {
+  // the second field is interpolated only by its own instances,
+  //   so that the surfaces without colormaps do not pay for it
+  const bool has_colors = NULL != color_array;
+  // general converters: the intersections are found in the orthogonal coordinate system
+  //   and are converted afterwards
+  if (NULL != mapping->converter || NULL != mapping->batch_converter) {
+    const int retval = has_colors
+      ? triangulate_mapped(glsizes, strides, grids, mapping, true, true, array, color_array, threshold, lattices)
+      : triangulate_mapped(glsizes, strides, grids, mapping, true, false, array, NULL, threshold, lattices);
+    if (0 != retval) {
+      return 1;
+    }
+    return convert_vertices((glsizes[0] - 1) * (glsizes[1] - 1), mapping, lattices);
+  }
+  // Cartesian up to an affine map, which is applied directly
+  return has_colors
+    ? triangulate_mapped(glsizes, strides, grids, mapping, false, true, array, color_array, threshold, lattices)
+    : triangulate_mapped(glsizes, strides, grids, mapping, false, false, array, NULL, threshold, lattices);
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <float.h> // DBL_MAX
+#include <math.h> // INFINITY
+#include <mpi.h>
+#include "./struct.h"
+#include "./memory.h"
+#include "./logger.h"
+#include "./depth.h"
+
+// depths and object ids of the pixels, which are exported
+//   so that images rendered separately can be depth-composited later
+// file layout (all little endian):
+//   - header (16 bytes): "C3DZ", version (uint32), width (uint32), height (uint32)
+//   - depths: width x height float32, from the top row to the bottom,
+//       larger is nearer and -infinity where nothing is drawn
+//   - ids: width x height uint16 in the same order
+
+#define HEADER_SIZE 16
+#define VERSION 1
+// number of rows which are packed at once by the main process
+#define BLOCK_ROWS 64
+
+static void put_u32 (
+    const uint32_t value,
+    uint8_t * const buffer
+) {
+  for (size_t n = 0; n < 4; n++) {
+    buffer[n] = (uint8_t)(value >> (8 * n));
+  }
+}
+
+static void put_u16 (
+    const uint16_t value,
+    uint8_t * const buffer
+) {
+  for (size_t n = 0; n < 2; n++) {
+    buffer[n] = (uint8_t)(value >> (8 * n));
+  }
+}
+
+static void pack_header (
+    const size_t width,
+    const size_t height,
+    uint8_t * const buffer
+) {
+  memcpy(buffer, "C3DZ", 4);
+  put_u32(VERSION, buffer + 4);
+  put_u32(width, buffer + 8);
+  put_u32(height, buffer + 12);
+}
+
+// pack the depths and / or the ids (either may be NULL)
+//   of "nrows" canvas rows from the "jmin"-th one from the top
+static void pack_rows (
+    const canvas_t * const canvas,
+    const size_t jmin,
+    const size_t nrows,
+    uint8_t * const depths,
+    uint8_t * const ids
+) {
+  const size_t width  = canvas->width;
+  const size_t height = canvas->height;
+  for (size_t cnt = 0, j = jmin; j < jmin + nrows; j++) {
+    for (size_t i = 0; i < width; i++, cnt++) {
+      // flip in y
+      const size_t index = (height - j - 1) * width + i;
+      if (NULL != depths) {
+        const double depth = canvas->depths[index];
+        // the background (-DBL_MAX) does not fit in a float
+        const float value = -1. * DBL_MAX == depth ? -INFINITY : (float)depth;
+        uint32_t bits = 0;
+        memcpy(&bits, &value, sizeof(uint32_t));
+        put_u32(bits, depths + 4 * cnt);
+      }
+      if (NULL != ids) {
+        put_u16(canvas->ids[index], ids + 2 * cnt);
+      }
+    }
+  }
+}
+
+// file name with the extension replaced by ".zid"
+char * contour3d_depth_get_fname (
+    const char fname[]
+) {
+  const char suffix[] = ".zid";
+  const char * const slash = strrchr(fname, '/');
+  const char * const dot = strrchr(fname, '.');
+  const size_t nchars = NULL != dot && (NULL == slash || slash < dot)
+    ? (size_t)(dot - fname)
+    : strlen(fname);
+  char * const zname = contour3d_memory_alloc(nchars + sizeof(suffix), sizeof(char));
+  if (NULL == zname) {
+    logger_error("failed to allocate file name");
+    return NULL;
+  }
+  memcpy(zname, fname, nchars);
+  memcpy(zname + nchars, suffix, sizeof(suffix));
+  return zname;
+}
+
+// the main process, holding the whole image, dumps it to a file,
+//   packing a block of rows at a time
+// NOTE: this is also called by the background writer,
+//   and thus should not call MPI functions
+int contour3d_depth_write_serial (
+    const char fname[],
+    const canvas_t * const canvas
+) {
+  const size_t width  = canvas->width;
+  const size_t height = canvas->height;
+  uint8_t * const buffer = contour3d_memory_alloc(HEADER_SIZE + 4 * width * BLOCK_ROWS, sizeof(uint8_t));
+  if (NULL == buffer) {
+    logger_error("failed to allocate depth buffer");
+    return 1;
+  }
+  errno = 0;
+  FILE * const fp = fopen(fname, "w");
+  if (NULL == fp) {
+    logger_error("%s: %s", fname, strerror(errno));
+    contour3d_memory_free(buffer);
+    return 1;
+  }
+  pack_header(width, height, buffer);
+  bool is_failed = HEADER_SIZE != fwrite(buffer, sizeof(uint8_t), HEADER_SIZE, fp);
+  // all depths are followed by all ids
+  for (size_t n = 0; n < 2; n++) {
+    const size_t nbytes = 0 == n ? 4 : 2;
+    for (size_t jmin = 0; !is_failed && jmin < height; jmin += BLOCK_ROWS) {
+      const size_t nrows = jmin + BLOCK_ROWS < height ? BLOCK_ROWS : height - jmin;
+      pack_rows(canvas, jmin, nrows, 0 == n ? buffer : NULL, 0 == n ? NULL : buffer);
+      const size_t size = nbytes * width * nrows;
+      is_failed = size != fwrite(buffer, sizeof(uint8_t), size, fp);
+    }
+  }
+  fclose(fp);
+  contour3d_memory_free(buffer);
+  if (is_failed) {
+    logger_error("%s: failed to write depths", fname);
+    return 1;
+  }
+  return 0;
+}
+
+// all processes, holding disjoint row bands of the image,
+//   write their parts to the same file collectively
+// since all sizes are known, the offsets follow directly from the bands
+int contour3d_depth_write_parallel (
+    const MPI_Comm comm,
+    const screen_t * const screen,
+    const char fname[],
+    const canvas_t * const canvas
+) {
+  int myrank = 0;
+  MPI_Comm_rank(comm, &myrank);
+  const size_t width  = screen->width;
+  const size_t height = screen->height;
+  const size_t nitems = width * canvas->height;
+  uint8_t * const buffer = contour3d_memory_alloc(6 * nitems, sizeof(uint8_t));
+  if (NULL == buffer) {
+    logger_error("failed to allocate depth buffer");
+    return 1;
+  }
+  pack_rows(canvas, 0, canvas->height, buffer, buffer + 4 * nitems);
+  // index of my first row in the file, which is ordered from the top
+  const size_t row = height - canvas->offset - canvas->height;
+  const MPI_Offset offsets[2] = {
+    HEADER_SIZE + 4 * width * row,
+    HEADER_SIZE + 4 * width * height + 2 * width * row,
+  };
+  MPI_File fh = MPI_FILE_NULL;
+  int error = MPI_File_open(comm, fname, MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &fh);
+  if (MPI_SUCCESS != error) {
+    char string[MPI_MAX_ERROR_STRING] = {'\0'};
+    int length = 0;
+    MPI_Error_string(error, string, &length);
+    logger_error("%s: %s", fname, string);
+    contour3d_memory_free(buffer);
+    return 1;
+  }
+  MPI_File_set_size(fh, 0);
+  if (0 == myrank) {
+    uint8_t header[HEADER_SIZE] = {0};
+    pack_header(width, height, header);
+    error |= MPI_File_write_at(fh, 0, header, HEADER_SIZE, MPI_BYTE, MPI_STATUS_IGNORE);
+  }
+  error |= MPI_File_write_at_all(fh, offsets[0], buffer, 4 * nitems, MPI_BYTE, MPI_STATUS_IGNORE);
+  error |= MPI_File_write_at_all(fh, offsets[1], buffer + 4 * nitems, 2 * nitems, MPI_BYTE, MPI_STATUS_IGNORE);
+  MPI_File_close(&fh);
+  contour3d_memory_free(buffer);
+  if (MPI_SUCCESS != error) {
+    logger_error("%s: failed to write depths", fname);
+    return 1;
+  }
+  return 0;
+}
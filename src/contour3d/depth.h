@@ -0,0 +1,23 @@
+#if !defined(CONTOUR3D_DEPTH_H)
+#define CONTOUR3D_DEPTH_H
+
+#include <mpi.h>
+#include "./struct.h"
+
+extern char * contour3d_depth_get_fname (
+    const char fname[]
+);
+
+extern int contour3d_depth_write_serial (
+    const char fname[],
+    const canvas_t * const canvas
+);
+
+extern int contour3d_depth_write_parallel (
+    const MPI_Comm comm,
+    const screen_t * const screen,
+    const char fname[],
+    const canvas_t * const canvas
+);
+
+#endif // CONTOUR3D_DEPTH_H
@@ -0,0 +1,261 @@
+#include <stdbool.h>
+#include "../memory.h"
+#include "../logger.h"
+#include "./internal.h"
+
+// minimal deflate compressor
+// - lz77 with hash chains to find repeated byte sequences
+// - fixed huffman codes, so that no code tables have to be stored
+// the output is a sequence of non-final blocks ending with an empty stored block
+//   (i.e., "sync flush"), which is byte-aligned and thus can be concatenated
+
+// window size and its mask
+#define WINDOW_SIZE 32768
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+// hash table size, 3 bytes are hashed
+#define HASH_BITS 15
+#define HASH_SIZE (1 << HASH_BITS)
+// shortest and longest matches
+#define MATCH_MIN 3
+#define MATCH_MAX 258
+// number of candidates to be checked for each position, trading speed for ratio
+#define CHAIN_MAX 32
+// no position is registered
+#define NIL (-1)
+
+// base values and numbers of extra bits of the length codes (257 - 285)
+static const uint16_t length_bases[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t length_extras[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+
+// base values and numbers of extra bits of the distance codes (0 - 29)
+static const uint16_t distance_bases[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const uint8_t distance_extras[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+// bits are packed from the least significant bit
+typedef struct {
+  uint8_t * output;
+  size_t size;
+  uint64_t bits;
+  size_t nbits;
+} bitstream_t;
+
+static inline void put_bits (
+    bitstream_t * const stream,
+    const uint32_t value,
+    const size_t nbits
+) {
+  stream->bits |= (uint64_t)value << stream->nbits;
+  stream->nbits += nbits;
+  while (8 <= stream->nbits) {
+    stream->output[stream->size++] = stream->bits & 0xff;
+    stream->bits >>= 8;
+    stream->nbits -= 8;
+  }
+}
+
+static void align_to_byte (
+    bitstream_t * const stream
+) {
+  if (0 < stream->nbits) {
+    put_bits(stream, 0, 8 - stream->nbits);
+  }
+}
+
+// huffman codes are packed from the most significant bit
+static inline void put_code (
+    bitstream_t * const stream,
+    const uint32_t code,
+    const size_t nbits
+) {
+  uint32_t reversed = 0;
+  for (size_t n = 0; n < nbits; n++) {
+    reversed |= ((code >> n) & 1) << (nbits - n - 1);
+  }
+  put_bits(stream, reversed, nbits);
+}
+
+// fixed huffman code of a literal / length symbol
+static inline void put_symbol (
+    bitstream_t * const stream,
+    const uint32_t symbol
+) {
+  if (symbol < 144) {
+    put_code(stream, 0x30 + symbol, 8);
+  } else if (symbol < 256) {
+    put_code(stream, 0x190 + symbol - 144, 9);
+  } else if (symbol < 280) {
+    put_code(stream, symbol - 256, 7);
+  } else {
+    put_code(stream, 0xc0 + symbol - 280, 8);
+  }
+}
+
+static void put_match (
+    bitstream_t * const stream,
+    const size_t length,
+    const size_t distance
+) {
+  size_t l = 28;
+  while (length < length_bases[l]) {
+    l -= 1;
+  }
+  put_symbol(stream, 257 + l);
+  put_bits(stream, length - length_bases[l], length_extras[l]);
+  size_t d = 29;
+  while (distance < distance_bases[d]) {
+    d -= 1;
+  }
+  // fixed distance codes are 5-bit long
+  put_code(stream, d, 5);
+  put_bits(stream, distance - distance_bases[d], distance_extras[d]);
+}
+
+static inline size_t hash (
+    const uint8_t * const input
+) {
+  const uint32_t value = (uint32_t)input[0] << 16 | (uint32_t)input[1] << 8 | input[2];
+  return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// upper bound of the compressed size:
+//   at most nine bits per literal, block headers and the sync flush
+size_t contour3d_deflate_bound (
+    const size_t nitems
+) {
+  return nitems + nitems / 8 + 16;
+}
+
+int contour3d_deflate (
+    const size_t nitems,
+    const uint8_t * const input,
+    uint8_t * const output,
+    size_t * const size
+) {
+  // latest position having each hash, and the previous positions having the same hash
+  int32_t * const heads = contour3d_memory_alloc(HASH_SIZE, sizeof(int32_t));
+  int32_t * const prevs = contour3d_memory_alloc(WINDOW_SIZE, sizeof(int32_t));
+  if (NULL == heads || NULL == prevs) {
+    logger_error("failed to allocate deflate buffers");
+    return 1;
+  }
+  for (size_t n = 0; n < HASH_SIZE; n++) {
+    heads[n] = NIL;
+  }
+  bitstream_t stream = {
+    .output = output,
+    .size = 0,
+    .bits = 0,
+    .nbits = 0,
+  };
+  // block header: not final, fixed huffman codes
+  put_bits(&stream, 0, 1);
+  put_bits(&stream, 1, 2);
+  for (size_t pos = 0; pos < nitems; ) {
+    size_t best_length = 0;
+    size_t best_distance = 0;
+    if (pos + MATCH_MIN <= nitems) {
+      const size_t h = hash(input + pos);
+      const size_t length_max = nitems - pos < MATCH_MAX ? nitems - pos : MATCH_MAX;
+      int32_t candidate = heads[h];
+      for (size_t chain = 0; NIL != candidate && chain < CHAIN_MAX; chain++) {
+        const size_t distance = pos - candidate;
+        if (WINDOW_SIZE <= distance) {
+          break;
+        }
+        size_t length = 0;
+        while (length < length_max && input[candidate + length] == input[pos + length]) {
+          length += 1;
+        }
+        if (best_length < length) {
+          best_length = length;
+          best_distance = distance;
+          if (length_max == length) {
+            break;
+          }
+        }
+        candidate = prevs[candidate & WINDOW_MASK];
+      }
+    }
+    const size_t advance = MATCH_MIN <= best_length ? best_length : 1;
+    if (MATCH_MIN <= best_length) {
+      put_match(&stream, best_length, best_distance);
+    } else {
+      put_symbol(&stream, input[pos]);
+    }
+    // register all positions which have been consumed
+    for (size_t n = 0; n < advance; n++, pos++) {
+      if (pos + MATCH_MIN <= nitems) {
+        const size_t h = hash(input + pos);
+        prevs[pos & WINDOW_MASK] = heads[h];
+        heads[h] = pos;
+      }
+    }
+  }
+  // end of block
+  put_symbol(&stream, 256);
+  // sync flush: empty stored block, which is byte-aligned
+  put_bits(&stream, 0, 1);
+  put_bits(&stream, 0, 2);
+  align_to_byte(&stream);
+  output[stream.size++] = 0x00;
+  output[stream.size++] = 0x00;
+  output[stream.size++] = 0xff;
+  output[stream.size++] = 0xff;
+  *size = stream.size;
+  contour3d_memory_free(prevs);
+  contour3d_memory_free(heads);
+  return 0;
+}
+
+#define ADLER_BASE 65521u
+
+uint32_t contour3d_adler32 (
+    const size_t nitems,
+    const uint8_t * const input
+) {
+  uint32_t a = 1;
+  uint32_t b = 0;
+  for (size_t n = 0; n < nitems; ) {
+    // defer the modulo operations as long as no overflow happens
+    const size_t nmax = n + 5552 < nitems ? n + 5552 : nitems;
+    for (; n < nmax; n++) {
+      a += input[n];
+      b += a;
+    }
+    a %= ADLER_BASE;
+    b %= ADLER_BASE;
+  }
+  return b << 16 | a;
+}
+
+// checksum of the concatenated data,
+//   whose first and second parts have checksums "adler0" and "adler1",
+//   while the second part has "length1" bytes
+uint32_t contour3d_adler32_combine (
+    const uint32_t adler0,
+    const uint32_t adler1,
+    const uint64_t length1
+) {
+  const uint64_t remainder = length1 % ADLER_BASE;
+  const uint64_t a0 = adler0 & 0xffff;
+  const uint64_t b0 = adler0 >> 16;
+  const uint64_t a1 = adler1 & 0xffff;
+  const uint64_t b1 = adler1 >> 16;
+  // a = a0 + a1 - 1, b = b0 + b1 + remainder * (a0 - 1)
+  const uint64_t a = (a0 + a1 + ADLER_BASE - 1) % ADLER_BASE;
+  const uint64_t b = (b0 + b1 + remainder * a0 + ADLER_BASE - remainder) % ADLER_BASE;
+  return b << 16 | a;
+}
+
@@ -0,0 +1,152 @@
+#if !defined(CONTOUR3D_ENCODE_INTERNAL_H)
+#define CONTOUR3D_ENCODE_INTERNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// image file formats, decided by the file extension
+typedef enum {
+  FORMAT_PPM = 0,
+  FORMAT_QOI = 1,
+  FORMAT_PNG = 2,
+} image_format_t;
+
+// summary of an encoded row block,
+//   which is needed to finish a file consisting of several blocks
+typedef struct {
+  // number of raw (filtered) bytes which are compressed
+  uint64_t length;
+  // checksum of the raw bytes (png only)
+  uint32_t adler;
+} block_info_t;
+
+// maximum size of the header / trailer
+#define ENCODE_HEADER_SIZE 64
+
+// each image is divided into row blocks, which are encoded independently
+//   so that the encoding can be parallelised
+
+extern image_format_t contour3d_encode_get_format (
+    const char fname[]
+);
+
+extern size_t contour3d_encode_bound (
+    const image_format_t format,
+    const size_t width,
+    const size_t nrows
+);
+
+extern int contour3d_encode_header (
+    const image_format_t format,
+    const size_t width,
+    const size_t height,
+    uint8_t * const buffer,
+    size_t * const size
+);
+
+extern int contour3d_encode_block (
+    const image_format_t format,
+    const size_t width,
+    const size_t nrows,
+    const uint8_t * const rgb,
+    uint8_t * const buffer,
+    size_t * const size,
+    block_info_t * const info
+);
+
+extern block_info_t contour3d_encode_combine (
+    const block_info_t * const info0,
+    const block_info_t * const info1
+);
+
+extern int contour3d_encode_trailer (
+    const image_format_t format,
+    const block_info_t * const info,
+    uint8_t * const buffer,
+    size_t * const size
+);
+
+// format-specific implementations
+
+extern int contour3d_encode_ppm_header (
+    const size_t width,
+    const size_t height,
+    uint8_t * const buffer,
+    size_t * const size
+);
+
+extern int contour3d_encode_ppm_block (
+    const size_t width,
+    const size_t nrows,
+    const uint8_t * const rgb,
+    uint8_t * const buffer,
+    size_t * const size
+);
+
+extern int contour3d_encode_qoi_header (
+    const size_t width,
+    const size_t height,
+    uint8_t * const buffer,
+    size_t * const size
+);
+
+extern int contour3d_encode_qoi_block (
+    const size_t width,
+    const size_t nrows,
+    const uint8_t * const rgb,
+    uint8_t * const buffer,
+    size_t * const size
+);
+
+extern int contour3d_encode_qoi_trailer (
+    uint8_t * const buffer,
+    size_t * const size
+);
+
+extern int contour3d_encode_png_header (
+    const size_t width,
+    const size_t height,
+    uint8_t * const buffer,
+    size_t * const size
+);
+
+extern int contour3d_encode_png_block (
+    const size_t width,
+    const size_t nrows,
+    const uint8_t * const rgb,
+    uint8_t * const buffer,
+    size_t * const size,
+    block_info_t * const info
+);
+
+extern int contour3d_encode_png_trailer (
+    const block_info_t * const info,
+    uint8_t * const buffer,
+    size_t * const size
+);
+
+// deflate (rfc 1951) using fixed huffman codes and adler-32 checksum (rfc 1950)
+
+extern size_t contour3d_deflate_bound (
+    const size_t nitems
+);
+
+extern int contour3d_deflate (
+    const size_t nitems,
+    const uint8_t * const input,
+    uint8_t * const output,
+    size_t * const size
+);
+
+extern uint32_t contour3d_adler32 (
+    const size_t nitems,
+    const uint8_t * const input
+);
+
+extern uint32_t contour3d_adler32_combine (
+    const uint32_t adler0,
+    const uint32_t adler1,
+    const uint64_t length1
+);
+
+#endif // CONTOUR3D_ENCODE_INTERNAL_H
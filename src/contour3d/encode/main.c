@@ -0,0 +1,107 @@
+#include <string.h>
+#include "../logger.h"
+#include "./internal.h"
+
+// decide the format from the file extension, ppm by default
+image_format_t contour3d_encode_get_format (
+    const char fname[]
+) {
+  const char * const extension = strrchr(fname, '.');
+  if (NULL == extension) {
+    return FORMAT_PPM;
+  }
+  if (0 == strcmp(extension, ".qoi")) {
+    return FORMAT_QOI;
+  }
+  if (0 == strcmp(extension, ".png")) {
+    return FORMAT_PNG;
+  }
+  return FORMAT_PPM;
+}
+
+// upper bound of the size of an encoded row block
+size_t contour3d_encode_bound (
+    const image_format_t format,
+    const size_t width,
+    const size_t nrows
+) {
+  const size_t npixels = width * nrows;
+  if (FORMAT_QOI == format) {
+    // at most four bytes per pixel (QOI_OP_RGB)
+    return 4 * npixels;
+  }
+  if (FORMAT_PNG == format) {
+    // chunk length, type, and crc in addition to the compressed rows,
+    //   each of which has one additional byte to specify the filter
+    return 12 + contour3d_deflate_bound(nrows * (1 + 3 * width));
+  }
+  return 3 * npixels;
+}
+
+int contour3d_encode_header (
+    const image_format_t format,
+    const size_t width,
+    const size_t height,
+    uint8_t * const buffer,
+    size_t * const size
+) {
+  if (FORMAT_QOI == format) {
+    return contour3d_encode_qoi_header(width, height, buffer, size);
+  }
+  if (FORMAT_PNG == format) {
+    return contour3d_encode_png_header(width, height, buffer, size);
+  }
+  return contour3d_encode_ppm_header(width, height, buffer, size);
+}
+
+// encode "nrows" rows of rgb pixels (from top to bottom)
+int contour3d_encode_block (
+    const image_format_t format,
+    const size_t width,
+    const size_t nrows,
+    const uint8_t * const rgb,
+    uint8_t * const buffer,
+    size_t * const size,
+    block_info_t * const info
+) {
+  info->length = 0;
+  info->adler = 1;
+  if (FORMAT_QOI == format) {
+    return contour3d_encode_qoi_block(width, nrows, rgb, buffer, size);
+  }
+  if (FORMAT_PNG == format) {
+    return contour3d_encode_png_block(width, nrows, rgb, buffer, size, info);
+  }
+  return contour3d_encode_ppm_block(width, nrows, rgb, buffer, size);
+}
+
+// summary of two consecutive blocks
+block_info_t contour3d_encode_combine (
+    const block_info_t * const info0,
+    const block_info_t * const info1
+) {
+  const block_info_t info = {
+    .length = info0->length + info1->length,
+    .adler = contour3d_adler32_combine(info0->adler, info1->adler, info1->length),
+  };
+  return info;
+}
+
+// "info" is the summary of all blocks
+int contour3d_encode_trailer (
+    const image_format_t format,
+    const block_info_t * const info,
+    uint8_t * const buffer,
+    size_t * const size
+) {
+  if (FORMAT_QOI == format) {
+    return contour3d_encode_qoi_trailer(buffer, size);
+  }
+  if (FORMAT_PNG == format) {
+    return contour3d_encode_png_trailer(info, buffer, size);
+  }
+  // nothing for ppm
+  *size = 0;
+  return 0;
+}
+
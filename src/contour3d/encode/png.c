@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../memory.h"
+#include "../logger.h"
+#include "./internal.h"
+
+// portable network graphics, 8-bit rgb, no interlace
+// the zlib stream is split into several IDAT chunks:
+//   - header  : zlib header
+//   - blocks  : deflate blocks of the filtered rows, each of which ends with a sync flush
+//   - trailer : final (empty) block and the adler-32 checksum of all filtered rows
+
+static void put_u32 (
+    const uint32_t value,
+    uint8_t * const buffer
+) {
+  buffer[0] = (value >> 24) & 0xff;
+  buffer[1] = (value >> 16) & 0xff;
+  buffer[2] = (value >>  8) & 0xff;
+  buffer[3] = (value >>  0) & 0xff;
+}
+
+static uint32_t crc32 (
+    const size_t nitems,
+    const uint8_t * const input
+) {
+  uint32_t crc = 0xffffffffu;
+  for (size_t n = 0; n < nitems; n++) {
+    crc ^= input[n];
+    for (size_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1)));
+    }
+  }
+  return crc ^ 0xffffffffu;
+}
+
+// a chunk consists of length, type, data, and crc of type and data
+// data should be already stored at buffer + 8
+static size_t finish_chunk (
+    const char type[4],
+    const size_t length,
+    uint8_t * const buffer
+) {
+  put_u32(length, buffer);
+  memcpy(buffer + 4, type, 4);
+  put_u32(crc32(4 + length, buffer + 4), buffer + 8 + length);
+  return 12 + length;
+}
+
+static inline uint8_t paeth (
+    const int a,
+    const int b,
+    const int c
+) {
+  const int p = a + b - c;
+  const int pa = abs(p - a);
+  const int pb = abs(p - b);
+  const int pc = abs(p - c);
+  if (pa <= pb && pa <= pc) {
+    return a;
+  }
+  return pb <= pc ? b : c;
+}
+
+// filter a row, choosing the one which minimises the sum of absolute differences
+// the first row of each block only refers to the left pixels (sub filter),
+//   so that blocks are independent of each other
+static void filter_row (
+    const size_t width,
+    const uint8_t * const prev,
+    const uint8_t * const curr,
+    uint8_t * const filtered
+) {
+  const size_t nbytes = 3 * width;
+  // candidates: 1 (sub), 2 (up), 4 (paeth)
+  const uint8_t types[] = {1, 2, 4};
+  const size_t ntypes = NULL == prev ? 1 : sizeof(types) / sizeof(types[0]);
+  size_t best_score = SIZE_MAX;
+  uint8_t best_type = 1;
+  for (size_t t = 0; t < ntypes; t++) {
+    size_t score = 0;
+    for (size_t n = 0; n < nbytes; n++) {
+      const int a = 3 <= n ? curr[n - 3] : 0;
+      const int b = NULL == prev ? 0 : prev[n];
+      const int c = NULL == prev || n < 3 ? 0 : prev[n - 3];
+      const int predictor = 1 == types[t] ? a : 2 == types[t] ? b : paeth(a, b, c);
+      const int8_t value = (int8_t)(uint8_t)(curr[n] - predictor);
+      score += abs(value);
+    }
+    if (score < best_score) {
+      best_score = score;
+      best_type = types[t];
+    }
+  }
+  filtered[0] = best_type;
+  for (size_t n = 0; n < nbytes; n++) {
+    const int a = 3 <= n ? curr[n - 3] : 0;
+    const int b = NULL == prev ? 0 : prev[n];
+    const int c = NULL == prev || n < 3 ? 0 : prev[n - 3];
+    const int predictor = 1 == best_type ? a : 2 == best_type ? b : paeth(a, b, c);
+    filtered[1 + n] = (uint8_t)(curr[n] - predictor);
+  }
+}
+
+int contour3d_encode_png_header (
+    const size_t width,
+    const size_t height,
+    uint8_t * const buffer,
+    size_t * const size
+) {
+  const uint8_t signature[8] = {0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a};
+  size_t cnt = 0;
+  memcpy(buffer, signature, sizeof(signature));
+  cnt += sizeof(signature);
+  // image header: 8-bit rgb, deflate, adaptive filtering, no interlace
+  {
+    uint8_t * const data = buffer + cnt + 8;
+    put_u32(width,  data + 0);
+    put_u32(height, data + 4);
+    data[ 8] = 8;
+    data[ 9] = 2;
+    data[10] = 0;
+    data[11] = 0;
+    data[12] = 0;
+    cnt += finish_chunk("IHDR", 13, buffer + cnt);
+  }
+  // zlib header: deflate with 32k window, fastest
+  {
+    uint8_t * const data = buffer + cnt + 8;
+    data[0] = 0x78;
+    data[1] = 0x01;
+    cnt += finish_chunk("IDAT", 2, buffer + cnt);
+  }
+  *size = cnt;
+  return 0;
+}
+
+int contour3d_encode_png_block (
+    const size_t width,
+    const size_t nrows,
+    const uint8_t * const rgb,
+    uint8_t * const buffer,
+    size_t * const size,
+    block_info_t * const info
+) {
+  const size_t stride = 1 + 3 * width;
+  uint8_t * const filtered = contour3d_memory_alloc(nrows * stride, sizeof(uint8_t));
+  if (NULL == filtered) {
+    logger_error("failed to allocate filtered rows");
+    return 1;
+  }
+  for (size_t j = 0; j < nrows; j++) {
+    filter_row(
+        width,
+        0 == j ? NULL : rgb + 3 * width * (j - 1),
+        rgb + 3 * width * j,
+        filtered + stride * j
+    );
+  }
+  size_t length = 0;
+  if (0 != contour3d_deflate(nrows * stride, filtered, buffer + 8, &length)) {
+    logger_error("failed to compress rows");
+    return 1;
+  }
+  *size = finish_chunk("IDAT", length, buffer);
+  info->length = nrows * stride;
+  info->adler = contour3d_adler32(nrows * stride, filtered);
+  contour3d_memory_free(filtered);
+  return 0;
+}
+
+int contour3d_encode_png_trailer (
+    const block_info_t * const info,
+    uint8_t * const buffer,
+    size_t * const size
+) {
+  size_t cnt = 0;
+  // final empty stored block and the checksum
+  {
+    uint8_t * const data = buffer + cnt + 8;
+    data[0] = 0x01;
+    data[1] = 0x00;
+    data[2] = 0x00;
+    data[3] = 0xff;
+    data[4] = 0xff;
+    put_u32(info->adler, data + 5);
+    cnt += finish_chunk("IDAT", 9, buffer + cnt);
+  }
+  // image end
+  cnt += finish_chunk("IEND", 0, buffer + cnt);
+  *size = cnt;
+  return 0;
+}
+
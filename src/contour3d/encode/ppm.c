@@ -0,0 +1,28 @@
+#include <stdio.h>
+#include <string.h>
+#include "./internal.h"
+
+// portable pixmap: plain header followed by raw rgb values
+
+int contour3d_encode_ppm_header (
+    const size_t width,
+    const size_t height,
+    uint8_t * const buffer,
+    size_t * const size
+) {
+  *size = snprintf((char *)buffer, ENCODE_HEADER_SIZE, "P6\n%zu %zu\n255\n", width, height);
+  return 0;
+}
+
+int contour3d_encode_ppm_block (
+    const size_t width,
+    const size_t nrows,
+    const uint8_t * const rgb,
+    uint8_t * const buffer,
+    size_t * const size
+) {
+  *size = 3 * width * nrows;
+  memcpy(buffer, rgb, *size);
+  return 0;
+}
+
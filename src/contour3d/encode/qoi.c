@@ -0,0 +1,149 @@
+#include <stdbool.h>
+#include <string.h>
+#include "./internal.h"
+
+// quite ok image format
+// see also: https://qoiformat.org/qoi-specification.pdf
+// NOTE: to encode row blocks independently,
+//   - the first pixel of each block is stored as it is (QOI_OP_RGB),
+//   - a run does not continue across blocks,
+//   - only the index entries written in the same block are referred to,
+//   which are all valid QOI streams when concatenated
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+
+typedef struct {
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+} rgb_t;
+
+static void put_u32 (
+    const uint32_t value,
+    uint8_t * const buffer
+) {
+  buffer[0] = (value >> 24) & 0xff;
+  buffer[1] = (value >> 16) & 0xff;
+  buffer[2] = (value >>  8) & 0xff;
+  buffer[3] = (value >>  0) & 0xff;
+}
+
+static inline bool is_equal (
+    const rgb_t * const px0,
+    const rgb_t * const px1
+) {
+  return px0->r == px1->r && px0->g == px1->g && px0->b == px1->b;
+}
+
+static inline size_t hash (
+    const rgb_t * const px
+) {
+  // alpha is always 255
+  return (px->r * 3 + px->g * 5 + px->b * 7 + 255 * 11) % 64;
+}
+
+int contour3d_encode_qoi_header (
+    const size_t width,
+    const size_t height,
+    uint8_t * const buffer,
+    size_t * const size
+) {
+  memcpy(buffer, "qoif", 4);
+  put_u32(width,  buffer + 4);
+  put_u32(height, buffer + 8);
+  // rgb, sRGB with linear alpha
+  buffer[12] = 3;
+  buffer[13] = 0;
+  *size = 14;
+  return 0;
+}
+
+int contour3d_encode_qoi_block (
+    const size_t width,
+    const size_t nrows,
+    const uint8_t * const rgb,
+    uint8_t * const buffer,
+    size_t * const size
+) {
+  const size_t npixels = width * nrows;
+  rgb_t index[64] = {{0, 0, 0}};
+  bool is_known[64] = {false};
+  rgb_t prev = {0, 0, 0};
+  size_t run = 0;
+  size_t cnt = 0;
+  for (size_t n = 0; n < npixels; n++) {
+    const rgb_t px = {rgb[3 * n + 0], rgb[3 * n + 1], rgb[3 * n + 2]};
+    if (0 < n && is_equal(&px, &prev)) {
+      run += 1;
+      if (62 == run || npixels - 1 == n) {
+        buffer[cnt++] = QOI_OP_RUN | (run - 1);
+        run = 0;
+      }
+      continue;
+    }
+    if (0 < run) {
+      buffer[cnt++] = QOI_OP_RUN | (run - 1);
+      run = 0;
+    }
+    const size_t index_pos = hash(&px);
+    if (0 < n && is_known[index_pos] && is_equal(index + index_pos, &px)) {
+      buffer[cnt++] = QOI_OP_INDEX | index_pos;
+      prev = px;
+      continue;
+    }
+    index[index_pos] = px;
+    is_known[index_pos] = true;
+    const int vr = px.r - prev.r;
+    const int vg = px.g - prev.g;
+    const int vb = px.b - prev.b;
+    // differences wrap around, which is consistent with the decoder
+    const signed char dr = (signed char)vr;
+    const signed char dg = (signed char)vg;
+    const signed char db = (signed char)vb;
+    const signed char dr_dg = (signed char)(dr - dg);
+    const signed char db_dg = (signed char)(db - dg);
+    if (0 == n) {
+      // independent of the previous block
+      buffer[cnt++] = QOI_OP_RGB;
+      buffer[cnt++] = px.r;
+      buffer[cnt++] = px.g;
+      buffer[cnt++] = px.b;
+    } else if (
+           -3 < dr && dr < 2
+        && -3 < dg && dg < 2
+        && -3 < db && db < 2
+    ) {
+      buffer[cnt++] = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+    } else if (
+            -33 < dg && dg < 32
+        &&  -9 < dr_dg && dr_dg < 8
+        &&  -9 < db_dg && db_dg < 8
+    ) {
+      buffer[cnt++] = QOI_OP_LUMA | (dg + 32);
+      buffer[cnt++] = (dr_dg + 8) << 4 | (db_dg + 8);
+    } else {
+      buffer[cnt++] = QOI_OP_RGB;
+      buffer[cnt++] = px.r;
+      buffer[cnt++] = px.g;
+      buffer[cnt++] = px.b;
+    }
+    prev = px;
+  }
+  *size = cnt;
+  return 0;
+}
+
+int contour3d_encode_qoi_trailer (
+    uint8_t * const buffer,
+    size_t * const size
+) {
+  const uint8_t padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+  memcpy(buffer, padding, sizeof(padding));
+  *size = sizeof(padding);
+  return 0;
+}
+
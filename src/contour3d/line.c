@@ -1,10 +1,12 @@
 #include <stdio.h>
+#include <stdbool.h>
 #include <math.h>
 #include "contour3d.h"
 #include "./struct.h"
 #include "./vector.h"
 #include "./logger.h"
 #include "./project.h"
+#include "./canvas.h"
 #include "./line.h"
 
 static inline int_fast32_t intmin (
@@ -30,10 +32,11 @@ static int draw_line_between_two_points (
       const contour3d_vector_t orthogonal
     ),
     const contour3d_color_t * const color,
+    const uint16_t id,
     const double line_width,
     const contour3d_vector_t * restrict const p0_orthogonal,
     const contour3d_vector_t * restrict const p1_orthogonal,
-    pixel_t * const canvas
+    canvas_t * const canvas
 ) {
   // transform points to Cartesian coordinate system
   const contour3d_vector_t p0_cartesian = converter(*p0_orthogonal);
@@ -72,10 +75,17 @@ static int draw_line_between_two_points (
   const int_fast32_t ymin = fmin(p0_screen.y, p1_screen.y) - 1;
   const int_fast32_t ymax = fmax(p0_screen.y, p1_screen.y) + 1;
   // avoid out-of-bounds access
+  // NOTE: the canvas may only cover a part of the screen rows,
+  //   and thus the range is further limited
+  const int_fast32_t jlower = canvas->offset;
+  const int_fast32_t jupper = canvas->offset + canvas->height - 1;
   const size_t imin = intmin( width - 1, intmax(0, xmin));
   const size_t imax = intmin( width - 1, intmax(0, xmax));
-  const size_t jmin = intmin(height - 1, intmax(0, ymin));
-  const size_t jmax = intmin(height - 1, intmax(0, ymax));
+  const size_t jmin = intmax(jlower, intmin(height - 1, intmax(0, ymin)));
+  const size_t jmax = intmin(jupper, intmin(height - 1, intmax(0, ymax)));
+  if (jmax < jmin) {
+    return 0;
+  }
   // change the color of a dot if the distance between
   //   the pixel and a line is below the width
   // line: ax + by + c = 0
@@ -84,6 +94,8 @@ static int draw_line_between_two_points (
   const double c =
     + (p1_screen.x - p0_screen.x) * p0_screen.y
     - (p1_screen.y - p0_screen.y) * p0_screen.x;
+  // flag to tell whether at least one pixel is updated by this segment
+  bool is_touched = false;
   for (size_t j = jmin; j <= jmax; j++) {
     for (size_t i = imin; i <= imax; i++) {
       // check distance from the line segment
@@ -103,18 +115,31 @@ static int draw_line_between_two_points (
       );
       const double dist0 = 1. / (param / p1_screen.z + (1. - param) / p0_screen.z);
       // check z-buffer
-      pixel_t * const pixel = canvas + j * width + i;
-      double * const dist1 = &pixel->depth;
+      const size_t index = (j - canvas->offset) * width + i;
+      double * const dist1 = canvas->depths + index;
       // by default depth is negative and thus we pick-up larger one
       if (dist0 < *dist1) {
         continue;
       }
       // draw this dot as it comes to the nearest
-      pixel->color = *color;
+      canvas->colors[index] = *color;
+      if (NULL != canvas->ids) {
+        canvas->ids[index] = id;
+      }
       // update nearest distance as well
       *dist1 = dist0;
+      is_touched = true;
     }
   }
+  // record the region which this segment has modified
+  if (is_touched) {
+    contour3d_canvas_touch(canvas, &(rect_t){
+        .imin = imin,
+        .imax = imax + 1,
+        .jmin = jmin,
+        .jmax = jmax + 1,
+    });
+  }
   return 0;
 }
 
@@ -122,7 +147,8 @@ int contour3d_process_line_obj (
     const camera_t * const camera,
     const screen_t * const screen,
     const contour3d_line_obj_t * const line_obj,
-    pixel_t * const canvas
+    const uint16_t id,
+    canvas_t * const canvas
 ) {
   // aliases for convenience
   contour3d_vector_t (* const add) (
@@ -160,6 +186,7 @@ int contour3d_process_line_obj (
         screen,
         converter,
         &color,
+        id,
         width,
         &s,
         &e,
@@ -17,3 +17,18 @@ int logger_error (
   return 0;
 }
 
+int logger_info (
+    const char * format,
+    ...
+) {
+  FILE * stream = stdout;
+  va_list args = {0};
+  va_start(args, format);
+  fprintf(stream, "[CONTOUR3D INFO] ");
+  vfprintf(stream, format, args);
+  fprintf(stream, "\n");
+  fflush(stream);
+  va_end(args);
+  return 0;
+}
+
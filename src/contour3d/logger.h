@@ -6,4 +6,9 @@ extern int logger_error (
     ...
 );
 
+extern int logger_info (
+    const char * format,
+    ...
+);
+
 #endif // CONTOUR3D_LOGGER_H
@@ -1,5 +1,7 @@
 #include <stdio.h>
-#include <float.h> // DBL_MAX
+#include <stdbool.h>
+#include <stdint.h>
+#include <mpi.h>
 #include "contour3d.h"
 #include "./struct.h"
 #include "./vector.h"
@@ -7,6 +9,13 @@
 #include "./output.h"
 #include "./logger.h"
 #include "./line.h"
+#include "./canvas.h"
+#include "./config.h"
+#include "./primitive.h"
+#include "./tile.h"
+#include "./balance.h"
+#include "./writer.h"
+#include "./profile.h"
 #include "./contour/internal.h"
 
 // assign user input to a struct camera_t
@@ -62,6 +71,55 @@ static screen_t init_screen (
   return screen;
 }
 
+// decide the compositing strategy for this frame
+// sort-first sends triangles while sort-last sends pixels,
+//   and thus the one with the smaller amount of data is chosen
+static contour3d_composite_mode_t choose_composite_mode (
+    const MPI_Comm comm,
+    const screen_t * const screen,
+    const primitives_t * const primitives
+) {
+  uint64_t num_triangles = primitives->nitems;
+  CONTOUR3D_TRACE_BEGIN(EVENT_ALLREDUCE);
+  MPI_Allreduce(MPI_IN_PLACE, &num_triangles, 1, MPI_UINT64_T, MPI_SUM, comm);
+  CONTOUR3D_TRACE_END(EVENT_ALLREDUCE);
+  const double triangle_bytes = 1. * num_triangles * sizeof(primitive_t);
+  const double pixel_bytes = 1. * screen->width * screen->height * (sizeof(double) + sizeof(contour3d_color_t));
+  return triangle_bytes < pixel_bytes
+    ? CONTOUR3D_COMPOSITE_SORT_FIRST
+    : CONTOUR3D_COMPOSITE_SORT_LAST;
+}
+
+// check if all processes can afford a full-screen canvas within the memory budget,
+//   together with what the main process needs to output the image
+static bool is_canvas_affordable (
+    const MPI_Comm comm,
+    const screen_t * const screen,
+    const char fname[],
+    const bool has_ids
+) {
+  int myrank = 0;
+  MPI_Comm_rank(comm, &myrank);
+  size_t nbytes = contour3d_canvas_get_size(screen->width * screen->height, has_ids);
+  if (0 == myrank) {
+    nbytes += contour3d_output_get_staging_size(fname, screen->width, screen->height, has_ids);
+  }
+  int is_affordable = nbytes <= contour3d_memory_get_available();
+  MPI_Allreduce(MPI_IN_PLACE, &is_affordable, 1, MPI_INT, MPI_LAND, comm);
+  return is_affordable;
+}
+
+// rasterise the stored triangles
+static int render_primitives (
+    const camera_t * const camera,
+    const contour3d_vector_t * const light,
+    const screen_t * const screen,
+    const primitives_t * const primitives,
+    canvas_t * const canvas
+) {
+  return contour3d_contour_render_primitives(camera, light, screen, 1, &primitives, canvas);
+}
+
 // from a given scalar field (or fields), extract triangle elements
 //   using the marching-tetrahedra algorithm,
 //   and output the result to an image
@@ -84,64 +142,197 @@ int contour3d_execute (
   const camera_t camera = init_camera(camera_position, camera_look_at);
   const contour3d_vector_t light = init_light(light_direction);
   const screen_t screen = init_screen(screen_sizes, screen_center, screen_local);
-  // prepare canvas: pixels (to store colors) and z buffer
-  const size_t width  = screen.width;
-  const size_t height = screen.height;
-  pixel_t * const canvas = contour3d_memory_alloc(width * height, sizeof(pixel_t));
-  if (NULL == canvas) {
-    logger_error("canvas allocation failed");
-    goto abort;
+  const contour3d_config_t * const config = contour3d_config_get();
+  MPI_Comm comm_cart = MPI_COMM_NULL;
+  sdecomp.get_comm_cart(sdecomp_info, &comm_cart);
+  int nprocs = 0;
+  MPI_Comm_size(comm_cart, &nprocs);
+  // an image queued by the previous calls may have failed to be written
+  int retval = 0;
+  if (contour3d_writer_has_failed()) {
+    logger_error("failed to write previous image asynchronously");
+    retval = 1;
+  }
+  // objects are identified by 16-bit ids, 0 being the background
+  const bool has_ids = config->export_depth;
+  if (has_ids && UINT16_MAX <= num_contours + num_lines) {
+    logger_error("too many objects to be identified (%zu)", num_contours + num_lines);
+    return 1;
+  }
+  CONTOUR3D_PROFILE_INIT(comm_cart, num_contours);
+  CONTOUR3D_TRACE_BEGIN(EVENT_FRAME);
+  contour3d_composite_mode_t mode = config->composite_mode;
+  if (screen.height < (size_t)nprocs) {
+    // each process should own at least one row to use sort-first
+    mode = CONTOUR3D_COMPOSITE_SORT_LAST;
+  }
+  if (
+         0 != config->memory_budget
+      && CONTOUR3D_COMPOSITE_SORT_FIRST != mode
+      && (size_t)nprocs <= screen.height
+      && !is_canvas_affordable(comm_cart, &screen, fname, has_ids)
+  ) {
+    // a band is much smaller than the full screen
+    int myrank = 0;
+    MPI_Comm_rank(comm_cart, &myrank);
+    if (0 == myrank) {
+      logger_info("sort-first is used to stay within the memory budget");
+    }
+    mode = CONTOUR3D_COMPOSITE_SORT_FIRST;
   }
-  for (/* each pixel */ size_t n = 0; n < width * height; n++) {
-    pixel_t * const pixel = canvas + n;
-    contour3d_color_t * const color = &pixel->color;
-    double * const depth = &pixel->depth;
-    // fill canvas with the default background color
-    *color = *bg_color;
-    // assign negative infinity as the minimum distance
-    *depth = -1. * DBL_MAX;
+  // triangles are stored and rasterised later
+  //   unless sort-last is specified without load balancing
+  const bool is_deferred = CONTOUR3D_COMPOSITE_SORT_LAST != mode || config->load_balancing;
+  primitives_t primitives = {0};
+  // prepare canvas: pixels (to store colors) and z buffer,
+  //   which covers the full screen under sort-last
+  //   and also takes the stored triangles outgrowing the memory budget
+  canvas_t canvas = {0};
+  contour3d_memory_set_subsystem(CONTOUR3D_MEMORY_CANVAS);
+  if (CONTOUR3D_COMPOSITE_SORT_LAST == mode) {
+    if (0 != contour3d_canvas_init(
+          comm_cart,
+          config->node_aware_compositing,
+          has_ids,
+          screen.width,
+          screen.height,
+          0,
+          bg_color,
+          &canvas
+    )) {
+      logger_error("canvas initialisation failed");
+      goto abort;
+    }
   }
   // process contour objects
+  contour3d_memory_set_subsystem(CONTOUR3D_MEMORY_OTHERS);
   for (/* each contour object */ size_t n = 0; n < num_contours; n++) {
+    CONTOUR3D_PROFILE_SET_OBJECT(n);
     if (0 != contour3d_process_contour_obj(
           sdecomp_info,
           &camera,
           &light,
           &screen,
           contour3d_contour_objs + n,
-          canvas
+          (uint16_t)(n + 1),
+          is_deferred ? &primitives : NULL,
+          &canvas
     )) {
       logger_error("contour processing failed");
       goto abort;
     }
   }
+  // the others are frame-wide
+  CONTOUR3D_PROFILE_SET_OBJECT(num_contours);
+  if (CONTOUR3D_COMPOSITE_AUTO == mode) {
+    mode = choose_composite_mode(comm_cart, &screen, &primitives);
+    if (CONTOUR3D_COMPOSITE_SORT_LAST == mode) {
+      // full-screen canvas, to be composited later
+      contour3d_memory_set_subsystem(CONTOUR3D_MEMORY_CANVAS);
+      if (0 != contour3d_canvas_init(
+            comm_cart,
+            config->node_aware_compositing,
+            has_ids,
+            screen.width,
+            screen.height,
+            0,
+            bg_color,
+            &canvas
+      )) {
+        logger_error("canvas initialisation failed");
+        goto abort;
+      }
+    }
+  }
+  if (is_deferred && CONTOUR3D_COMPOSITE_SORT_LAST == mode) {
+    contour3d_memory_set_subsystem(CONTOUR3D_MEMORY_PRIMITIVES);
+    if (config->load_balancing) {
+      CONTOUR3D_PROFILE_START(CONTOUR3D_PHASE_EXCHANGE);
+      if (0 != contour3d_balance_primitives(comm_cart, &primitives)) {
+        logger_error("load balancing failed");
+        goto abort;
+      }
+      CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_EXCHANGE);
+    }
+    CONTOUR3D_PROFILE_START(CONTOUR3D_PHASE_RASTERISE);
+    if (0 != render_primitives(&camera, &light, &screen, &primitives, &canvas)) {
+      goto abort;
+    }
+    CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_RASTERISE);
+  }
+  if (CONTOUR3D_COMPOSITE_SORT_FIRST == mode) {
+    // canvas covering my band, onto which the triangles
+    //   sent from all processes are rasterised
+    contour3d_memory_set_subsystem(CONTOUR3D_MEMORY_CANVAS);
+    if (0 != contour3d_tile_init_canvas(comm_cart, &screen, has_ids, bg_color, &canvas)) {
+      logger_error("canvas initialisation failed");
+      goto abort;
+    }
+    contour3d_memory_set_subsystem(CONTOUR3D_MEMORY_PRIMITIVES);
+    // triangles are exchanged in several rounds
+    //   when the buffers do not fit in the memory budget at once
+    size_t nrounds = 1;
+    contour3d_tile_get_nrounds(comm_cart, &primitives, &nrounds);
+    for (/* each round */ size_t round = 0; round < nrounds; round++) {
+      const size_t begin = primitives.nitems * (round    ) / nrounds;
+      const size_t end   = primitives.nitems * (round + 1) / nrounds;
+      const primitives_t part = {
+        .nitems = end - begin,
+        .capacity = end - begin,
+        .items = primitives.items + begin,
+      };
+      primitives_t received = {0};
+      CONTOUR3D_PROFILE_START(CONTOUR3D_PHASE_EXCHANGE);
+      if (0 != contour3d_tile_distribute(comm_cart, &camera, &screen, &part, &received)) {
+        logger_error("triangle redistribution failed");
+        goto abort;
+      }
+      CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_EXCHANGE);
+      CONTOUR3D_PROFILE_START(CONTOUR3D_PHASE_RASTERISE);
+      if (0 != render_primitives(&camera, &light, &screen, &received, &canvas)) {
+        goto abort;
+      }
+      CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_RASTERISE);
+      contour3d_primitive_finalise(&received);
+    }
+  }
+  contour3d_primitive_finalise(&primitives);
   // draw lines
+  CONTOUR3D_PROFILE_START(CONTOUR3D_PHASE_LINES);
   for (/* each line object */ size_t n = 0; n < num_lines; n++) {
     if (0 != contour3d_process_line_obj(
           &camera,
           &screen,
           contour3d_line_objs + n,
-          canvas
+          (uint16_t)(num_contours + n + 1),
+          &canvas
     )) {
       logger_error("line processing failed");
       goto abort;
     }
   }
+  CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_LINES);
+  contour3d_memory_set_subsystem(CONTOUR3D_MEMORY_OUTPUT);
   if (0 != contour3d_output_image(
         sdecomp_info,
+        &screen,
         fname,
-        width,
-        height,
-        canvas
+        &canvas
   )) {
     logger_error("image output failed");
     goto abort;
   }
-  contour3d_memory_free(canvas);
-  return 0;
+  contour3d_canvas_finalise(&canvas);
+  // reduce and report the measurements of this frame
+  CONTOUR3D_TRACE_END(EVENT_FRAME);
+  CONTOUR3D_PROFILE_FINALISE(comm_cart);
+  // everything allocated during this frame is no longer needed
+  contour3d_memory_free_all();
+  return retval;
 abort:
-  // error detected, deallocate all internal memory
+  // error detected, close the events of this frame in the timeline
+  //   and deallocate all internal memory
+  CONTOUR3D_PROFILE_ABORT();
   contour3d_memory_free_all();
   return 1;
 }
-
@@ -1,70 +1,624 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
 #include <stdint.h> // SIZE_MAX
+#include <pthread.h>
+#include "contour3d.h"
 #include "./memory.h"
 #include "./logger.h"
+#include "./config.h"
 
-// singly-linked list to store all allocated memory
-typedef struct node_t {
-  void * ptr;
-  struct node_t * next;
-} node_t;
-static node_t * memory = NULL;
+// all internal memory is carved out of per-thread arenas by bumping a pointer
+// everything allocated during a frame is given back at once
+//   by rewinding the arena ("contour3d_memory_free_all"),
+//   while the chunks are kept and reused by the following frames
+// each thread (the main thread, the workers, and the background writer) has its own arena,
+//   and thus no locking is needed to allocate
+// every allocation is attributed to the subsystem which is set at that time,
+//   and the live bytes of all arenas of the process are summed up,
+//   refusing allocations which exceed the memory budget
+// large allocations (e.g. canvases and growing lists of triangles) are obtained from the system
+//   one by one, so that they are given back as soon as they are freed
+//   and are grown without leaving dead copies in the chunks
+
+// alignment of all allocations
+#define ALIGNMENT 16
+// minimum size of a chunk requested from the system
+#define CHUNK_SIZE ((size_t)1 << 20)
+// allocations of this size or more do not live in the chunks
+#define LARGE_SIZE (CHUNK_SIZE / 16)
+
+typedef struct chunk_t {
+  size_t capacity;
+  size_t used;
+  uint8_t * base;
+  struct chunk_t * prev;
+  struct chunk_t * next;
+} chunk_t;
+
+// links of the large allocations of an arena, preceding their headers
+typedef struct large_t {
+  struct large_t * prev;
+  struct large_t * next;
+} large_t;
+
+typedef struct {
+  // all chunks, and the one currently used,
+  //   whose followers are empty
+  chunk_t * head;
+  chunk_t * current;
+  // large allocations which are alive
+  large_t * larges;
+  // bytes in use (in total and by each subsystem), and bytes obtained from the system
+  size_t used;
+  size_t subsystem_used[CONTOUR3D_MEMORY_NSUBSYSTEMS];
+  size_t reserved;
+  // subsystem to which new allocations are attributed
+  contour3d_memory_subsystem_t subsystem;
+} arena_t;
+
+// sums over all arenas of the process, which are limited by the budget,
+//   and their maximums
+typedef struct {
+  pthread_mutex_t mutex;
+  size_t used;
+  size_t peak;
+  size_t reserved;
+  size_t subsystem_used[CONTOUR3D_MEMORY_NSUBSYSTEMS];
+  size_t subsystem_peak[CONTOUR3D_MEMORY_NSUBSYSTEMS];
+} totals_t;
+
+// each allocation is preceded by its size and its subsystem,
+//   so that the last one can be returned or grown
+// NOTE: the size of a large allocation includes its links
+typedef struct {
+  size_t size;
+  uint32_t subsystem;
+  uint32_t is_large;
+} header_t;
+
+static pthread_key_t key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static totals_t totals = {
+  .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// keep track of the memory used by the subsystems
+static void account (
+    arena_t * const arena,
+    const contour3d_memory_subsystem_t subsystem,
+    const size_t nbytes_old,
+    const size_t nbytes_new
+) {
+  arena->used = arena->used - nbytes_old + nbytes_new;
+  arena->subsystem_used[subsystem] = arena->subsystem_used[subsystem] - nbytes_old + nbytes_new;
+  pthread_mutex_lock(&totals.mutex);
+  totals.used = totals.used - nbytes_old + nbytes_new;
+  if (totals.peak < totals.used) {
+    totals.peak = totals.used;
+  }
+  size_t * const used = totals.subsystem_used + subsystem;
+  size_t * const peak = totals.subsystem_peak + subsystem;
+  *used = *used - nbytes_old + nbytes_new;
+  if (*peak < *used) {
+    *peak = *used;
+  }
+  pthread_mutex_unlock(&totals.mutex);
+}
+
+// keep track of the memory obtained from the system for the chunks
+static void account_reserved (
+    arena_t * const arena,
+    const size_t nbytes_old,
+    const size_t nbytes_new
+) {
+  arena->reserved = arena->reserved - nbytes_old + nbytes_new;
+  pthread_mutex_lock(&totals.mutex);
+  totals.reserved = totals.reserved - nbytes_old + nbytes_new;
+  pthread_mutex_unlock(&totals.mutex);
+}
+
+// nothing of the arena is alive any longer
+static void account_rewound (
+    arena_t * const arena
+) {
+  for (size_t n = 0; n < CONTOUR3D_MEMORY_NSUBSYSTEMS; n++) {
+    account(arena, n, arena->subsystem_used[n], 0);
+  }
+}
+
+// give the large allocations back to the system
+static void release_larges (
+    arena_t * const arena
+) {
+  large_t * large = arena->larges;
+  while (large) {
+    large_t * const next = large->next;
+    free(large);
+    large = next;
+  }
+  arena->larges = NULL;
+}
+
+// give all chunks back to the system
+static void release_chunks (
+    arena_t * const arena
+) {
+  release_larges(arena);
+  chunk_t * chunk = arena->head;
+  while (chunk) {
+    chunk_t * const next = chunk->next;
+    free(chunk->base);
+    free(chunk);
+    chunk = next;
+  }
+  arena->head = NULL;
+  arena->current = NULL;
+  account_rewound(arena);
+  account_reserved(arena, arena->reserved, 0);
+}
+
+// give the chunks after the current one, which are empty, back to the system
+static void release_followers (
+    arena_t * const arena
+) {
+  chunk_t * const current = arena->current;
+  if (NULL == current) {
+    return;
+  }
+  chunk_t * chunk = current->next;
+  while (chunk) {
+    chunk_t * const next = chunk->next;
+    account_reserved(arena, chunk->capacity, 0);
+    free(chunk->base);
+    free(chunk);
+    chunk = next;
+  }
+  current->next = NULL;
+}
+
+// called when a thread terminates
+static void destroy_arena (
+    void * const ptr
+) {
+  arena_t * const arena = ptr;
+  release_chunks(arena);
+  free(arena);
+}
+
+static void create_key (
+    void
+) {
+  pthread_key_create(&key, destroy_arena);
+}
+
+// arena of the calling thread, created at the first call
+static arena_t * get_arena (
+    void
+) {
+  pthread_once(&key_once, create_key);
+  arena_t * arena = pthread_getspecific(key);
+  if (NULL == arena) {
+    arena = calloc(1, sizeof(arena_t));
+    if (NULL == arena) {
+      logger_error("failed to allocate arena");
+      return NULL;
+    }
+    arena->subsystem = CONTOUR3D_MEMORY_OTHERS;
+    pthread_setspecific(key, arena);
+  }
+  return arena;
+}
+
+static size_t round_up (
+    const size_t nbytes
+) {
+  return (nbytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+// a chunk which has "nbytes" free bytes,
+//   which is the current one, one of the (empty) followers, or a new one
+static chunk_t * find_chunk (
+    arena_t * const arena,
+    const size_t nbytes
+) {
+  chunk_t * chunk = arena->current;
+  if (NULL != chunk && nbytes <= chunk->capacity - chunk->used) {
+    return chunk;
+  }
+  while (NULL != chunk && NULL != chunk->next) {
+    chunk = chunk->next;
+    chunk->used = 0;
+    if (nbytes <= chunk->capacity) {
+      arena->current = chunk;
+      return chunk;
+    }
+  }
+  // nothing fits, append a new chunk
+  const size_t capacity = nbytes < CHUNK_SIZE ? CHUNK_SIZE : nbytes;
+  const size_t budget = contour3d_config_get()->memory_budget;
+  if (0 != budget && budget < arena->reserved + capacity) {
+    // give back the (empty) chunks which are too small to be used
+    release_followers(arena);
+    chunk = arena->current;
+  }
+  chunk_t * const new_chunk = malloc(sizeof(chunk_t));
+  uint8_t * const base = malloc(capacity);
+  if (NULL == new_chunk || NULL == base) {
+    logger_error("failed to allocate memory (%zu)", capacity);
+    free(new_chunk);
+    free(base);
+    return NULL;
+  }
+  new_chunk->capacity = capacity;
+  new_chunk->used = 0;
+  new_chunk->base = base;
+  new_chunk->prev = chunk;
+  new_chunk->next = NULL;
+  if (NULL == chunk) {
+    arena->head = new_chunk;
+  } else {
+    chunk->next = new_chunk;
+  }
+  arena->current = new_chunk;
+  account_reserved(arena, 0, capacity);
+  return new_chunk;
+}
+
+// check if "nbytes" more bytes are within the budget
+static bool is_affordable (
+    const size_t nbytes
+) {
+  const size_t budget = contour3d_config_get()->memory_budget;
+  pthread_mutex_lock(&totals.mutex);
+  const size_t used = totals.used;
+  pthread_mutex_unlock(&totals.mutex);
+  if (0 == budget || used + nbytes <= budget) {
+    return true;
+  }
+  logger_error(
+      "memory budget exceeded (%zu in use, %zu requested, %zu allowed)",
+      used, nbytes, budget
+  );
+  return false;
+}
+
+// true if the allocation is the last one of the arena
+static bool is_last (
+    const arena_t * const arena,
+    const header_t * const header
+) {
+  const chunk_t * const chunk = arena->current;
+  return NULL != chunk && (const uint8_t *)header + header->size == chunk->base + chunk->used;
+}
+
+// header of a large allocation
+static header_t * get_large_header (
+    large_t * const large
+) {
+  return (header_t *)(large + 1);
+}
+
+static large_t * get_large (
+    header_t * const header
+) {
+  return (large_t *)header - 1;
+}
+
+// obtain "nbytes" (including the links and the header) from the system
+static void * alloc_large (
+    arena_t * const arena,
+    const size_t nbytes
+) {
+  if (!is_affordable(nbytes)) {
+    return NULL;
+  }
+  large_t * const large = malloc(nbytes);
+  if (NULL == large) {
+    logger_error("failed to allocate memory (%zu)", nbytes);
+    return NULL;
+  }
+  large->prev = NULL;
+  large->next = arena->larges;
+  if (NULL != arena->larges) {
+    arena->larges->prev = large;
+  }
+  arena->larges = large;
+  header_t * const header = get_large_header(large);
+  header->size = nbytes;
+  header->subsystem = arena->subsystem;
+  header->is_large = true;
+  account(arena, arena->subsystem, 0, nbytes);
+  return header + 1;
+}
+
+// resize a large allocation to "nbytes" (including the links and the header),
+//   which stays large even when it shrinks
+static void * realloc_large (
+    arena_t * const arena,
+    header_t * const header,
+    const size_t nbytes
+) {
+  if (header->size < nbytes && !is_affordable(nbytes - header->size)) {
+    return NULL;
+  }
+  large_t * const large = realloc(get_large(header), nbytes);
+  if (NULL == large) {
+    logger_error("failed to allocate memory (%zu)", nbytes);
+    return NULL;
+  }
+  // the links of the neighbours follow the moved block
+  if (NULL == large->prev) {
+    arena->larges = large;
+  } else {
+    large->prev->next = large;
+  }
+  if (NULL != large->next) {
+    large->next->prev = large;
+  }
+  header_t * const new_header = get_large_header(large);
+  account(arena, new_header->subsystem, new_header->size, nbytes);
+  new_header->size = nbytes;
+  return new_header + 1;
+}
+
+static void free_large (
+    arena_t * const arena,
+    header_t * const header
+) {
+  large_t * const large = get_large(header);
+  if (NULL == large->prev) {
+    arena->larges = large->next;
+  } else {
+    large->prev->next = large->next;
+  }
+  if (NULL != large->next) {
+    large->next->prev = large->prev;
+  }
+  account(arena, header->subsystem, header->size, 0);
+  free(large);
+}
 
 void * contour3d_memory_alloc (
     const size_t nitems,
     const size_t size
 ) {
-  if (SIZE_MAX / nitems < size) {
+  if (0 != nitems && (SIZE_MAX - sizeof(header_t) - ALIGNMENT) / nitems < size) {
     logger_error("request too much memory (%zu x %zu)\n", nitems, size);
     return NULL;
   }
-  void * const ptr = malloc(nitems * size);
+  arena_t * const arena = get_arena();
+  if (NULL == arena) {
+    return NULL;
+  }
+  const size_t nbytes = sizeof(header_t) + round_up(nitems * size);
+  if (LARGE_SIZE <= nbytes) {
+    return alloc_large(arena, sizeof(large_t) + nbytes);
+  }
+  if (!is_affordable(nbytes)) {
+    return NULL;
+  }
+  chunk_t * const chunk = find_chunk(arena, nbytes);
+  if (NULL == chunk) {
+    return NULL;
+  }
+  header_t * const header = (header_t *)(chunk->base + chunk->used);
+  header->size = nbytes;
+  header->subsystem = arena->subsystem;
+  header->is_large = false;
+  chunk->used += nbytes;
+  account(arena, arena->subsystem, 0, nbytes);
+  return header + 1;
+}
+
+// resize the given memory, which is done in place if it is the last allocation
+void * contour3d_memory_realloc (
+    void * const ptr,
+    const size_t nitems,
+    const size_t size
+) {
   if (NULL == ptr) {
-    logger_error("failed to allocate memory (%zu)\n", nitems * size);
+    return contour3d_memory_alloc(nitems, size);
+  }
+  arena_t * const arena = get_arena();
+  if (NULL == arena) {
     return NULL;
   }
-  node_t * const node = malloc(1 * sizeof(node_t));
-  if (NULL == node) {
-    logger_error("failed to allocate memory (%zu)\n", sizeof(node_t));
+  header_t * const header = (header_t *)ptr - 1;
+  if (0 != nitems && (SIZE_MAX - sizeof(header_t) - ALIGNMENT) / nitems < size) {
+    logger_error("request too much memory (%zu x %zu)\n", nitems, size);
     return NULL;
   }
-  node->ptr = ptr;
-  node->next = memory;
-  memory = node;
-  return ptr;
+  const size_t nbytes = sizeof(header_t) + round_up(nitems * size);
+  const contour3d_memory_subsystem_t subsystem = header->subsystem;
+  if (header->is_large) {
+    return realloc_large(arena, header, sizeof(large_t) + nbytes);
+  }
+  if (is_last(arena, header)) {
+    chunk_t * const chunk = arena->current;
+    const size_t used = chunk->used - header->size;
+    if (nbytes <= chunk->capacity - used) {
+      if (header->size < nbytes && !is_affordable(nbytes - header->size)) {
+        return NULL;
+      }
+      chunk->used = used + nbytes;
+      account(arena, subsystem, header->size, nbytes);
+      header->size = nbytes;
+      return ptr;
+    }
+  }
+  // the new memory belongs to the same subsystem
+  const contour3d_memory_subsystem_t current = contour3d_memory_set_subsystem(subsystem);
+  void * const new_ptr = contour3d_memory_alloc(nitems, size);
+  contour3d_memory_set_subsystem(current);
+  if (NULL == new_ptr) {
+    return NULL;
+  }
+  const size_t old_size = header->size - sizeof(header_t);
+  const size_t new_size = nbytes - sizeof(header_t);
+  memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+  contour3d_memory_free(ptr);
+  return new_ptr;
 }
 
+// only the last allocation in the chunks is actually returned,
+//   the others are kept until the arena is rewound,
+//   while large allocations are always given back
+// NOTE: the memory is no longer counted as used in any case
 int contour3d_memory_free (
     void * const ptr
 ) {
   if (NULL == ptr) {
     return 0;
   }
-  node_t ** node = &memory;
-  while (*node) {
-    if (ptr == (*node)->ptr) {
-      node_t * const node_next = (*node)->next;
-      free(*node);
-      free(ptr);
-      *node = node_next;
-      return 0;
+  arena_t * const arena = get_arena();
+  if (NULL == arena) {
+    return 1;
+  }
+  header_t * const header = (header_t *)ptr - 1;
+  if (header->is_large) {
+    free_large(arena, header);
+    return 0;
+  }
+  account(arena, header->subsystem, header->size, 0);
+  if (is_last(arena, header)) {
+    arena->current->used -= header->size;
+    // step back over the emptied chunks,
+    //   so that the allocations before them can also be returned
+    while (0 == arena->current->used && NULL != arena->current->prev) {
+      arena->current = arena->current->prev;
     }
-    node = &(*node)->next;
   }
-  logger_error("this memory is not allocated");
-  return 1;
+  return 0;
 }
 
+// rewind the arena of the calling thread,
+//   which is done at the end of each frame or when an error is detected
 int contour3d_memory_free_all (
     void
 ) {
-  while (memory) {
-    node_t * const next = memory->next;
-    free(memory->ptr);
-    free(memory);
-    memory = next;
+  arena_t * const arena = get_arena();
+  if (NULL == arena) {
+    return 1;
   }
+  release_larges(arena);
+  arena->current = arena->head;
+  if (NULL != arena->head) {
+    arena->head->used = 0;
+  }
+  account_rewound(arena);
+  arena->subsystem = CONTOUR3D_MEMORY_OTHERS;
+  // retained memory beyond the budget is given back
+  const size_t budget = contour3d_config_get()->memory_budget;
+  if (0 != budget && budget < arena->reserved) {
+    release_chunks(arena);
+  }
+  return 0;
+}
+
+// attribute the following allocations to the given subsystem,
+//   returning the previous one to be restored later
+contour3d_memory_subsystem_t contour3d_memory_set_subsystem (
+    const contour3d_memory_subsystem_t subsystem
+) {
+  arena_t * const arena = get_arena();
+  if (NULL == arena) {
+    return CONTOUR3D_MEMORY_OTHERS;
+  }
+  const contour3d_memory_subsystem_t previous = arena->subsystem;
+  arena->subsystem = subsystem;
+  return previous;
+}
+
+// bytes which an allocation of "nitems" x "size" takes from the budget,
+//   including its header (and links)
+size_t contour3d_memory_get_footprint (
+    const size_t nitems,
+    const size_t size
+) {
+  const size_t nbytes = sizeof(header_t) + round_up(nitems * size);
+  return LARGE_SIZE <= nbytes ? sizeof(large_t) + nbytes : nbytes;
+}
+
+// bytes which can still be allocated within the budget by the process
+size_t contour3d_memory_get_available (
+    void
+) {
+  const size_t budget = contour3d_config_get()->memory_budget;
+  if (0 == budget) {
+    return SIZE_MAX;
+  }
+  pthread_mutex_lock(&totals.mutex);
+  const size_t used = totals.used;
+  pthread_mutex_unlock(&totals.mutex);
+  return used < budget ? budget - used : 0;
+}
+
+// attribute "nbytes" held outside the arenas (e.g. by "malloc") to the subsystem,
+//   provided that they are within the budget
+// NOTE: nothing is reported, since the caller may wait and try again
+int contour3d_memory_charge (
+    const contour3d_memory_subsystem_t subsystem,
+    const size_t nbytes
+) {
+  const size_t budget = contour3d_config_get()->memory_budget;
+  pthread_mutex_lock(&totals.mutex);
+  if (0 != budget && budget < totals.used + nbytes) {
+    pthread_mutex_unlock(&totals.mutex);
+    return 1;
+  }
+  totals.used += nbytes;
+  if (totals.peak < totals.used) {
+    totals.peak = totals.used;
+  }
+  totals.subsystem_used[subsystem] += nbytes;
+  if (totals.subsystem_peak[subsystem] < totals.subsystem_used[subsystem]) {
+    totals.subsystem_peak[subsystem] = totals.subsystem_used[subsystem];
+  }
+  pthread_mutex_unlock(&totals.mutex);
+  return 0;
+}
+
+// the bytes charged to the subsystem are given back
+int contour3d_memory_discharge (
+    const contour3d_memory_subsystem_t subsystem,
+    const size_t nbytes
+) {
+  pthread_mutex_lock(&totals.mutex);
+  totals.used -= nbytes;
+  totals.subsystem_used[subsystem] -= nbytes;
+  pthread_mutex_unlock(&totals.mutex);
   return 0;
 }
 
+// give the chunks of the calling thread back to the system
+int contour3d_memory_release (
+    void
+) {
+  arena_t * const arena = get_arena();
+  if (NULL == arena) {
+    return 1;
+  }
+  release_chunks(arena);
+  return 0;
+}
+
+int contour3d_get_memory_stats (
+    contour3d_memory_stats_t * const stats
+) {
+  if (NULL == stats) {
+    logger_error("memory statistics are not given");
+    return 1;
+  }
+  pthread_mutex_lock(&totals.mutex);
+  stats->current = totals.used;
+  stats->peak = totals.peak;
+  stats->reserved = totals.reserved;
+  for (size_t n = 0; n < CONTOUR3D_MEMORY_NSUBSYSTEMS; n++) {
+    stats->subsystem_current[n] = totals.subsystem_used[n];
+    stats->subsystem_peak[n] = totals.subsystem_peak[n];
+  }
+  pthread_mutex_unlock(&totals.mutex);
+  return 0;
+}
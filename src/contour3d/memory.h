@@ -1,11 +1,20 @@
 #if !defined(CONTOUR3D_MEMORY_H)
 #define CONTOUR3D_MEMORY_H
 
+#include <stddef.h>
+#include "contour3d.h"
+
 extern void * contour3d_memory_alloc (
     const size_t nitems,
     const size_t size
 );
 
+extern void * contour3d_memory_realloc (
+    void * ptr,
+    const size_t nitems,
+    const size_t size
+);
+
 extern int contour3d_memory_free (
     void * ptr
 );
@@ -14,4 +23,31 @@ extern int contour3d_memory_free_all (
     void
 );
 
+extern int contour3d_memory_release (
+    void
+);
+
+extern contour3d_memory_subsystem_t contour3d_memory_set_subsystem (
+    const contour3d_memory_subsystem_t subsystem
+);
+
+extern size_t contour3d_memory_get_available (
+    void
+);
+
+extern size_t contour3d_memory_get_footprint (
+    const size_t nitems,
+    const size_t size
+);
+
+extern int contour3d_memory_charge (
+    const contour3d_memory_subsystem_t subsystem,
+    const size_t nbytes
+);
+
+extern int contour3d_memory_discharge (
+    const contour3d_memory_subsystem_t subsystem,
+    const size_t nbytes
+);
+
 #endif // CONTOUR3D_MEMORY_H
@@ -1,151 +1,471 @@
 #include <stdio.h>
+#include <stdbool.h>
 #include <string.h>
 #include <errno.h>
 #include <mpi.h>
 #include "./struct.h"
 #include "./memory.h"
 #include "./logger.h"
+#include "./canvas.h"
+#include "./composite.h"
+#include "./config.h"
+#include "./writer.h"
+#include "./stream.h"
+#include "./pool.h"
+#include "./depth.h"
+#include "./profile.h"
 #include "./output.h"
+#include "./encode/internal.h"
+#include "./contour/internal.h"
 
-static void reduction_func (
-    void * const void_invec,
-    void * const void_inoutvec,
-    int * const len,
-    MPI_Datatype * const datatype
+// pack colors of "nrows" rows of the canvas from the "jmin"-th one from the top
+//   to a buffer (rgb for each pixel), in the order of the image file
+static void pack_rows (
+    const canvas_t * const canvas,
+    const size_t jmin,
+    const size_t nrows,
+    uint8_t * const buffer
 ) {
-  if (MPI_DATATYPE_NULL == *datatype) {
-    // to suppress -Wunused-parameter warning
-    return;
-  }
-  const pixel_t * const invec = void_invec;
-  pixel_t * const inoutvec = void_inoutvec;
-  for (int index = 0; index < *len; index++) {
-    const pixel_t * const inpixel = invec + index;
-    pixel_t * const inoutpixel = inoutvec + index;
-    // take out the nearest pixel
-    if (inoutpixel->depth < inpixel->depth) {
-      *inoutpixel = *inpixel;
+  const size_t width  = canvas->width;
+  const size_t height = canvas->height;
+  for (size_t cnt = 0, j = jmin; j < jmin + nrows; j++) {
+    for (size_t i = 0; i < width; i++) {
+      // flip in y
+      const size_t index = (height - j - 1) * width + i;
+      const contour3d_color_t * const color = canvas->colors + index;
+      buffer[cnt++] = color->r;
+      buffer[cnt++] = color->g;
+      buffer[cnt++] = color->b;
     }
   }
 }
 
-static int extract_nearest (
-    const int myrank,
+// number of rows which are encoded at once
+#define BLOCK_ROWS 64
+
+// bytes which the main process allocates on top of the canvas to output a whole image,
+//   i.e. the row blocks being packed and encoded (the depths and the stream need less),
+//   and the copy handed to the background writer if any
+size_t contour3d_output_get_staging_size (
+    const char fname[],
     const size_t width,
     const size_t height,
-    pixel_t * const canvas
+    const bool has_ids
 ) {
-  const size_t nitems = width * height;
-  // create a datatype to store pixel_t
-  MPI_Datatype color_type = MPI_DATATYPE_NULL;
-  MPI_Datatype pixel_type = MPI_DATATYPE_NULL;
-  // create a sub-type for contour3d_color_t first
-  MPI_Type_create_struct(
-      1,
-      (int []) {3},
-      (MPI_Aint []) {
-        offsetof(contour3d_color_t, r),
-        offsetof(contour3d_color_t, g),
-        offsetof(contour3d_color_t, b),
-      },
-      (MPI_Datatype []) {
-        MPI_UNSIGNED_CHAR,
-        MPI_UNSIGNED_CHAR,
-        MPI_UNSIGNED_CHAR,
-      },
-      &color_type
-  );
-  MPI_Type_commit(&color_type);
-  // create a main type for pixel_t
-  MPI_Type_create_struct(
-      2,
-      (int []) {1, 1},
-      (MPI_Aint []) {
-        offsetof(pixel_t, depth),
-        offsetof(pixel_t, color),
-      },
-      (MPI_Datatype []) {
-        MPI_DOUBLE,
-        color_type,
-      },
-      &pixel_type
-  );
-  MPI_Type_commit(&pixel_type);
-  // define original reduction operation to
-  //   communicate the nearest pixel information
-  MPI_Op op = MPI_OP_NULL;
-  MPI_Op_create(reduction_func, 1, &op);
-  // gather result to the main process
-  const int root = 0;
-  const void * const sendbuf = root == myrank ? MPI_IN_PLACE : canvas;
-  void * const recvbuf = canvas;
-  MPI_Reduce(sendbuf, recvbuf, nitems, pixel_type, op, root, MPI_COMM_WORLD);
-  // clean-up
-  MPI_Type_free(&pixel_type);
-  MPI_Type_free(&color_type);
-  MPI_Op_free(&op);
-  return 0;
+  const contour3d_config_t * const config = contour3d_config_get();
+  size_t nbytes = 0;
+  if (NULL != fname) {
+    const image_format_t format = contour3d_encode_get_format(fname);
+    nbytes += 3 * width * BLOCK_ROWS + contour3d_encode_bound(format, width, BLOCK_ROWS) + ENCODE_HEADER_SIZE;
+  } else if (CONTOUR3D_STREAM_NONE != config->stream_format) {
+    nbytes += 3 * width * BLOCK_ROWS;
+  }
+  if (config->async_output) {
+    nbytes += contour3d_writer_get_job_size(width * height, has_ids);
+  }
+  return nbytes;
 }
 
-int contour3d_output_image (
-    const sdecomp_info_t * const sdecomp_info,
+// encode the rows (from top to bottom) and dump them to a file
+static int write_file (
     const char fname[],
-    const size_t width,
-    const size_t height,
-    pixel_t * const canvas
+    const canvas_t * const canvas
 ) {
-  int myrank = 0;
-  sdecomp.get_comm_rank(sdecomp_info, &myrank);
-  // communicate among all processes to obtain the nearest pixel color
-  // the result is only held by the main process
-  extract_nearest(myrank, width, height, canvas);
-  if (0 != myrank) {
-    return 0;
-  }
-  // pack all to a buffer (rgb for each pixel)
-  const size_t nitems = width * height;
-  const size_t size = 3 * sizeof(uint8_t);
-  uint8_t * const buffer = contour3d_memory_alloc(nitems, size);
-  if (NULL == buffer) {
+  const size_t width  = canvas->width;
+  const size_t height = canvas->height;
+  const image_format_t format = contour3d_encode_get_format(fname);
+  uint8_t * const rgb = contour3d_memory_alloc(3 * width * BLOCK_ROWS, sizeof(uint8_t));
+  uint8_t * const buffer = contour3d_memory_alloc(
+      contour3d_encode_bound(format, width, BLOCK_ROWS) + ENCODE_HEADER_SIZE,
+      sizeof(uint8_t)
+  );
+  if (NULL == rgb || NULL == buffer) {
     logger_error("failed to allocate image buffer");
+    contour3d_memory_free(buffer);
+    contour3d_memory_free(rgb);
     return 1;
   }
-  for (size_t cnt = 0, j = 0; j < height; j++) {
-    for (size_t i = 0; i < width; i++) {
-      // flip in y
-      const size_t index = (height - j - 1) * width + i;
-      const pixel_t * const pixel = canvas + index;
-      const contour3d_color_t * const color = &pixel->color;
-      buffer[cnt++] = color->r;
-      buffer[cnt++] = color->g;
-      buffer[cnt++] = color->b;
-    }
-  }
-  // dump a ppm file
   errno = 0;
   FILE * const fp = fopen(fname, "w");
   if (NULL == fp) {
     logger_error("%s: %s", fname, strerror(errno));
+    contour3d_memory_free(buffer);
+    contour3d_memory_free(rgb);
     return 1;
   }
   // header
-  errno = 0;
-  fprintf(fp, "P6\n%zu %zu\n255\n", width, height);
-  if (0 != errno) {
-    logger_error("%s: %s", fname, strerror(errno));
+  size_t size = 0;
+  contour3d_encode_header(format, width, height, buffer, &size);
+  if (size != fwrite(buffer, sizeof(uint8_t), size, fp)) {
+    logger_error("%s: failed to write header", fname);
     fclose(fp);
+    contour3d_memory_free(buffer);
+    contour3d_memory_free(rgb);
     return 1;
   }
-  // contents
-  const size_t retval = fwrite(buffer, size, nitems, fp);
-  if (nitems != retval) {
-    logger_error("fwrite failed (%zu expected, %zu returned)\n", nitems, retval);
+  // contents, packed, encoded, and written for each row block
+  block_info_t info = {.length = 0, .adler = 1};
+  for (size_t j = 0; j < height; j += BLOCK_ROWS) {
+    const size_t nrows = j + BLOCK_ROWS < height ? BLOCK_ROWS : height - j;
+    pack_rows(canvas, j, nrows, rgb);
+    block_info_t block_info = {0};
+    if (0 != contour3d_encode_block(format, width, nrows, rgb, buffer, &size, &block_info)) {
+      logger_error("%s: failed to encode image", fname);
+      fclose(fp);
+      contour3d_memory_free(buffer);
+      contour3d_memory_free(rgb);
+      return 1;
+    }
+    const size_t retval = fwrite(buffer, sizeof(uint8_t), size, fp);
+    if (size != retval) {
+      logger_error("fwrite failed (%zu expected, %zu returned)\n", size, retval);
+      fclose(fp);
+      contour3d_memory_free(buffer);
+      contour3d_memory_free(rgb);
+      return 1;
+    }
+    info = contour3d_encode_combine(&info, &block_info);
+  }
+  // trailer
+  contour3d_encode_trailer(format, &info, buffer, &size);
+  if (size != fwrite(buffer, sizeof(uint8_t), size, fp)) {
+    logger_error("%s: failed to write trailer", fname);
     fclose(fp);
+    contour3d_memory_free(buffer);
+    contour3d_memory_free(rgb);
     return 1;
   }
   fclose(fp);
   // clean-up
   contour3d_memory_free(buffer);
+  contour3d_memory_free(rgb);
   return 0;
 }
 
+// the main process, holding the whole image,
+//   dumps it to a file and / or appends it to the stream
+// NOTE: this is also called by the background writer,
+//   and thus should not call MPI functions
+int contour3d_output_write_serial (
+    const char fname[],
+    const bool is_streamed,
+    const canvas_t * const canvas
+) {
+  if (NULL != fname) {
+    if (0 != write_file(fname, canvas)) {
+      return 1;
+    }
+    if (NULL != canvas->ids) {
+      char * const zname = contour3d_depth_get_fname(fname);
+      if (NULL == zname || 0 != contour3d_depth_write_serial(zname, canvas)) {
+        contour3d_memory_free(zname);
+        return 1;
+      }
+      contour3d_memory_free(zname);
+    }
+  }
+  if (is_streamed) {
+    if (0 != contour3d_stream_write(canvas->width, canvas->height, canvas->colors)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// all processes, holding disjoint row bands of the image,
+//   encode their parts and write them to the same file collectively
+static int write_parallel (
+    const MPI_Comm comm,
+    const screen_t * const screen,
+    const char fname[],
+    const canvas_t * const canvas
+) {
+  int nprocs = 0;
+  int myrank = 0;
+  MPI_Comm_size(comm, &nprocs);
+  MPI_Comm_rank(comm, &myrank);
+  const size_t width  = screen->width;
+  const size_t height = screen->height;
+  const image_format_t format = contour3d_encode_get_format(fname);
+  // my band is stored from the bottom, while the file is from the top
+  uint8_t * const rgb = contour3d_memory_alloc(3 * width * canvas->height, sizeof(uint8_t));
+  uint8_t * const buffer = contour3d_memory_alloc(
+      contour3d_encode_bound(format, width, canvas->height),
+      sizeof(uint8_t)
+  );
+  uint64_t * const summaries = contour3d_memory_alloc(3 * nprocs, sizeof(uint64_t));
+  if (NULL == rgb || NULL == buffer || NULL == summaries) {
+    logger_error("failed to allocate image buffer");
+    contour3d_memory_free(summaries);
+    contour3d_memory_free(buffer);
+    contour3d_memory_free(rgb);
+    return 1;
+  }
+  pack_rows(canvas, 0, canvas->height, rgb);
+  size_t size = 0;
+  block_info_t block_info = {0};
+  if (0 != contour3d_encode_block(format, width, canvas->height, rgb, buffer, &size, &block_info)) {
+    logger_error("%s: failed to encode image", fname);
+    contour3d_memory_free(summaries);
+    contour3d_memory_free(buffer);
+    contour3d_memory_free(rgb);
+    return 1;
+  }
+  // share the sizes of the encoded blocks to decide where they go
+  CONTOUR3D_TRACE_BEGIN(EVENT_ALLGATHER);
+  MPI_Allgather(
+      (uint64_t [3]) {size, block_info.length, block_info.adler}, 3, MPI_UINT64_T,
+      summaries, 3, MPI_UINT64_T,
+      comm
+  );
+  CONTOUR3D_TRACE_END(EVENT_ALLGATHER);
+  uint8_t header[ENCODE_HEADER_SIZE] = {0};
+  size_t header_size = 0;
+  contour3d_encode_header(format, width, height, header, &header_size);
+  // the band of the last process comes first in the file
+  MPI_Offset offset = header_size;
+  for (int rank = nprocs - 1; myrank < rank; rank--) {
+    offset += summaries[3 * rank];
+  }
+  MPI_File fh = MPI_FILE_NULL;
+  int error = MPI_File_open(comm, fname, MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &fh);
+  if (MPI_SUCCESS != error) {
+    char string[MPI_MAX_ERROR_STRING] = {'\0'};
+    int length = 0;
+    MPI_Error_string(error, string, &length);
+    logger_error("%s: %s", fname, string);
+    contour3d_memory_free(summaries);
+    contour3d_memory_free(buffer);
+    contour3d_memory_free(rgb);
+    return 1;
+  }
+  // discard the previous contents
+  MPI_File_set_size(fh, 0);
+  if (0 == myrank) {
+    // the main process has the last band and thus writes the trailer as well
+    block_info_t info = {.length = 0, .adler = 1};
+    for (int rank = nprocs - 1; 0 <= rank; rank--) {
+      const block_info_t block_info = {
+        .length = summaries[3 * rank + 1],
+        .adler = summaries[3 * rank + 2],
+      };
+      info = contour3d_encode_combine(&info, &block_info);
+    }
+    uint8_t trailer[ENCODE_HEADER_SIZE] = {0};
+    size_t trailer_size = 0;
+    contour3d_encode_trailer(format, &info, trailer, &trailer_size);
+    error |= MPI_File_write_at(fh, 0, header, header_size, MPI_BYTE, MPI_STATUS_IGNORE);
+    error |= MPI_File_write_at(fh, offset + size, trailer, trailer_size, MPI_BYTE, MPI_STATUS_IGNORE);
+  }
+  CONTOUR3D_TRACE_BEGIN(EVENT_FILE_WRITE);
+  error |= MPI_File_write_at_all(fh, offset, buffer, size, MPI_BYTE, MPI_STATUS_IGNORE);
+  CONTOUR3D_TRACE_END(EVENT_FILE_WRITE);
+  MPI_File_close(&fh);
+  contour3d_memory_free(summaries);
+  contour3d_memory_free(buffer);
+  contour3d_memory_free(rgb);
+  if (MPI_SUCCESS != error) {
+    logger_error("%s: failed to write image", fname);
+    return 1;
+  }
+  return 0;
+}
+
+// give the composited image to the caller
+static int hand_over (
+    const canvas_t * const canvas
+) {
+  const contour3d_config_t * const config = contour3d_config_get();
+  if (NULL == config->frame_callback) {
+    return 0;
+  }
+  const contour3d_framebuffer_t framebuffer = {
+    .width = canvas->width,
+    .height = canvas->height,
+    .offset = canvas->offset,
+    .colors = canvas->colors,
+    .depths = canvas->depths,
+    .ids = canvas->ids,
+  };
+  if (0 != config->frame_callback(&framebuffer, config->frame_callback_data)) {
+    logger_error("frame callback failed");
+    return 1;
+  }
+  return 0;
+}
+
+// collect the colors of all bands to the main process,
+//   which are stored to a colors-only canvas
+static int gather_bands (
+    const MPI_Comm comm,
+    const screen_t * const screen,
+    const canvas_t * const canvas,
+    canvas_t * const gathered
+) {
+  int nprocs = 0;
+  int myrank = 0;
+  MPI_Comm_size(comm, &nprocs);
+  MPI_Comm_rank(comm, &myrank);
+  const size_t width  = screen->width;
+  const size_t height = screen->height;
+  int * const counts = contour3d_memory_alloc(nprocs, sizeof(int));
+  int * const displs = contour3d_memory_alloc(nprocs, sizeof(int));
+  if (NULL == counts || NULL == displs) {
+    logger_error("failed to allocate gather counts");
+    contour3d_memory_free(displs);
+    contour3d_memory_free(counts);
+    return 1;
+  }
+  // bands are ordered from the bottom, as well as the rows of a canvas
+  for (int rank = 0; rank < nprocs; rank++) {
+    const size_t jmin = height * (rank + 0) / nprocs;
+    const size_t jmax = height * (rank + 1) / nprocs;
+    counts[rank] = 3 * width * (jmax - jmin);
+    displs[rank] = 3 * width * jmin;
+  }
+  *gathered = (canvas_t){
+    .width = width,
+    .height = height,
+    .offset = 0,
+    .is_partitioned = false,
+    .depths = NULL,
+    .ids = NULL,
+    .colors = NULL,
+    .comm_node = MPI_COMM_NULL,
+    .comm_leaders = MPI_COMM_NULL,
+    .win = MPI_WIN_NULL,
+  };
+  if (0 == myrank) {
+    gathered->colors = contour3d_memory_alloc(width * height, sizeof(contour3d_color_t));
+    if (NULL == gathered->colors) {
+      logger_error("failed to allocate image buffer");
+      contour3d_memory_free(displs);
+      contour3d_memory_free(counts);
+      return 1;
+    }
+  }
+  CONTOUR3D_TRACE_BEGIN(EVENT_GATHERV);
+  MPI_Gatherv(
+      canvas->colors, 3 * width * canvas->height, MPI_BYTE,
+      gathered->colors, counts, displs, MPI_BYTE,
+      0, comm
+  );
+  CONTOUR3D_TRACE_END(EVENT_GATHERV);
+  contour3d_memory_free(counts);
+  contour3d_memory_free(displs);
+  return 0;
+}
+
+// the main process writes the whole image to a file and / or the stream,
+//   either now or in the background
+static int write_whole (
+    const char fname[],
+    canvas_t * const canvas
+) {
+  const contour3d_config_t * const config = contour3d_config_get();
+  const bool is_streamed = CONTOUR3D_STREAM_NONE != config->stream_format;
+  if (is_streamed && !contour3d_stream_is_open()) {
+    if (0 != contour3d_stream_open(config, canvas->width, canvas->height)) {
+      logger_error("failed to open stream");
+      return 1;
+    }
+  }
+  if (NULL == fname && !is_streamed) {
+    return 0;
+  }
+  if (config->async_output) {
+    // encoding and writing are left to the background thread
+    return contour3d_writer_push(fname, is_streamed, canvas);
+  }
+  return contour3d_output_write_serial(fname, is_streamed, canvas);
+}
+
+int contour3d_output_image (
+    const sdecomp_info_t * const sdecomp_info,
+    const screen_t * const screen,
+    const char fname[],
+    canvas_t * const canvas
+) {
+  MPI_Comm comm_cart = MPI_COMM_NULL;
+  sdecomp.get_comm_cart(sdecomp_info, &comm_cart);
+  int myrank = 0;
+  sdecomp.get_comm_rank(sdecomp_info, &myrank);
+  if (canvas->is_partitioned) {
+    // each process owns image rows, which are given to the caller
+    //   and are written in parallel
+    CONTOUR3D_PROFILE_START(CONTOUR3D_PHASE_WRITE);
+    if (0 != hand_over(canvas)) {
+      return 1;
+    }
+    if (NULL != fname) {
+      if (0 != write_parallel(comm_cart, screen, fname, canvas)) {
+        return 1;
+      }
+      if (NULL != canvas->ids) {
+        char * const zname = contour3d_depth_get_fname(fname);
+        if (NULL == zname || 0 != contour3d_depth_write_parallel(comm_cart, screen, zname, canvas)) {
+          contour3d_memory_free(zname);
+          return 1;
+        }
+        contour3d_memory_free(zname);
+      }
+    }
+    if (CONTOUR3D_STREAM_NONE == contour3d_config_get()->stream_format) {
+      CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_WRITE);
+      return 0;
+    }
+    // the stream is written by the main process, which needs all rows
+    canvas_t gathered = {0};
+    if (0 != gather_bands(comm_cart, screen, canvas, &gathered)) {
+      return 1;
+    }
+    if (0 != myrank) {
+      CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_WRITE);
+      return 0;
+    }
+    const int retval = write_whole(NULL, &gathered);
+    contour3d_memory_free(gathered.colors);
+    CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_WRITE);
+    return retval;
+  }
+  // communicate among all processes to obtain the nearest pixel color
+  // the result is only held by the main process
+  CONTOUR3D_PROFILE_START(CONTOUR3D_PHASE_COMPOSITE);
+  if (0 != contour3d_composite(sdecomp_info, canvas)) {
+    logger_error("failed to composite canvases");
+    return 1;
+  }
+  CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_COMPOSITE);
+  if (0 != myrank) {
+    return 0;
+  }
+  CONTOUR3D_PROFILE_START(CONTOUR3D_PHASE_WRITE);
+  if (0 != hand_over(canvas)) {
+    return 1;
+  }
+  const int retval = write_whole(fname, canvas);
+  CONTOUR3D_PROFILE_STOP(CONTOUR3D_PHASE_WRITE);
+  return retval;
+}
+
+// wait for the background writer, close the stream, terminate the worker threads,
+//   and free the shared window
+int contour3d_flush (
+    void
+) {
+  int retval = 0;
+  if (0 != contour3d_writer_flush()) {
+    logger_error("failed to write image(s) asynchronously");
+    retval = 1;
+  }
+  if (0 != contour3d_stream_close()) {
+    logger_error("failed to close stream");
+    retval = 1;
+  }
+  contour3d_pool_finalise();
+  contour3d_canvas_release();
+  // the timeline so far, when tracing
+  CONTOUR3D_TRACE_WRITE();
+  contour3d_memory_release();
+  return retval;
+}
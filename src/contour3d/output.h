@@ -2,15 +2,28 @@
 #define CONTOUR3D_OUTPUT_H
 
 #include <stddef.h>
+#include <stdbool.h>
 #include "sdecomp.h"
 #include "./struct.h"
 
 extern int contour3d_output_image(
     const sdecomp_info_t * sdecomp_info,
+    const screen_t * screen,
+    const char fname[],
+    canvas_t * canvas
+);
+
+extern size_t contour3d_output_get_staging_size(
     const char fname[],
     const size_t width,
     const size_t height,
-    pixel_t * canvas
+    const bool has_ids
+);
+
+extern int contour3d_output_write_serial(
+    const char fname[],
+    const bool is_streamed,
+    const canvas_t * canvas
 );
 
 #endif // CONTOUR3D_OUTPUT_H
@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "contour3d.h"
+#include "./logger.h"
+#include "./config.h"
+#include "./pool.h"
+
+// worker threads of each process, which share the work of the main thread
+//   (e.g. different slabs of a domain, or different rows of a canvas)
+// the workers are created at the first use and kept until "contour3d_flush",
+//   so that their arenas are reused by the following frames
+// NOTE: workers never call MPI, and what they allocate stays alive
+//   until they rewind their own arenas
+
+// workers, whose ranks are 1, 2, ...
+static pthread_t * threads = NULL;
+static size_t * ranks = NULL;
+static size_t nworkers = 0;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+// signalled when a task is given or the workers are asked to stop
+static pthread_cond_t cond_start = PTHREAD_COND_INITIALIZER;
+// signalled when the last worker finishes its part
+static pthread_cond_t cond_done = PTHREAD_COND_INITIALIZER;
+// incremented for each task, so that a task is never taken twice
+static uint64_t generation = 0;
+static contour3d_pool_task_t current_task = NULL;
+static void * current_data = NULL;
+static size_t current_nthreads = 0;
+// workers which have not finished the current task
+static size_t nbusy = 0;
+static bool has_failed = false;
+static bool is_stopping = false;
+
+static void * run (
+    void * const arg
+) {
+  const size_t rank = *(const size_t *)arg;
+  // generation is zero whenever workers are created (see "contour3d_pool_finalise")
+  uint64_t done = 0;
+  pthread_mutex_lock(&mutex);
+  while (true) {
+    while (done == generation && !is_stopping) {
+      pthread_cond_wait(&cond_start, &mutex);
+    }
+    if (is_stopping) {
+      break;
+    }
+    done = generation;
+    if (rank < current_nthreads) {
+      const contour3d_pool_task_t task = current_task;
+      void * const data = current_data;
+      const size_t nthreads = current_nthreads;
+      pthread_mutex_unlock(&mutex);
+      const int retval = task(rank, nthreads, data);
+      pthread_mutex_lock(&mutex);
+      if (0 != retval) {
+        has_failed = true;
+      }
+    }
+    nbusy -= 1;
+    if (0 == nbusy) {
+      pthread_cond_signal(&cond_done);
+    }
+  }
+  pthread_mutex_unlock(&mutex);
+  return NULL;
+}
+
+static int start (
+    const size_t nthreads
+) {
+  threads = malloc((nthreads - 1) * sizeof(pthread_t));
+  ranks = malloc((nthreads - 1) * sizeof(size_t));
+  if (NULL == threads || NULL == ranks) {
+    logger_error("failed to allocate worker threads");
+    free(threads);
+    free(ranks);
+    threads = NULL;
+    ranks = NULL;
+    return 1;
+  }
+  is_stopping = false;
+  for (nworkers = 0; nworkers < nthreads - 1; nworkers++) {
+    ranks[nworkers] = nworkers + 1;
+    if (0 != pthread_create(threads + nworkers, NULL, run, ranks + nworkers)) {
+      logger_error("failed to create worker thread %zu", nworkers + 1);
+      contour3d_pool_finalise();
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// number of threads sharing the work of each process
+size_t contour3d_pool_get_nthreads (
+    void
+) {
+  const size_t nthreads = contour3d_config_get()->num_threads;
+  return 0 == nthreads ? 1 : nthreads;
+}
+
+// run the task on "nthreads" threads including the calling one,
+//   and wait for all of them
+// a failure of any thread is reported as a failure
+int contour3d_pool_run (
+    const size_t nthreads,
+    const contour3d_pool_task_t task,
+    void * const data
+) {
+  if (nthreads <= 1) {
+    return task(0, 1, data);
+  }
+  if (nworkers < nthreads - 1) {
+    // the number of threads has been increased
+    contour3d_pool_finalise();
+    if (0 != start(nthreads)) {
+      return 1;
+    }
+  }
+  pthread_mutex_lock(&mutex);
+  current_task = task;
+  current_data = data;
+  current_nthreads = nthreads;
+  nbusy = nworkers;
+  has_failed = false;
+  generation += 1;
+  pthread_cond_broadcast(&cond_start);
+  pthread_mutex_unlock(&mutex);
+  int retval = task(0, nthreads, data);
+  pthread_mutex_lock(&mutex);
+  while (0 != nbusy) {
+    pthread_cond_wait(&cond_done, &mutex);
+  }
+  if (has_failed) {
+    retval = 1;
+  }
+  pthread_mutex_unlock(&mutex);
+  return retval;
+}
+
+// terminate the workers, whose arenas are released
+int contour3d_pool_finalise (
+    void
+) {
+  pthread_mutex_lock(&mutex);
+  is_stopping = true;
+  pthread_cond_broadcast(&cond_start);
+  pthread_mutex_unlock(&mutex);
+  for (size_t n = 0; n < nworkers; n++) {
+    pthread_join(threads[n], NULL);
+  }
+  free(threads);
+  free(ranks);
+  threads = NULL;
+  ranks = NULL;
+  nworkers = 0;
+  // workers created later start from the first generation,
+  //   and thus should not take the last task again
+  generation = 0;
+  current_task = NULL;
+  current_data = NULL;
+  current_nthreads = 0;
+  return 0;
+}
@@ -0,0 +1,28 @@
+#if !defined(CONTOUR3D_POOL_H)
+#define CONTOUR3D_POOL_H
+
+#include <stddef.h>
+
+// work done by each thread, identified by "rank" in [0 : nthreads),
+//   where rank 0 is the calling (main) thread
+typedef int (* contour3d_pool_task_t) (
+    const size_t rank,
+    const size_t nthreads,
+    void * const data
+);
+
+extern size_t contour3d_pool_get_nthreads (
+    void
+);
+
+extern int contour3d_pool_run (
+    const size_t nthreads,
+    const contour3d_pool_task_t task,
+    void * const data
+);
+
+extern int contour3d_pool_finalise (
+    void
+);
+
+#endif // CONTOUR3D_POOL_H
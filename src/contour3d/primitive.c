@@ -0,0 +1,85 @@
+#include <mpi.h>
+#include "./struct.h"
+#include "./memory.h"
+#include "./logger.h"
+#include "./primitive.h"
+
+// make sure the list can hold at least "capacity" items
+int contour3d_primitive_reserve (
+    primitives_t * const primitives,
+    const size_t capacity
+) {
+  if (capacity <= primitives->capacity) {
+    return 0;
+  }
+  // grown in place as long as nothing has been allocated after the list
+  const contour3d_memory_subsystem_t subsystem = contour3d_memory_set_subsystem(CONTOUR3D_MEMORY_PRIMITIVES);
+  primitive_t * const items = contour3d_memory_realloc(primitives->items, capacity, sizeof(primitive_t));
+  contour3d_memory_set_subsystem(subsystem);
+  if (NULL == items) {
+    logger_error("failed to allocate primitives (%zu)", capacity);
+    return 1;
+  }
+  primitives->capacity = capacity;
+  primitives->items = items;
+  return 0;
+}
+
+int contour3d_primitive_push (
+    primitives_t * const primitives,
+    const primitive_t * const primitive
+) {
+  if (primitives->capacity == primitives->nitems) {
+    // grow geometrically to amortise copies
+    const size_t capacity = 0 == primitives->capacity ? 1024 : 2 * primitives->capacity;
+    if (0 != contour3d_primitive_reserve(primitives, capacity)) {
+      return 1;
+    }
+  }
+  primitives->items[primitives->nitems++] = *primitive;
+  return 0;
+}
+
+int contour3d_primitive_finalise (
+    primitives_t * const primitives
+) {
+  contour3d_memory_free(primitives->items);
+  primitives->nitems = 0;
+  primitives->capacity = 0;
+  primitives->items = NULL;
+  return 0;
+}
+
+// create a datatype to store primitive_t
+int contour3d_primitive_create_type (
+    MPI_Datatype * const primitive_type
+) {
+  MPI_Datatype struct_type = MPI_DATATYPE_NULL;
+  MPI_Type_create_struct(
+      6,
+      (int []) {9, 9, 3, 1, 1, 3},
+      (MPI_Aint []) {
+        offsetof(primitive_t, vertices),
+        offsetof(primitive_t, vertex_normals),
+        offsetof(primitive_t, color),
+        offsetof(primitive_t, id),
+        offsetof(primitive_t, colormap),
+        offsetof(primitive_t, levels),
+      },
+      (MPI_Datatype []) {
+        MPI_DOUBLE,
+        MPI_DOUBLE,
+        MPI_UNSIGNED_CHAR,
+        MPI_UINT16_T,
+        MPI_UINT8_T,
+        MPI_UINT8_T,
+      },
+      &struct_type
+  );
+  // take trailing padding into account
+  MPI_Type_create_resized(struct_type, 0, sizeof(primitive_t), primitive_type);
+  MPI_Type_commit(primitive_type);
+  MPI_Type_free(&struct_type);
+  return 0;
+}
+
@@ -0,0 +1,33 @@
+#if !defined(CONTOUR3D_PRIMITIVE_H)
+#define CONTOUR3D_PRIMITIVE_H
+
+#include <stddef.h>
+#include <mpi.h>
+#include "./struct.h"
+
+// growable list of triangles to be rasterised later
+typedef struct {
+  size_t nitems;
+  size_t capacity;
+  primitive_t * items;
+} primitives_t;
+
+extern int contour3d_primitive_push (
+    primitives_t * const primitives,
+    const primitive_t * const primitive
+);
+
+extern int contour3d_primitive_reserve (
+    primitives_t * const primitives,
+    const size_t capacity
+);
+
+extern int contour3d_primitive_finalise (
+    primitives_t * const primitives
+);
+
+extern int contour3d_primitive_create_type (
+    MPI_Datatype * const primitive_type
+);
+
+#endif // CONTOUR3D_PRIMITIVE_H
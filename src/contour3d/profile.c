@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <mpi.h>
+#include "contour3d.h"
+#include "./memory.h"
+#include "./logger.h"
+#include "./config.h"
+#include "./profile.h"
+
+// summary of the last frame, shared by all processes
+static contour3d_profile_t last = {0};
+static bool has_profile = false;
+
+#if defined(CONTOUR3D_PROFILE)
+
+// each row holds the timings followed by the counters
+#define NCOLUMNS (CONTOUR3D_NPHASES + CONTOUR3D_NCOUNTERS)
+
+// one row per contour object, followed by a row for the frame-wide work
+//   (deferred rasterisation, lines, compositing, and output)
+//   and another for the totals
+static size_t nrows = 0;
+static double * rows = NULL;
+// row to which the measurements are added
+static size_t current = 0;
+// when the running phases started
+static double starts[CONTOUR3D_NPHASES] = {0.};
+// phases are timed (and traced) on the thread which started the frame,
+//   while the counters are also updated by the worker threads
+static pthread_t owner;
+static bool has_owner = false;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool is_owner (
+    void
+) {
+  return has_owner && pthread_equal(owner, pthread_self());
+}
+
+// phases come first, followed by the other events
+static const char * const event_names[NEVENTS] = {
+  "extend",
+  "triangulate",
+  "normals",
+  "exchange",
+  "rasterise",
+  "lines",
+  "composite",
+  "write",
+  "frame",
+  "MPI_Sendrecv",
+  "MPI_Send",
+  "MPI_Recv",
+  "MPI_Allgather",
+  "MPI_Allreduce",
+  "MPI_Alltoall",
+  "MPI_Gatherv",
+  "MPI_Win_sync",
+  "MPI_File_write",
+};
+
+// timeline of this process, which spans all frames of the run
+//   and thus is kept outside the arena
+typedef struct {
+  uint16_t event;
+  bool is_begin;
+  // microseconds since the beginning of the first frame
+  double time;
+} record_t;
+
+static size_t nrecords = 0;
+static size_t capacity = 0;
+static record_t * records = NULL;
+// common origin of the time stamps
+static double origin = 0.;
+// communicator used to write the timeline, which outlives the frames
+//   and is freed when the timeline is written by "contour3d_flush"
+static MPI_Comm comm_trace = MPI_COMM_NULL;
+// events which have begun but not ended yet, innermost last,
+//   which are closed when a frame is aborted
+static uint16_t opened[NEVENTS] = {0};
+static size_t nopened = 0;
+
+static const char * const counter_names[CONTOUR3D_NCOUNTERS] = {
+  "cells",
+  "triangles",
+  "pixels tested",
+  "pixels written",
+};
+
+// prepare rows for "nobjs" contour objects
+int contour3d_profile_init (
+    const MPI_Comm comm,
+    const size_t nobjs
+) {
+  if (NULL != contour3d_config_get()->trace_path && MPI_COMM_NULL == comm_trace) {
+    // first traced frame: align the time stamps of all processes
+    MPI_Comm_dup(comm, &comm_trace);
+    MPI_Barrier(comm_trace);
+    origin = MPI_Wtime();
+  }
+  owner = pthread_self();
+  has_owner = true;
+  nrows = nobjs + 2;
+  rows = contour3d_memory_alloc(nrows * NCOLUMNS, sizeof(double));
+  if (NULL == rows) {
+    // nothing is measured in this frame
+    logger_error("failed to allocate profile");
+    nrows = 0;
+    return 1;
+  }
+  for (size_t n = 0; n < nrows * NCOLUMNS; n++) {
+    rows[n] = 0.;
+  }
+  current = nobjs;
+  return 0;
+}
+
+// attribute the following measurements to the given contour object,
+//   or to the frame-wide row when "obj" is the number of objects
+int contour3d_profile_set_object (
+    const size_t obj
+) {
+  current = obj;
+  return 0;
+}
+
+int contour3d_profile_start (
+    const contour3d_phase_t phase
+) {
+  if (!is_owner()) {
+    return 0;
+  }
+  starts[phase] = MPI_Wtime();
+  contour3d_profile_trace((event_t)phase, true);
+  return 0;
+}
+
+int contour3d_profile_stop (
+    const contour3d_phase_t phase
+) {
+  if (!is_owner()) {
+    return 0;
+  }
+  contour3d_profile_trace((event_t)phase, false);
+  if (NULL == rows) {
+    return 0;
+  }
+  rows[current * NCOLUMNS + phase] += MPI_Wtime() - starts[phase];
+  return 0;
+}
+
+// append a begin / end event to the timeline
+int contour3d_profile_trace (
+    const event_t event,
+    const bool is_begin
+) {
+  if (MPI_COMM_NULL == comm_trace || !is_owner()) {
+    return 0;
+  }
+  if (capacity == nrecords) {
+    const size_t new_capacity = 0 == capacity ? 4096 : 2 * capacity;
+    record_t * const new_records = realloc(records, new_capacity * sizeof(record_t));
+    if (NULL == new_records) {
+      // the timeline is truncated rather than failing the frame
+      return 1;
+    }
+    capacity = new_capacity;
+    records = new_records;
+  }
+  records[nrecords++] = (record_t){
+    .event = event,
+    .is_begin = is_begin,
+    .time = 1.e6 * (MPI_Wtime() - origin),
+  };
+  if (is_begin) {
+    if (nopened < NEVENTS) {
+      opened[nopened++] = event;
+    }
+  } else {
+    // the innermost one of the same kind is ended
+    for (size_t n = nopened; 0 < n; n--) {
+      if (event == opened[n - 1]) {
+        for (size_t m = n; m < nopened; m++) {
+          opened[m - 1] = opened[m];
+        }
+        nopened -= 1;
+        break;
+      }
+    }
+  }
+  return 0;
+}
+
+// end the events left open by an aborted frame (innermost first),
+//   and drop the measurements, which are released with the frame
+int contour3d_profile_abort (
+    void
+) {
+  if (!is_owner()) {
+    return 0;
+  }
+  for (size_t n = nopened; 0 < n; n--) {
+    contour3d_profile_trace((event_t)opened[n - 1], false);
+  }
+  nopened = 0;
+  nrows = 0;
+  rows = NULL;
+  return 0;
+}
+
+// the timeline is kept until it is written
+static void release_trace (
+    void
+) {
+  MPI_Comm_free(&comm_trace);
+  free(records);
+  records = NULL;
+  nrecords = 0;
+  capacity = 0;
+  nopened = 0;
+}
+
+// write the timelines of all processes to a single Chrome-trace JSON file,
+//   where each process appears as a "pid",
+//   after which the timeline is released and the next traced frame starts a new one
+// NOTE: collective, the whole file is rewritten every time
+int contour3d_profile_write_trace (
+    void
+) {
+  const char * const fname = contour3d_config_get()->trace_path;
+  if (MPI_COMM_NULL == comm_trace || NULL == fname) {
+    return 0;
+  }
+  int nprocs = 0;
+  int myrank = 0;
+  MPI_Comm_size(comm_trace, &nprocs);
+  MPI_Comm_rank(comm_trace, &myrank);
+  // each event is well below this length
+  const size_t max_length = 160;
+  char * const text = malloc((nrecords + 2) * max_length);
+  if (NULL == text) {
+    logger_error("failed to allocate buffer to write trace");
+    release_trace();
+    return 1;
+  }
+  size_t size = 0;
+  if (0 == myrank) {
+    size += sprintf(text + size, "{\"traceEvents\":[\n");
+  }
+  // name the process, which is the first event of each process
+  size += sprintf(
+      text + size,
+      "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"rank %d\"}}",
+      0 == myrank ? "" : ",\n",
+      myrank,
+      myrank
+  );
+  for (size_t n = 0; n < nrecords; n++) {
+    const record_t * const record = records + n;
+    size += sprintf(
+        text + size,
+        ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":0}",
+        event_names[record->event],
+        record->event < CONTOUR3D_NPHASES ? "phase" : EVENT_FRAME == record->event ? "frame" : "mpi",
+        record->is_begin ? 'B' : 'E',
+        record->time,
+        myrank
+    );
+  }
+  if (nprocs - 1 == myrank) {
+    size += sprintf(text + size, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  }
+  // the processes write their parts one after another
+  uint64_t offset = 0;
+  MPI_Exscan(&(uint64_t){size}, &offset, 1, MPI_UINT64_T, MPI_SUM, comm_trace);
+  if (0 == myrank) {
+    offset = 0;
+  }
+  MPI_File fh = MPI_FILE_NULL;
+  int error = MPI_File_open(comm_trace, fname, MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &fh);
+  if (MPI_SUCCESS != error) {
+    char string[MPI_MAX_ERROR_STRING] = {'\0'};
+    int length = 0;
+    MPI_Error_string(error, string, &length);
+    logger_error("%s: %s", fname, string);
+    free(text);
+    release_trace();
+    return 1;
+  }
+  // discard the previous contents
+  MPI_File_set_size(fh, 0);
+  error = MPI_File_write_at_all(fh, offset, text, size, MPI_CHAR, MPI_STATUS_IGNORE);
+  MPI_File_close(&fh);
+  free(text);
+  release_trace();
+  if (MPI_SUCCESS != error) {
+    logger_error("%s: failed to write trace", fname);
+    return 1;
+  }
+  return 0;
+}
+
+int contour3d_profile_count (
+    const contour3d_counter_t counter,
+    const uint64_t n
+) {
+  pthread_mutex_lock(&mutex);
+  if (NULL != rows) {
+    rows[current * NCOLUMNS + CONTOUR3D_NPHASES + counter] += n;
+  }
+  pthread_mutex_unlock(&mutex);
+  return 0;
+}
+
+// print one row, skipping what was not measured on any process
+static void print_row (
+    const char label[],
+    const double * const mins,
+    const double * const means,
+    const double * const maxs
+) {
+  for (size_t n = 0; n < NCOLUMNS; n++) {
+    if (0. == maxs[n]) {
+      continue;
+    }
+    if (n < CONTOUR3D_NPHASES) {
+      logger_info(
+          "profile: %-10s %-14s min %.3e mean %.3e max %.3e [s]",
+          label, event_names[n], mins[n], means[n], maxs[n]
+      );
+    } else {
+      logger_info(
+          "profile: %-10s %-14s min %.0f mean %.0f max %.0f",
+          label, counter_names[n - CONTOUR3D_NPHASES], mins[n], means[n], maxs[n]
+      );
+    }
+  }
+}
+
+// reduce the measurements over all processes, which is collective
+int contour3d_profile_finalise (
+    const MPI_Comm comm
+) {
+  if (NULL == rows) {
+    return 1;
+  }
+  int nprocs = 0;
+  int myrank = 0;
+  MPI_Comm_size(comm, &nprocs);
+  MPI_Comm_rank(comm, &myrank);
+  // the last row is the sum of the others
+  double * const totals = rows + (nrows - 1) * NCOLUMNS;
+  for (size_t m = 0; m < nrows - 1; m++) {
+    for (size_t n = 0; n < NCOLUMNS; n++) {
+      totals[n] += rows[m * NCOLUMNS + n];
+    }
+  }
+  const size_t nitems = nrows * NCOLUMNS;
+  double * const mins  = contour3d_memory_alloc(nitems, sizeof(double));
+  double * const means = contour3d_memory_alloc(nitems, sizeof(double));
+  double * const maxs  = contour3d_memory_alloc(nitems, sizeof(double));
+  if (NULL == mins || NULL == means || NULL == maxs) {
+    logger_error("failed to allocate buffers to reduce profile");
+    rows = NULL;
+    return 1;
+  }
+  MPI_Allreduce(rows, mins,  nitems, MPI_DOUBLE, MPI_MIN, comm);
+  MPI_Allreduce(rows, means, nitems, MPI_DOUBLE, MPI_SUM, comm);
+  MPI_Allreduce(rows, maxs,  nitems, MPI_DOUBLE, MPI_MAX, comm);
+  for (size_t n = 0; n < nitems; n++) {
+    means[n] /= nprocs;
+  }
+  const size_t offset = (nrows - 1) * NCOLUMNS;
+  for (size_t n = 0; n < NCOLUMNS; n++) {
+    contour3d_summary_t * const summary = n < CONTOUR3D_NPHASES
+      ? last.times + n
+      : last.counts + n - CONTOUR3D_NPHASES;
+    summary->min  = mins [offset + n];
+    summary->mean = means[offset + n];
+    summary->max  = maxs [offset + n];
+  }
+  has_profile = true;
+  if (0 == myrank && contour3d_config_get()->print_profile) {
+    for (size_t m = 0; m < nrows; m++) {
+      char label[32] = {0};
+      if (m < nrows - 2) {
+        snprintf(label, sizeof(label), "contour %zu", m + 1);
+      } else {
+        snprintf(label, sizeof(label), "%s", m < nrows - 1 ? "frame" : "total");
+      }
+      const size_t index = m * NCOLUMNS;
+      print_row(label, mins + index, means + index, maxs + index);
+    }
+  }
+  // released with the other memory of this frame
+  rows = NULL;
+  return 0;
+}
+
+#endif
+
+int contour3d_get_profile (
+    contour3d_profile_t * const profile
+) {
+  if (!has_profile) {
+    logger_error("no profile is available (build with -DCONTOUR3D_PROFILE)");
+    return 1;
+  }
+  *profile = last;
+  return 0;
+}
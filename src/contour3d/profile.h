@@ -0,0 +1,96 @@
+#if !defined(CONTOUR3D_PROFILE_H)
+#define CONTOUR3D_PROFILE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <mpi.h>
+#include "contour3d.h"
+
+// instrumentation is only compiled in with -DCONTOUR3D_PROFILE,
+//   otherwise all hooks vanish
+
+// events recorded in the timeline in addition to the phases
+typedef enum {
+  EVENT_FRAME      = CONTOUR3D_NPHASES,
+  EVENT_SENDRECV   = CONTOUR3D_NPHASES + 1,
+  EVENT_SEND       = CONTOUR3D_NPHASES + 2,
+  EVENT_RECV       = CONTOUR3D_NPHASES + 3,
+  EVENT_ALLGATHER  = CONTOUR3D_NPHASES + 4,
+  EVENT_ALLREDUCE  = CONTOUR3D_NPHASES + 5,
+  EVENT_ALLTOALL   = CONTOUR3D_NPHASES + 6,
+  EVENT_GATHERV    = CONTOUR3D_NPHASES + 7,
+  EVENT_WIN_SYNC   = CONTOUR3D_NPHASES + 8,
+  EVENT_FILE_WRITE = CONTOUR3D_NPHASES + 9,
+  NEVENTS          = CONTOUR3D_NPHASES + 10,
+} event_t;
+
+#if defined(CONTOUR3D_PROFILE)
+
+extern int contour3d_profile_init (
+    const MPI_Comm comm,
+    const size_t nobjs
+);
+
+extern int contour3d_profile_set_object (
+    const size_t obj
+);
+
+extern int contour3d_profile_start (
+    const contour3d_phase_t phase
+);
+
+extern int contour3d_profile_stop (
+    const contour3d_phase_t phase
+);
+
+extern int contour3d_profile_count (
+    const contour3d_counter_t counter,
+    const uint64_t n
+);
+
+extern int contour3d_profile_finalise (
+    const MPI_Comm comm
+);
+
+extern int contour3d_profile_trace (
+    const event_t event,
+    const bool is_begin
+);
+
+extern int contour3d_profile_abort (
+    void
+);
+
+extern int contour3d_profile_write_trace (
+    void
+);
+
+#define CONTOUR3D_PROFILE_INIT(comm, nobjs) contour3d_profile_init(comm, nobjs)
+#define CONTOUR3D_PROFILE_SET_OBJECT(obj)   contour3d_profile_set_object(obj)
+#define CONTOUR3D_PROFILE_START(phase)      contour3d_profile_start(phase)
+#define CONTOUR3D_PROFILE_STOP(phase)       contour3d_profile_stop(phase)
+#define CONTOUR3D_PROFILE_COUNT(counter, n) contour3d_profile_count(counter, n)
+#define CONTOUR3D_PROFILE_FINALISE(comm)    contour3d_profile_finalise(comm)
+#define CONTOUR3D_PROFILE_ABORT()           contour3d_profile_abort()
+#define CONTOUR3D_TRACE_BEGIN(event)        contour3d_profile_trace(event, true)
+#define CONTOUR3D_TRACE_END(event)          contour3d_profile_trace(event, false)
+#define CONTOUR3D_TRACE_WRITE()             contour3d_profile_write_trace()
+
+#else
+
+#define CONTOUR3D_PROFILE_INIT(comm, nobjs) ((void)0)
+#define CONTOUR3D_PROFILE_SET_OBJECT(obj)   ((void)0)
+#define CONTOUR3D_PROFILE_START(phase)      ((void)0)
+#define CONTOUR3D_PROFILE_STOP(phase)       ((void)0)
+// NOTE: the count is evaluated so that the local tallies are regarded as used
+#define CONTOUR3D_PROFILE_COUNT(counter, n) ((void)(n))
+#define CONTOUR3D_PROFILE_FINALISE(comm)    ((void)0)
+#define CONTOUR3D_PROFILE_ABORT()           ((void)0)
+#define CONTOUR3D_TRACE_BEGIN(event)        ((void)0)
+#define CONTOUR3D_TRACE_END(event)          ((void)0)
+#define CONTOUR3D_TRACE_WRITE()             ((void)0)
+
+#endif
+
+#endif // CONTOUR3D_PROFILE_H
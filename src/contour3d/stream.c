@@ -0,0 +1,261 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h> // sigtimedwait
+#include <time.h> // timespec
+#include <pthread.h> // pthread_sigmask
+#include <fcntl.h> // open, fcntl
+#include <unistd.h> // write, close
+#include "contour3d.h"
+#include "./memory.h"
+#include "./logger.h"
+#include "./stream.h"
+
+// a single destination to which all frames are appended,
+//   opened by the main process at the first frame and kept until "contour3d_flush"
+// NOTE: frames are written by the main thread or the background writer,
+//   but never by both at the same time
+
+// default frame rate recorded in the y4m header
+#define DEFAULT_FRAME_RATE 25
+
+static struct {
+  bool is_open;
+  // true if the descriptor is opened (and thus closed) by myself
+  bool is_owned;
+  int fd;
+  contour3d_stream_format_t format;
+  // resolution, which should not change among frames
+  size_t width;
+  size_t height;
+} stream = {
+  .is_open = false,
+  .is_owned = false,
+  .fd = -1,
+  .format = CONTOUR3D_STREAM_NONE,
+  .width = 0,
+  .height = 0,
+};
+
+// write all bytes, retrying partial writes (e.g. to pipes)
+// NOTE: SIGPIPE is blocked meanwhile, so that a reader which has gone away
+//   is reported as EPIPE instead of terminating the process
+static int write_all (
+    const uint8_t * buffer,
+    size_t size
+) {
+  sigset_t sigpipe;
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  sigset_t pending;
+  sigpending(&pending);
+  const bool was_pending = 1 == sigismember(&pending, SIGPIPE);
+  sigset_t saved;
+  pthread_sigmask(SIG_BLOCK, &sigpipe, &saved);
+  int error = 0;
+  while (0 < size) {
+    errno = 0;
+    const ssize_t retval = write(stream.fd, buffer, size);
+    if (retval < 0) {
+      if (EINTR == errno) {
+        continue;
+      }
+      error = errno;
+      break;
+    }
+    buffer += retval;
+    size -= retval;
+  }
+  if (EPIPE == error && !was_pending) {
+    // discard the signal raised by the failed write
+    sigtimedwait(&sigpipe, NULL, &(struct timespec){.tv_sec = 0, .tv_nsec = 0});
+  }
+  pthread_sigmask(SIG_SETMASK, &saved, NULL);
+  if (0 != error) {
+    logger_error("stream: %s", strerror(error));
+    return 1;
+  }
+  return 0;
+}
+
+bool contour3d_stream_is_open (
+    void
+) {
+  return stream.is_open;
+}
+
+// check that the given descriptor is open for writing
+static int check_fd (
+    const int fd
+) {
+  // a zero-initialised config otherwise points to stdin
+  if (STDIN_FILENO == fd) {
+    logger_error("stream: stream_fd is not set (0 is stdin)");
+    return 1;
+  }
+  errno = 0;
+  const int flags = fd < 0 ? -1 : fcntl(fd, F_GETFL);
+  if (flags < 0) {
+    logger_error("stream: descriptor %d is not open", fd);
+    return 1;
+  }
+  const int mode = flags & O_ACCMODE;
+  if (O_WRONLY != mode && O_RDWR != mode) {
+    logger_error("stream: descriptor %d is not open for writing", fd);
+    return 1;
+  }
+  return 0;
+}
+
+// the descriptor is given back when the header cannot be written
+static void abandon (
+    void
+) {
+  if (stream.is_owned) {
+    close(stream.fd);
+  }
+  stream.is_owned = false;
+  stream.fd = -1;
+}
+
+// open the destination (unless a descriptor is given) and write the header
+// NOTE: opening a fifo blocks until the reader is ready
+int contour3d_stream_open (
+    const contour3d_config_t * const config,
+    const size_t width,
+    const size_t height
+) {
+  if (NULL != config->stream_path) {
+    errno = 0;
+    stream.fd = open(config->stream_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (stream.fd < 0) {
+      logger_error("%s: %s", config->stream_path, strerror(errno));
+      return 1;
+    }
+    stream.is_owned = true;
+  } else {
+    if (0 != check_fd(config->stream_fd)) {
+      return 1;
+    }
+    stream.fd = config->stream_fd;
+    stream.is_owned = false;
+  }
+  stream.format = config->stream_format;
+  stream.width = width;
+  stream.height = height;
+  if (CONTOUR3D_STREAM_Y4M == stream.format) {
+    // progressive, square pixels, full-resolution chroma
+    const size_t frame_rate = 0 == config->stream_frame_rate ? DEFAULT_FRAME_RATE : config->stream_frame_rate;
+    char header[128] = {'\0'};
+    const int size = snprintf(
+        header,
+        sizeof(header),
+        "YUV4MPEG2 W%zu H%zu F%zu:1 Ip A1:1 C444\n",
+        width,
+        height,
+        frame_rate
+    );
+    if (0 != write_all((const uint8_t *)header, size)) {
+      logger_error("stream: failed to write header");
+      abandon();
+      return 1;
+    }
+  }
+  // frames are appended only after the header
+  stream.is_open = true;
+  return 0;
+}
+
+// number of rows which are converted at once
+#define BLOCK_ROWS 64
+
+// convert rgb (8-bit each) to one of y, cb, cr (bt.601, limited range)
+static void convert_to_plane (
+    const size_t plane,
+    const size_t npixels,
+    const contour3d_color_t * const colors,
+    uint8_t * const values
+) {
+  for (size_t n = 0; n < npixels; n++) {
+    const int r = colors[n].r;
+    const int g = colors[n].g;
+    const int b = colors[n].b;
+    values[n] =
+        0 == plane ? (uint8_t)((( 66 * r + 129 * g +  25 * b + 128) >> 8) +  16)
+      : 1 == plane ? (uint8_t)(((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128)
+      :              (uint8_t)(((112 * r -  94 * g -  18 * b + 128) >> 8) + 128);
+  }
+}
+
+// append a frame, whose rows are stored from the bottom as in a canvas,
+//   converting a block of rows at a time
+int contour3d_stream_write (
+    const size_t width,
+    const size_t height,
+    const contour3d_color_t * const colors
+) {
+  if (width != stream.width || height != stream.height) {
+    logger_error(
+        "stream: resolution changed (%zu x %zu -> %zu x %zu)",
+        stream.width, stream.height, width, height
+    );
+    return 1;
+  }
+  if (CONTOUR3D_STREAM_RGB == stream.format) {
+    // rows are written from the top
+    for (size_t j = 0; j < height; j++) {
+      const contour3d_color_t * const row = colors + (height - j - 1) * width;
+      if (0 != write_all((const uint8_t *)row, 3 * width)) {
+        logger_error("stream: failed to write frame");
+        return 1;
+      }
+    }
+    return 0;
+  }
+  uint8_t * const values = contour3d_memory_alloc(width * BLOCK_ROWS, sizeof(uint8_t));
+  if (NULL == values) {
+    logger_error("stream: failed to allocate frame buffer");
+    return 1;
+  }
+  const char tag[] = "FRAME\n";
+  if (0 != write_all((const uint8_t *)tag, strlen(tag))) {
+    logger_error("stream: failed to write frame");
+    contour3d_memory_free(values);
+    return 1;
+  }
+  for (/* y, cb, cr */ size_t plane = 0; plane < 3; plane++) {
+    for (size_t jmin = 0; jmin < height; jmin += BLOCK_ROWS) {
+      const size_t nrows = jmin + BLOCK_ROWS < height ? BLOCK_ROWS : height - jmin;
+      for (size_t j = jmin; j < jmin + nrows; j++) {
+        const contour3d_color_t * const row = colors + (height - j - 1) * width;
+        convert_to_plane(plane, width, row, values + (j - jmin) * width);
+      }
+      if (0 != write_all(values, width * nrows)) {
+        logger_error("stream: failed to write frame");
+        contour3d_memory_free(values);
+        return 1;
+      }
+    }
+  }
+  contour3d_memory_free(values);
+  return 0;
+}
+
+// close the destination if it is opened by myself
+int contour3d_stream_close (
+    void
+) {
+  if (!stream.is_open) {
+    return 0;
+  }
+  int retval = 0;
+  if (stream.is_owned && 0 != close(stream.fd)) {
+    logger_error("stream: %s", strerror(errno));
+    retval = 1;
+  }
+  stream.is_open = false;
+  stream.is_owned = false;
+  stream.fd = -1;
+  return retval;
+}
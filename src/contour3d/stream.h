@@ -0,0 +1,29 @@
+#if !defined(CONTOUR3D_STREAM_H)
+#define CONTOUR3D_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "contour3d.h"
+
+extern bool contour3d_stream_is_open (
+    void
+);
+
+extern int contour3d_stream_open (
+    const contour3d_config_t * const config,
+    const size_t width,
+    const size_t height
+);
+
+extern int contour3d_stream_write (
+    const size_t width,
+    const size_t height,
+    const contour3d_color_t * const colors
+);
+
+extern int contour3d_stream_close (
+    void
+);
+
+#endif // CONTOUR3D_STREAM_H
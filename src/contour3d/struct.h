@@ -1,8 +1,10 @@
 #if !defined(CONTOUR3D_STRUCT_H)
 #define CONTOUR3D_STRUCT_H
 
+#include <stdbool.h> // bool
 #include <stddef.h> // size_t
 #include <stdint.h> // uint8_t
+#include <mpi.h>
 #include "sdecomp.h"
 #include "contour3d.h"
 
@@ -14,6 +16,9 @@ typedef struct {
   contour3d_vector_t face_normal;
   // vertex normals (defined at each vertex)
   contour3d_vector_t vertex_normals[3];
+  // second field at the vertices, which is used to color the triangle
+  //   and is left unset when the field is not given
+  double values[3];
   // indices of the lattice edges where the corners are sitting
   size_t cube_indices[3];
   // area of triangle
@@ -27,11 +32,69 @@ typedef struct {
   triangle_t triangles[12];
 } lattice_t;
 
-// pixel which has z-buffer and color information
+// triangle element which is ready to be rasterised,
+//   whose vertex normals are already computed
 typedef struct {
-  double depth;
+  // vertex positions
+  contour3d_vector_t vertices[3];
+  // vertex normals
+  contour3d_vector_t vertex_normals[3];
+  // object color
   contour3d_color_t color;
-} pixel_t;
+  // object which this primitive belongs to, see "ids" of canvas_t
+  uint16_t id;
+  // colormap used instead of "color" unless CONTOUR3D_COLORMAP_NONE,
+  //   and its levels at the vertices, which are interpolated on each pixel
+  uint8_t colormap;
+  uint8_t levels[3];
+} primitive_t;
+
+// rectangle on the canvas, in pixel indices
+// NOTE: half-open ranges [imin : imax) x [jmin : jmax),
+//   which is empty when imax <= imin or jmax <= jmin
+typedef struct {
+  size_t imin;
+  size_t imax;
+  size_t jmin;
+  size_t jmax;
+} rect_t;
+
+// canvas, onto which elements are rendered
+// NOTE: a canvas may cover only a part of the screen,
+//   i.e. rows [offset : offset + height) of the whole screen
+typedef struct {
+  // number of pixels
+  size_t width;
+  size_t height;
+  // index of the first row on the screen
+  size_t offset;
+  // false: canvases of all processes cover the whole screen and are composited
+  // true : canvases of all processes are disjoint row bands of the screen
+  bool is_partitioned;
+  // z buffer, object ids and colors of the pixels,
+  //   stored separately (row-major, from the bottom)
+  //   so that the colors can be handed to the caller as they are
+  // ids are 0 for the background, 1, 2, ... for the contour objects,
+  //   followed by the line objects,
+  //   and are NULL unless they are exported
+  // NOTE: all live in a single allocation starting from "depths"
+  //   (see contour3d_canvas_locate),
+  //   except for colors-only canvases whose "depths" is NULL
+  double * depths;
+  uint16_t * ids;
+  contour3d_color_t * colors;
+  // bounding box of the pixels which have been touched so far
+  //   (in screen pixel indices),
+  //   used to limit the compositing to the active region
+  rect_t active;
+  // processes sharing the same node, their node-local main processes
+  //   (MPI_COMM_NULL on the others), and the window holding their pixels,
+  //   which are MPI_COMM_NULL and MPI_WIN_NULL unless node-aware compositing is used
+  //   and are owned by canvas.c
+  MPI_Comm comm_node;
+  MPI_Comm comm_leaders;
+  MPI_Win win;
+} canvas_t;
 
 // screen configuration
 typedef struct {
@@ -0,0 +1,214 @@
+#include <stdint.h>
+#include <float.h> // DBL_MAX
+#include <mpi.h>
+#include "contour3d.h"
+#include "./struct.h"
+#include "./memory.h"
+#include "./logger.h"
+#include "./config.h"
+#include "./project.h"
+#include "./canvas.h"
+#include "./primitive.h"
+#include "./profile.h"
+#include "./tile.h"
+
+// sort-first rendering:
+//   the screen is divided into row bands (tiles), each of which is owned by a process,
+//   and triangles are sent to the owners of the rows they cover,
+//   so that no full-resolution canvas and no image reduction are needed
+
+// first row of the band owned by the process "rank"
+static size_t get_band_offset (
+    const size_t height,
+    const int nprocs,
+    const int rank
+) {
+  return height * rank / nprocs;
+}
+
+// process owning the given row,
+//   i.e. the largest rank satisfying get_band_offset(rank) <= j
+static int get_band_owner (
+    const size_t height,
+    const int nprocs,
+    const size_t j
+) {
+  return ((j + 1) * nprocs + height - 1) / height - 1;
+}
+
+// find the processes whose bands are covered by the projected triangle
+// return non-zero value if the triangle is out of the screen
+static int find_owners (
+    const int nprocs,
+    const camera_t * const camera,
+    const screen_t * const screen,
+    const primitive_t * const primitive,
+    int owners[2]
+) {
+  const size_t height = screen->height;
+  double ymin = + DBL_MAX;
+  double ymax = - DBL_MAX;
+  for (size_t n = 0; n < 3; n++) {
+    contour3d_vector_t projected = {0};
+    if (0 != contour3d_project(camera, screen, primitive->vertices + n, &projected)) {
+      return 1;
+    }
+    ymin = projected.y < ymin ? projected.y : ymin;
+    ymax = projected.y < ymax ? ymax : projected.y;
+  }
+  // same bounding box as the rasteriser, clamped to the screen
+  const int_fast32_t jmin = (0.5 + ymin) * height - 1;
+  const int_fast32_t jmax = (0.5 + ymax) * height + 1;
+  const int_fast32_t jupper = height - 1;
+  owners[0] = get_band_owner(height, nprocs, jmin < 0 ? 0 : jupper < jmin ? jupper : jmin);
+  owners[1] = get_band_owner(height, nprocs, jmax < 0 ? 0 : jupper < jmax ? jupper : jmax);
+  return 0;
+}
+
+// allocate a canvas which covers my band
+int contour3d_tile_init_canvas (
+    const MPI_Comm comm,
+    const screen_t * const screen,
+    const bool has_ids,
+    const contour3d_color_t * const bg_color,
+    canvas_t * const canvas
+) {
+  int nprocs = 0;
+  int myrank = 0;
+  MPI_Comm_size(comm, &nprocs);
+  MPI_Comm_rank(comm, &myrank);
+  const size_t offset = get_band_offset(screen->height, nprocs, myrank    );
+  const size_t nrows  = get_band_offset(screen->height, nprocs, myrank + 1) - offset;
+  if (0 != contour3d_canvas_init(comm, false, has_ids, screen->width, nrows, offset, bg_color, canvas)) {
+    logger_error("failed to initialise band canvas");
+    return 1;
+  }
+  canvas->is_partitioned = true;
+  return 0;
+}
+
+// number of rounds in which the triangles are distributed,
+//   so that the buffers of each round fit in the memory budget
+// NOTE: a triangle covering several bands is sent more than once,
+//   which is roughly taken into account by doubling its size
+int contour3d_tile_get_nrounds (
+    const MPI_Comm comm,
+    const primitives_t * const primitives,
+    size_t * const nrounds
+) {
+  *nrounds = 1;
+  if (0 == contour3d_config_get()->memory_budget) {
+    return 0;
+  }
+  // send and receive buffers, and two owners per triangle
+  const size_t nbytes = primitives->nitems * 2 * (2 * sizeof(primitive_t) + 2 * sizeof(int));
+  const size_t available = contour3d_memory_get_available() / 2;
+  uint64_t myrounds = 0 == available ? 1 : 1 + nbytes / available;
+  MPI_Allreduce(MPI_IN_PLACE, &myrounds, 1, MPI_UINT64_T, MPI_MAX, comm);
+  *nrounds = myrounds;
+  return 0;
+}
+
+// in the reverse order of the allocations,
+//   so that the memory of each round is reused by the next one
+static void free_buffers (
+    int * const sendcounts,
+    int * const recvcounts,
+    int * const sdispls,
+    int * const rdispls,
+    int * const owners,
+    primitive_t * const sendbuf
+) {
+  contour3d_memory_free(sendbuf);
+  contour3d_memory_free(owners);
+  contour3d_memory_free(rdispls);
+  contour3d_memory_free(sdispls);
+  contour3d_memory_free(recvcounts);
+  contour3d_memory_free(sendcounts);
+}
+
+// send triangles to the processes owning the rows they cover
+int contour3d_tile_distribute (
+    const MPI_Comm comm,
+    const camera_t * const camera,
+    const screen_t * const screen,
+    const primitives_t * const primitives,
+    primitives_t * const received
+) {
+  int nprocs = 0;
+  MPI_Comm_size(comm, &nprocs);
+  int * const sendcounts = contour3d_memory_alloc(nprocs, sizeof(int));
+  int * const recvcounts = contour3d_memory_alloc(nprocs, sizeof(int));
+  int * const sdispls = contour3d_memory_alloc(nprocs, sizeof(int));
+  int * const rdispls = contour3d_memory_alloc(nprocs, sizeof(int));
+  int * const owners = contour3d_memory_alloc(2 * primitives->nitems + 1, sizeof(int));
+  if (NULL == sendcounts || NULL == recvcounts || NULL == sdispls || NULL == rdispls || NULL == owners) {
+    logger_error("failed to allocate buffers for triangle redistribution");
+    free_buffers(sendcounts, recvcounts, sdispls, rdispls, owners, NULL);
+    return 1;
+  }
+  for (int rank = 0; rank < nprocs; rank++) {
+    sendcounts[rank] = 0;
+  }
+  // count triangles sent to each process,
+  //   one triangle may be sent to several processes
+  for (size_t n = 0; n < primitives->nitems; n++) {
+    int * const owner = owners + 2 * n;
+    if (0 != find_owners(nprocs, camera, screen, primitives->items + n, owner)) {
+      // out of the screen, nobody needs it
+      owner[0] = 1;
+      owner[1] = 0;
+      continue;
+    }
+    for (int rank = owner[0]; rank <= owner[1]; rank++) {
+      sendcounts[rank] += 1;
+    }
+  }
+  CONTOUR3D_TRACE_BEGIN(EVENT_ALLTOALL);
+  MPI_Alltoall(sendcounts, 1, MPI_INT, recvcounts, 1, MPI_INT, comm);
+  CONTOUR3D_TRACE_END(EVENT_ALLTOALL);
+  size_t nsends = 0;
+  size_t nrecvs = 0;
+  for (int rank = 0; rank < nprocs; rank++) {
+    sdispls[rank] = nsends;
+    rdispls[rank] = nrecvs;
+    nsends += sendcounts[rank];
+    nrecvs += recvcounts[rank];
+  }
+  // pack triangles in the order of the destinations
+  primitive_t * const sendbuf = contour3d_memory_alloc(nsends + 1, sizeof(primitive_t));
+  if (NULL == sendbuf) {
+    logger_error("failed to allocate send buffer for triangle redistribution");
+    free_buffers(sendcounts, recvcounts, sdispls, rdispls, owners, NULL);
+    return 1;
+  }
+  for (int rank = 0; rank < nprocs; rank++) {
+    sendcounts[rank] = 0;
+  }
+  for (size_t n = 0; n < primitives->nitems; n++) {
+    const int * const owner = owners + 2 * n;
+    for (int rank = owner[0]; rank <= owner[1]; rank++) {
+      sendbuf[sdispls[rank] + sendcounts[rank]++] = primitives->items[n];
+    }
+  }
+  if (0 != contour3d_primitive_reserve(received, nrecvs + 1)) {
+    logger_error("failed to allocate receive buffer for triangle redistribution");
+    free_buffers(sendcounts, recvcounts, sdispls, rdispls, owners, sendbuf);
+    return 1;
+  }
+  MPI_Datatype primitive_type = MPI_DATATYPE_NULL;
+  contour3d_primitive_create_type(&primitive_type);
+  CONTOUR3D_TRACE_BEGIN(EVENT_ALLTOALL);
+  MPI_Alltoallv(
+      sendbuf, sendcounts, sdispls, primitive_type,
+      received->items, recvcounts, rdispls, primitive_type,
+      comm
+  );
+  CONTOUR3D_TRACE_END(EVENT_ALLTOALL);
+  received->nitems = nrecvs;
+  // clean-up
+  MPI_Type_free(&primitive_type);
+  free_buffers(sendcounts, recvcounts, sdispls, rdispls, owners, sendbuf);
+  return 0;
+}
+
@@ -0,0 +1,31 @@
+#if !defined(CONTOUR3D_TILE_H)
+#define CONTOUR3D_TILE_H
+
+#include <mpi.h>
+#include "contour3d.h"
+#include "./struct.h"
+#include "./primitive.h"
+
+extern int contour3d_tile_init_canvas (
+    const MPI_Comm comm,
+    const screen_t * const screen,
+    const bool has_ids,
+    const contour3d_color_t * const bg_color,
+    canvas_t * const canvas
+);
+
+extern int contour3d_tile_get_nrounds (
+    const MPI_Comm comm,
+    const primitives_t * const primitives,
+    size_t * const nrounds
+);
+
+extern int contour3d_tile_distribute (
+    const MPI_Comm comm,
+    const camera_t * const camera,
+    const screen_t * const screen,
+    const primitives_t * const primitives,
+    primitives_t * const received
+);
+
+#endif // CONTOUR3D_TILE_H
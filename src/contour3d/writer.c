@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <mpi.h>
+#include "contour3d.h"
+#include "./struct.h"
+#include "./memory.h"
+#include "./logger.h"
+#include "./config.h"
+#include "./canvas.h"
+#include "./output.h"
+#include "./writer.h"
+
+// background thread of the main process, which encodes and writes
+//   the composited images one after another
+// since the thread never calls MPI, the main thread is free to go on
+//   with the following frames
+
+// default number of images waiting to be written
+#define DEFAULT_QUEUE_SIZE 2
+
+// an image to be written, whose pixels ("memory") are owned by the job
+//   and are allocated by "malloc"
+// NOTE: the pixels are charged to the output subsystem
+//   so that the queued images are within the budget
+typedef struct {
+  // image file name, or NULL if the frame only goes to the stream
+  char * fname;
+  bool is_streamed;
+  void * memory;
+  size_t nbytes;
+  canvas_t canvas;
+} job_t;
+
+// ring buffer of the pending jobs,
+//   whose first "njobs" items (from "head") are valid
+// NOTE: allocated by "malloc", since the arena of the main thread
+//   is rewound at the end of every frame
+static job_t * jobs = NULL;
+static size_t capacity = 0;
+static size_t head = 0;
+static size_t njobs = 0;
+
+static pthread_t thread;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+// signalled when a job is pushed or the thread is asked to stop
+static pthread_cond_t cond_push = PTHREAD_COND_INITIALIZER;
+// signalled when a job is finished
+static pthread_cond_t cond_pop = PTHREAD_COND_INITIALIZER;
+static bool is_running = false;
+static bool is_stopping = false;
+// set when writing an image failed, cleared when reported
+static bool has_failed = false;
+
+static void release_job (
+    job_t * const job
+) {
+  free(job->fname);
+  free(job->memory);
+  contour3d_memory_discharge(CONTOUR3D_MEMORY_OUTPUT, job->nbytes);
+}
+
+static void * run (
+    void * const arg
+) {
+  (void)arg;
+  pthread_mutex_lock(&mutex);
+  while (true) {
+    while (0 == njobs && !is_stopping) {
+      pthread_cond_wait(&cond_push, &mutex);
+    }
+    if (0 == njobs) {
+      // asked to stop, and nothing is left
+      break;
+    }
+    job_t * const job = jobs + head;
+    pthread_mutex_unlock(&mutex);
+    const int retval = contour3d_output_write_serial(job->fname, job->is_streamed, &job->canvas);
+    release_job(job);
+    // everything the writer allocated for this image
+    contour3d_memory_free_all();
+    pthread_mutex_lock(&mutex);
+    // the slot is kept until the image is written,
+    //   so that at most "capacity" images are alive
+    head = (head + 1) % capacity;
+    njobs -= 1;
+    if (0 != retval) {
+      has_failed = true;
+    }
+    pthread_cond_broadcast(&cond_pop);
+  }
+  pthread_mutex_unlock(&mutex);
+  return NULL;
+}
+
+static int start (
+    void
+) {
+  const contour3d_config_t * const config = contour3d_config_get();
+  capacity = 0 == config->async_queue_size ? DEFAULT_QUEUE_SIZE : config->async_queue_size;
+  jobs = malloc(capacity * sizeof(job_t));
+  if (NULL == jobs) {
+    logger_error("failed to allocate image queue");
+    return 1;
+  }
+  head = 0;
+  njobs = 0;
+  is_stopping = false;
+  if (0 != pthread_create(&thread, NULL, run, NULL)) {
+    logger_error("failed to create image writer thread");
+    free(jobs);
+    jobs = NULL;
+    return 1;
+  }
+  is_running = true;
+  return 0;
+}
+
+// bytes of the copy of a canvas of "nitems" pixels held by a queued job,
+//   which needs the depths and the ids only to export them
+size_t contour3d_writer_get_job_size (
+    const size_t nitems,
+    const bool has_ids
+) {
+  return has_ids
+    ? contour3d_canvas_get_size(nitems, has_ids)
+    : nitems * sizeof(contour3d_color_t);
+}
+
+// hand a copy of the canvas over to the writer,
+//   blocking while the queue is full or the copy exceeds the budget
+int contour3d_writer_push (
+    const char fname[],
+    const bool is_streamed,
+    canvas_t * const canvas
+) {
+  if (!is_running) {
+    if (0 != start()) {
+      return 1;
+    }
+  }
+  job_t job = {
+    .fname = NULL,
+    .is_streamed = is_streamed,
+    .memory = NULL,
+    .nbytes = 0,
+    .canvas = *canvas,
+  };
+  job.canvas.comm_node = MPI_COMM_NULL;
+  job.canvas.comm_leaders = MPI_COMM_NULL;
+  job.canvas.win = MPI_WIN_NULL;
+  if (NULL != fname) {
+    const size_t nchars = strlen(fname) + 1;
+    job.fname = malloc(nchars * sizeof(char));
+    if (NULL == job.fname) {
+      logger_error("failed to allocate file name");
+      return 1;
+    }
+    memcpy(job.fname, fname, nchars * sizeof(char));
+  }
+  // pixels live in the arena of the main thread (or in a shared window),
+  //   which is rewound when the frame ends, and thus are copied
+  const size_t nitems = canvas->width * canvas->height;
+  const bool has_ids = NULL != canvas->ids;
+  const size_t nbytes = contour3d_writer_get_job_size(nitems, has_ids);
+  // the images being written are released sooner or later,
+  //   and thus the copy waits for them if it is not affordable yet
+  pthread_mutex_lock(&mutex);
+  while (0 != contour3d_memory_charge(CONTOUR3D_MEMORY_OUTPUT, nbytes)) {
+    if (0 == njobs) {
+      pthread_mutex_unlock(&mutex);
+      logger_error("image buffer exceeds memory budget (%zu bytes)", nbytes);
+      free(job.fname);
+      return 1;
+    }
+    pthread_cond_wait(&cond_pop, &mutex);
+  }
+  pthread_mutex_unlock(&mutex);
+  job.nbytes = nbytes;
+  job.memory = malloc(nbytes);
+  if (NULL == job.memory) {
+    logger_error("failed to allocate image buffer");
+    release_job(&job);
+    return 1;
+  }
+  if (has_ids) {
+    // depths, ids, and colors are contiguous
+    memcpy(job.memory, canvas->depths, nbytes);
+    contour3d_canvas_locate(
+        job.memory,
+        nitems,
+        has_ids,
+        &job.canvas.depths,
+        &job.canvas.ids,
+        &job.canvas.colors
+    );
+  } else {
+    memcpy(job.memory, canvas->colors, nbytes);
+    job.canvas.depths = NULL;
+    job.canvas.ids = NULL;
+    job.canvas.colors = job.memory;
+  }
+  pthread_mutex_lock(&mutex);
+  while (capacity == njobs) {
+    pthread_cond_wait(&cond_pop, &mutex);
+  }
+  jobs[(head + njobs) % capacity] = job;
+  njobs += 1;
+  pthread_cond_signal(&cond_push);
+  pthread_mutex_unlock(&mutex);
+  return 0;
+}
+
+// check (and clear) the failure of the images written so far
+bool contour3d_writer_has_failed (
+    void
+) {
+  pthread_mutex_lock(&mutex);
+  const bool retval = has_failed;
+  has_failed = false;
+  pthread_mutex_unlock(&mutex);
+  return retval;
+}
+
+// write all pending images and terminate the thread
+int contour3d_writer_flush (
+    void
+) {
+  if (is_running) {
+    pthread_mutex_lock(&mutex);
+    is_stopping = true;
+    pthread_cond_signal(&cond_push);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(thread, NULL);
+    free(jobs);
+    jobs = NULL;
+    is_running = false;
+  }
+  return contour3d_writer_has_failed() ? 1 : 0;
+}
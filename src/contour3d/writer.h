@@ -0,0 +1,27 @@
+#if !defined(CONTOUR3D_WRITER_H)
+#define CONTOUR3D_WRITER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "./struct.h"
+
+extern size_t contour3d_writer_get_job_size (
+    const size_t nitems,
+    const bool has_ids
+);
+
+extern int contour3d_writer_push (
+    const char fname[],
+    const bool is_streamed,
+    canvas_t * const canvas
+);
+
+extern bool contour3d_writer_has_failed (
+    void
+);
+
+extern int contour3d_writer_flush (
+    void
+);
+
+#endif // CONTOUR3D_WRITER_H
@@ -191,6 +191,7 @@ int main (
       .grids[1]   = grids[1],
       .grids[2]   = grids[2],
       .converter  = converter,
+      .converter_kind = CONTOUR3D_CONVERTER_IDENTITY,
       .threshold  = -0.25,
       .color.r    = 0x00,
       .color.g    = 0xFF,
@@ -207,6 +208,7 @@ int main (
       .grids[1]   = grids[1],
       .grids[2]   = grids[2],
       .converter  = converter,
+      .converter_kind = CONTOUR3D_CONVERTER_IDENTITY,
       .threshold  = +0.25,
       .color.r    = 0xFF,
       .color.g    = 0xFF,
@@ -305,6 +307,30 @@ int main (
     },
   };
   const size_t num_lines = sizeof(line_objs) / sizeof(line_objs[0]);
+  // optional settings, members which are not given are zero-initialised
+  // see also: include/contour3d.h
+  const contour3d_config_t config = {
+    .node_aware_compositing = false,
+    .composite_mode = CONTOUR3D_COMPOSITE_SORT_LAST,
+    .load_balancing = false,
+    .async_output = false,
+    .async_queue_size = 2,
+    .frame_callback = NULL,
+    .frame_callback_data = NULL,
+    .stream_format = CONTOUR3D_STREAM_NONE,
+    .stream_path = NULL,
+    .stream_fd = -1,
+    .stream_frame_rate = 25,
+    .export_depth = false,
+    .memory_budget = 0,
+    .print_profile = false,
+    .trace_path = NULL,
+    .num_threads = 1,
+    .pipelined_extraction = false,
+  };
+  if (0 != contour3d_configure(&config)) {
+    fprintf(stderr, "contour3d configuration failed\n");
+  }
   // draw 3d contour and output an image
   // see also: include/contour3d.h
   if (0 != contour3d_execute(
@@ -324,6 +350,10 @@ int main (
   )) {
     fprintf(stderr, "contour3d failed\n");
   }
+  // wait for the images being written in the background
+  if (0 != contour3d_flush()) {
+    fprintf(stderr, "contour3d flush failed\n");
+  }
   // clean-up
   free(grids[0]);
   free(grids[1]);